@@ -0,0 +1,24 @@
+#include "alphabet.h"
+
+// number of the letter with byte c, -1 if c isn't one
+#if ALPHABET == 26
+#define LETTER_NUMBER(c) ((c) >= 'a' && (c) <= 'z' ? (c) - 'a' : -1)
+#elif ALPHABET == 64
+#define LETTER_NUMBER(c) \
+    ((c) == '-' ? 0 : \
+     (c) >= '0' && (c) <= '9' ? (c) - '0' + 1 : \
+     (c) >= 'A' && (c) <= 'Z' ? (c) - 'A' + 11 : \
+     (c) == '_' ? 37 : \
+     (c) >= 'a' && (c) <= 'z' ? (c) - 'a' + 38 : -1)
+#else
+#define LETTER_NUMBER(c) ((c) == '\0' || (c) == '\n' || (c) == ' ' ? -1 : (c))
+#endif
+
+#define LETTERS4(c) LETTER_NUMBER(c), LETTER_NUMBER((c) + 1), LETTER_NUMBER((c) + 2), \
+                    LETTER_NUMBER((c) + 3)
+#define LETTERS16(c) LETTERS4(c), LETTERS4((c) + 4), LETTERS4((c) + 8), LETTERS4((c) + 12)
+#define LETTERS64(c) LETTERS16(c), LETTERS16((c) + 16), LETTERS16((c) + 32), LETTERS16((c) + 48)
+
+const short letter_numbers[256] = {
+    LETTERS64(0), LETTERS64(64), LETTERS64(128), LETTERS64(192)
+};
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <stdint.h>
+#include "bits.h"
+
+/* ALPHABET - characters words are made of, chosen when building with
+   make ALPHABET=26|64|256 (rebuild everything with make clean first when
+   switching):
+     26 - small english letters, the default.
+     64 - small and capital letters, digits, '-' and '_'.
+     256 - every byte but '\0', '\n' and ' ', which end words; UTF-8 words
+           are stored as their bytes.
+   Letters are numbered in the order of their bytes, so words in the order
+   of their letter numbers are in the order of memcmp. Snapshots are only
+   loaded by builds with the alphabet they were saved with.
+*/
+#ifndef ALPHABET
+#define ALPHABET 26
+#endif
+#define ALPHABET_SIZE ALPHABET
+
+#if ALPHABET != 26 && ALPHABET != 64 && ALPHABET != 256
+#error "ALPHABET must be 26, 64 or 256"
+#endif
+
+// letter_numbers[c] - number of the letter with byte c, -1 if c isn't a letter
+extern const short letter_numbers[256];
+
+// characters of the 64 letters, by letter number
+#define ALPHABET64_LETTERS "-0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ_abcdefghijklmnopqrstuvwxyz"
+
+// 1 if a character is a letter of the alphabet, 0 otherwise
+static inline int is_letter(char c){
+    return letter_numbers[(unsigned char)c] >= 0;
+}
+
+// number of a letter, which must be one. The two dense alphabets don't
+//  need the table
+static inline int letter_number_of(char c){
+#if ALPHABET == 26
+    return c - 'a';
+#elif ALPHABET == 256
+    return (unsigned char)c;
+#else
+    return letter_numbers[(unsigned char)c];
+#endif
+}
+
+// the letter with a given number
+static inline char letter_char(int x){
+#if ALPHABET == 26
+    return 'a' + x;
+#elif ALPHABET == 256
+    return x;
+#else
+    return ALPHABET64_LETTERS[x];
+#endif
+}
+
+
+/* LETTER SET - a bitmap with bit x set for letter x. One 32-bit word holds
+   all of a-z, so nodes keep their size in the default build.
+*/
+#if ALPHABET == 26
+typedef uint32_t LetterWord;
+#else
+typedef uint64_t LetterWord;
+#endif
+#define LETTER_WORD_BITS (8 * (int)sizeof(LetterWord))
+#define LETTER_WORDS ((ALPHABET_SIZE + LETTER_WORD_BITS - 1) / LETTER_WORD_BITS)
+
+typedef struct{
+    LetterWord words[LETTER_WORDS];
+} LetterSet;
+
+// number of bits set in a word of a letter set
+static inline int count_letter_bits(LetterWord word){
+    return sizeof(LetterWord) == 4 ? count_bits(word) : count_bits64(word);
+}
+
+// 1 if letter x is in a set, 0 otherwise
+static inline int letters_has(const LetterSet* set, int x){
+    return (set->words[x / LETTER_WORD_BITS] >> (x % LETTER_WORD_BITS)) & 1;
+}
+
+// number of letters in a set below letter x
+static inline int letters_rank(const LetterSet* set, int x){
+    int count = 0;
+    for (int i = 0; i < x / LETTER_WORD_BITS; ++i){
+        count += count_letter_bits(set->words[i]);
+    }
+    LetterWord below = ((LetterWord)1 << (x % LETTER_WORD_BITS)) - 1;
+    return count + count_letter_bits(set->words[x / LETTER_WORD_BITS] & below);
+}
+
+// number of letters in a set
+static inline int letters_count(const LetterSet* set){
+    int count = 0;
+    for (int i = 0; i < LETTER_WORDS; ++i){
+        count += count_letter_bits(set->words[i]);
+    }
+    return count;
+}
+
+// the first letter of a set that is x or comes after it, -1 if there is none
+static inline int letters_next(const LetterSet* set, int x){
+    for (int i = x / LETTER_WORD_BITS; i < LETTER_WORDS; ++i){
+        LetterWord word = set->words[i];
+        if (i == x / LETTER_WORD_BITS){
+            word &= ~(LetterWord)0 << (x % LETTER_WORD_BITS);
+        }
+        if (word != 0){
+            return i * LETTER_WORD_BITS + __builtin_ctzll(word);
+        }
+    }
+    return -1;
+}
+
+// the first letter of a set, -1 if it's empty
+static inline int letters_first(const LetterSet* set){
+    return letters_next(set, 0);
+}
+
+// 1 if a set has no letters, 0 otherwise
+static inline int letters_empty(const LetterSet* set){
+    for (int i = 0; i < LETTER_WORDS; ++i){
+        if (set->words[i] != 0){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static inline void letters_add(LetterSet* set, int x){
+    set->words[x / LETTER_WORD_BITS] |= (LetterWord)1 << (x % LETTER_WORD_BITS);
+}
+
+static inline void letters_remove(LetterSet* set, int x){
+    set->words[x / LETTER_WORD_BITS] &= ~((LetterWord)1 << (x % LETTER_WORD_BITS));
+}
+
+// for sets that are read by other threads: every word is changed and read
+//  atomically, though not all of them at once
+static inline void letters_add_atomic(LetterSet* set, int x){
+    __atomic_fetch_or(&set->words[x / LETTER_WORD_BITS],
+                      (LetterWord)1 << (x % LETTER_WORD_BITS), __ATOMIC_RELAXED);
+}
+
+static inline void letters_remove_atomic(LetterSet* set, int x){
+    __atomic_fetch_and(&set->words[x / LETTER_WORD_BITS],
+                       ~((LetterWord)1 << (x % LETTER_WORD_BITS)), __ATOMIC_RELAXED);
+}
+
+// for sets that are read by other threads while one thread changes them
+static inline void letters_add_shared(LetterSet* set, int x){
+    LetterWord* word = &set->words[x / LETTER_WORD_BITS];
+    __atomic_store_n(word, *word | (LetterWord)1 << (x % LETTER_WORD_BITS), __ATOMIC_RELAXED);
+}
+
+static inline void letters_remove_shared(LetterSet* set, int x){
+    LetterWord* word = &set->words[x / LETTER_WORD_BITS];
+    __atomic_store_n(word, *word & ~((LetterWord)1 << (x % LETTER_WORD_BITS)), __ATOMIC_RELAXED);
+}
+
+static inline LetterSet letters_load(const LetterSet* set){
+    LetterSet copy;
+    for (int i = 0; i < LETTER_WORDS; ++i){
+        copy.words[i] = __atomic_load_n(&set->words[i], __ATOMIC_RELAXED);
+    }
+    return copy;
+}
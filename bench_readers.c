@@ -0,0 +1,136 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "trie.h"
+
+/* Throughput of find in concurrent mode: for 1, 2, 4, ... reader threads
+   (up to the number of cores, or the first argument), every reader runs find
+   on random words while the main thread keeps inserting and deleting.
+   Usage: bench_readers [max_readers] [seconds_per_run]
+*/
+
+#define WORD_COUNT 100000
+#define WORD_LENGTH 12
+#define LETTERS 4
+
+char words[WORD_COUNT][WORD_LENGTH];
+atomic_int running;
+Dictionary* dict;
+
+typedef struct{
+    pthread_t thread;
+    unsigned int seed;
+    uint64_t finds;
+} Reader;
+
+
+// a random word over the first LETTERS letters
+void random_word(char* word, unsigned int* seed){
+    for (int i = 0; i < WORD_LENGTH; ++i){
+        word[i] = 'a' + rand_r(seed) % LETTERS;
+    }
+}
+
+
+void* read_words(void* argument){
+    Reader* reader = argument;
+    uint64_t finds = 0;
+    while (atomic_load_explicit(&running, memory_order_relaxed) == 1){
+        int index = rand_r(&reader->seed) % WORD_COUNT;
+        find(dict, words[index], 1 + rand_r(&reader->seed) % WORD_LENGTH);
+        ++finds;
+    }
+    reader->finds = finds;
+    return NULL;
+}
+
+
+double now(){
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+
+// run readers against a writer for a while, returns finds per second
+double run(int reader_count, double seconds, uint64_t* writes){
+    Reader* readers = calloc(reader_count, sizeof(Reader));
+    unsigned int seed = reader_count;
+    atomic_store(&running, 1);
+    for (int i = 0; i < reader_count; ++i){
+        readers[i].seed = 7919 * (i + 1);
+        pthread_create(&readers[i].thread, NULL, read_words, &readers[i]);
+    }
+
+    // keep the tree at about half of the words, with every id short-lived
+    double start = now();
+    *writes = 0;
+    int next_delete = 0;
+    int inserted = 0;
+    while (now() - start < seconds){
+        for (int i = 0; i < 256; ++i){
+            if (inserted < WORD_COUNT / 2 || rand_r(&seed) % 2 == 0){
+                if (insert(dict, words[rand_r(&seed) % WORD_COUNT], WORD_LENGTH) != -1){
+                    ++inserted;
+                }
+            }
+            else if (delete(dict, next_delete++) != -1){
+                --inserted;
+            }
+            ++*writes;
+        }
+    }
+    atomic_store(&running, 0);
+    double elapsed = now() - start;
+
+    uint64_t finds = 0;
+    for (int i = 0; i < reader_count; ++i){
+        pthread_join(readers[i].thread, NULL);
+        finds += readers[i].finds;
+    }
+    free(readers);
+    clear(dict);
+    return finds / elapsed;
+}
+
+
+int main(int argc, char* argv[]){
+    int max_readers = sysconf(_SC_NPROCESSORS_ONLN);
+    double seconds = 1.0;
+    if (argc > 1){
+        max_readers = atoi(argv[1]);
+    }
+    if (argc > 2){
+        seconds = atof(argv[2]);
+    }
+    if (max_readers < 1){
+        max_readers = 1;
+    }
+
+    unsigned int seed = 1;
+    for (int i = 0; i < WORD_COUNT; ++i){
+        random_word(words[i], &seed);
+    }
+    dict = dictionary_create();
+    if (dict == NULL){
+        return 1;
+    }
+    set_concurrent(dict, 1);
+
+    printf("readers finds_per_second finds_per_second_per_reader writes_per_second\n");
+    for (int readers = 1; readers <= max_readers; readers *= 2){
+        uint64_t writes;
+        double throughput = run(readers, seconds, &writes);
+        printf("%d %.0f %.0f %.0f\n", readers, throughput, throughput / readers,
+               writes / seconds);
+        if (readers < max_readers && readers * 2 > max_readers){
+            readers = max_readers / 2;
+        }
+    }
+    dictionary_destroy(dict);
+    return 0;
+}
@@ -0,0 +1,224 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "workload.h"
+
+/* Load generator for dictionary --serve: every connection sends the
+   commands of its own synthetic workload, one at a time, and waits for the
+   reply line before it sends the next one. The workload only has insert,
+   prev, delete, find and clear, which are answered with exactly one line
+   each as long as the server isn't run with --merged; list and stats,
+   which print more, are never sent, since there's no telling where their
+   replies end.
+   Prints one line of "key=value" pairs:
+     bench=serve connections=<n> ops=<n> seconds=<s> ops_per_s=<x>
+     p50_ns=<x> p99_ns=<x> p999_ns=<x>
+   Usage: bench_server <socket path> [--connections n] [workload options,
+          see gen_workload]
+     --connections - number of concurrent connections (default 4); each
+                     sends --commands commands, connection i with seed
+                     --seed + i.
+*/
+
+#define REPLY_BUFFER_SIZE (1 << 16)
+
+/* CLIENT - a connection and what it has measured.
+     workload - its commands.
+     samples - time from sending each command to receiving its reply, in
+               nanoseconds.
+     failed - 1 if the connection broke before all commands were answered.
+*/
+typedef struct{
+    pthread_t thread;
+    const char* path;
+    Workload workload;
+    uint32_t* samples;
+    long count;
+    int failed;
+} Client;
+
+
+uint64_t now_ns(){
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1000000000ull + time.tv_nsec;
+}
+
+
+int compare_samples(const void* a, const void* b){
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+
+// a socket connected to the server, -1 on fail
+int connect_to(const char* path){
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)){
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd != -1 && connect(fd, (struct sockaddr*)&address, sizeof(address)) == -1){
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+// send a whole line. Returns -1 on fail
+int send_line(int fd, const char* line, int length){
+    int done = 0;
+    while (done < length){
+        ssize_t count = send(fd, line + done, length - done, MSG_NOSIGNAL);
+        if (count < 0 && errno == EINTR){
+            continue;
+        }
+        if (count <= 0){
+            return -1;
+        }
+        done += count;
+    }
+    return 1;
+}
+
+
+void* run_client(void* argument){
+    Client* client = argument;
+    long commands = client->workload.commands;
+    char* line = malloc(WORKLOAD_MAX_LENGTH + 32);
+    char* reply = malloc(REPLY_BUFFER_SIZE);
+    client->samples = malloc(commands * sizeof(uint32_t) + 1);
+    int fd = connect_to(client->path);
+    if (line == NULL || reply == NULL || client->samples == NULL || fd == -1){
+        client->failed = 1;
+        free(line);
+        free(reply);
+        return NULL;
+    }
+
+    // reply[0 .. used - 1] has been received but not matched with a command yet
+    int used = 0;
+    for (long i = 0; i < commands; ++i){
+        int length = workload_command(&client->workload, line);
+        line[length] = '\n';
+        uint64_t start = now_ns();
+        if (send_line(fd, line, length + 1) == -1){
+            client->failed = 1;
+            break;
+        }
+        char* endline;
+        while ((endline = memchr(reply, '\n', used)) == NULL){
+            ssize_t count = 0;
+            if (used < REPLY_BUFFER_SIZE){
+                count = recv(fd, reply + used, REPLY_BUFFER_SIZE - used, 0);
+            }
+            if (count < 0 && errno == EINTR){
+                continue;
+            }
+            if (count <= 0){
+                client->failed = 1;
+                break;
+            }
+            used += count;
+        }
+        if (client->failed == 1){
+            break;
+        }
+        uint64_t time = now_ns() - start;
+        client->samples[client->count++] = time > UINT32_MAX ? UINT32_MAX : time;
+        int rest = used - (endline + 1 - reply);
+        memmove(reply, endline + 1, rest);
+        used = rest;
+    }
+    close(fd);
+    free(line);
+    free(reply);
+    return NULL;
+}
+
+
+int main(int argc, char* argv[]){
+    Workload workload;
+    int connections = 4;
+    workload_defaults(&workload);
+    if (argc < 2){
+        fprintf(stderr, "Usage: bench_server <socket path> [--connections n] [workload options]\n");
+        return 1;
+    }
+    for (int i = 2; i < argc; ){
+        int used = workload_option(&workload, argc, argv, i);
+        if (used == 0 && i + 1 < argc && strcmp(argv[i], "--connections") == 0){
+            connections = atoi(argv[i + 1]);
+            used = 2;
+        }
+        if (used <= 0){
+            fprintf(stderr, "Error: wrong parameter %s\n", argv[i]);
+            return 1;
+        }
+        i += used;
+    }
+    if (connections < 1){
+        fprintf(stderr, "Error: wrong number of connections\n");
+        return 1;
+    }
+
+    Client* clients = calloc(connections, sizeof(Client));
+    for (int i = 0; i < connections; ++i){
+        clients[i].path = argv[1];
+        clients[i].workload = workload;
+        clients[i].workload.seed = workload.seed + i;
+        if (workload_start(&clients[i].workload) == -1){
+            fprintf(stderr, "Error: wrong workload parameters\n");
+            return 1;
+        }
+    }
+    uint64_t start = now_ns();
+    for (int i = 0; i < connections; ++i){
+        if (pthread_create(&clients[i].thread, NULL, run_client, &clients[i]) != 0){
+            fprintf(stderr, "Error: cannot start connection %d\n", i);
+            return 1;
+        }
+    }
+    long total = 0;
+    int failed = 0;
+    for (int i = 0; i < connections; ++i){
+        pthread_join(clients[i].thread, NULL);
+        total += clients[i].count;
+        failed |= clients[i].failed;
+    }
+    double seconds = (now_ns() - start) * 1e-9;
+
+    uint32_t* samples = malloc(total * sizeof(uint32_t) + 1);
+    long count = 0;
+    for (int i = 0; i < connections; ++i){
+        memcpy(samples + count, clients[i].samples, clients[i].count * sizeof(uint32_t));
+        count += clients[i].count;
+        free(clients[i].samples);
+        workload_release(&clients[i].workload);
+    }
+    free(clients);
+    if (failed == 1){
+        fprintf(stderr, "Error: a connection to %s failed\n", argv[1]);
+    }
+    if (total > 0){
+        qsort(samples, total, sizeof(uint32_t), compare_samples);
+        printf("bench=serve connections=%d ops=%ld seconds=%.6f ops_per_s=%.0f p50_ns=%u p99_ns=%u "
+               "p999_ns=%u\n",
+               connections, total, seconds, total / seconds, samples[(long)(0.5 * total)],
+               samples[(long)(0.99 * total)], samples[(long)(0.999 * total)]);
+    }
+    free(samples);
+    return failed == 1 ? 1 : 0;
+}
@@ -0,0 +1,434 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "trie.h"
+#include "parse.h"
+#include "workload.h"
+
+/* Microbenchmarks of the trie functions, and replay of a workload file.
+   Every result is one line of "key=value" pairs:
+     bench=<name> ops=<n> seconds=<s> ops_per_s=<x> p50_ns=<x> p99_ns=<x>
+     p999_ns=<x> peak_rss_kb=<x>
+   Usage: bench_trie [workload options, see gen_workload] [--ops n] [--replay file]
+     --ops - number of calls in every microbenchmark (default 200000).
+     --replay - also run every command of a workload file and report each
+                command type separately; parsing is included in the times.
+*/
+
+/* LATENCIES - time of every operation of one benchmark, in nanoseconds. */
+typedef struct{
+    const char* name;
+    uint32_t* samples;
+    long count;
+    long capacity;
+    double seconds;
+} Latencies;
+
+// the dictionary every benchmark runs on
+Dictionary* dict;
+
+
+uint64_t now_ns(){
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1000000000ull + time.tv_nsec;
+}
+
+
+void latencies_init(Latencies* latencies, const char* name){
+    latencies->name = name;
+    latencies->samples = NULL;
+    latencies->count = 0;
+    latencies->capacity = 0;
+    latencies->seconds = 0;
+}
+
+
+void record(Latencies* latencies, uint64_t start, uint64_t end){
+    if (latencies->count == latencies->capacity){
+        latencies->capacity = latencies->capacity == 0 ? 1024 : 2 * latencies->capacity;
+        latencies->samples = realloc(latencies->samples, latencies->capacity * sizeof(uint32_t));
+    }
+    uint64_t time = end - start;
+    latencies->samples[latencies->count++] = time > UINT32_MAX ? UINT32_MAX : time;
+    latencies->seconds += time * 1e-9;
+}
+
+
+int compare_samples(const void* a, const void* b){
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+
+uint32_t percentile(const Latencies* latencies, double fraction){
+    long index = (long)(fraction * latencies->count);
+    if (index >= latencies->count){
+        index = latencies->count - 1;
+    }
+    return latencies->samples[index];
+}
+
+
+// print a result line and free the samples
+void report(Latencies* latencies){
+    if (latencies->count > 0){
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        qsort(latencies->samples, latencies->count, sizeof(uint32_t), compare_samples);
+        printf("bench=%s ops=%ld seconds=%.6f ops_per_s=%.0f p50_ns=%u p99_ns=%u p999_ns=%u peak_rss_kb=%ld\n",
+               latencies->name, latencies->count, latencies->seconds,
+               latencies->count / latencies->seconds, percentile(latencies, 0.5),
+               percentile(latencies, 0.99), percentile(latencies, 0.999), usage.ru_maxrss);
+        fflush(stdout);
+    }
+    free(latencies->samples);
+    latencies->samples = NULL;
+}
+
+
+// find on random inserted words, then on the same words extended by one letter
+void run_finds(Workload* workload, char* words, int* lengths, long ops,
+               const char* hit_name, const char* miss_name){
+    Latencies latencies;
+    latencies_init(&latencies, hit_name);
+    for (long i = 0; i < ops; ++i){
+        long x = workload_random(workload, ops);
+        uint64_t start = now_ns();
+        find(dict, words + x * workload->length_max, lengths[x]);
+        record(&latencies, start, now_ns());
+    }
+    report(&latencies);
+
+    // a word that's extended by one letter is almost never in the tree
+    latencies_init(&latencies, miss_name);
+    char* missing = malloc(workload->length_max + 1);
+    for (long i = 0; i < ops; ++i){
+        long x = workload_random(workload, ops);
+        memcpy(missing, words + x * workload->length_max, lengths[x]);
+        missing[lengths[x]] = 'a' + workload_random(workload, workload->letters);
+        uint64_t start = now_ns();
+        find(dict, missing, lengths[x] + 1);
+        record(&latencies, start, now_ns());
+    }
+    free(missing);
+    report(&latencies);
+}
+
+
+// every pattern within one edit of a word, tried with find until one is
+//  found: what a client without fuzzy_find would do. Returns find's result
+int expand_find(Workload* workload, const char* word, int length, char* variant){
+    if (find(dict, word, length) == 1){
+        return 1;
+    }
+    for (int i = 0; i <= length; ++i){
+        // letter i deleted, then every letter put in its place
+        if (i < length){
+            memcpy(variant, word, i);
+            memcpy(variant + i, word + i + 1, length - i - 1);
+            if (find(dict, variant, length - 1) == 1){
+                return 1;
+            }
+            memcpy(variant, word, length);
+            for (int letter = 0; letter < workload->letters; ++letter){
+                variant[i] = 'a' + letter;
+                if (variant[i] != word[i] && find(dict, variant, length) == 1){
+                    return 1;
+                }
+            }
+        }
+        // every letter put before letter i
+        memcpy(variant, word, i);
+        memcpy(variant + i + 1, word + i, length - i);
+        for (int letter = 0; letter < workload->letters; ++letter){
+            variant[i] = 'a' + letter;
+            if (find(dict, variant, length + 1) == 1){
+                return 1;
+            }
+        }
+    }
+    return -1;
+}
+
+
+// fuzzy_find within one edit of inserted words with a letter replaced, then
+//  the same patterns with every variant looked up by find
+void run_fuzzy(Workload* workload, char* words, int* lengths, long ops){
+    char* patterns = malloc(ops * (long)workload->length_max);
+    int* pattern_lengths = malloc(ops * sizeof(int));
+    char* variant = malloc(workload->length_max + 2);
+    for (long i = 0; i < ops; ++i){
+        char* pattern = patterns + i * workload->length_max;
+        long x = workload_random(workload, ops);
+        memcpy(pattern, words + x * workload->length_max, lengths[x]);
+        int replaced = workload_random(workload, lengths[x]);
+        pattern[replaced] = 'a' + workload_random(workload, workload->letters);
+        pattern_lengths[i] = lengths[x];
+    }
+
+    Latencies latencies;
+    latencies_init(&latencies, "fuzzy_find_k1");
+    for (long i = 0; i < ops; ++i){
+        uint64_t start = now_ns();
+        fuzzy_find(dict, patterns + i * workload->length_max, pattern_lengths[i], 1);
+        record(&latencies, start, now_ns());
+    }
+    report(&latencies);
+
+    latencies_init(&latencies, "fuzzy_expand_k1");
+    for (long i = 0; i < ops; ++i){
+        uint64_t start = now_ns();
+        expand_find(workload, patterns + i * workload->length_max, pattern_lengths[i], variant);
+        record(&latencies, start, now_ns());
+    }
+    report(&latencies);
+    free(patterns);
+    free(pattern_lengths);
+    free(variant);
+}
+
+
+// insert, find, prev and delete called one kind at a time
+void run_microbenchmarks(Workload* workload, long ops){
+    char* words = malloc(ops * (long)workload->length_max);
+    int* lengths = malloc(ops * sizeof(int));
+    for (long i = 0; i < ops; ++i){
+        lengths[i] = workload_word(workload, words + i * workload->length_max);
+    }
+
+    Latencies latencies;
+    latencies_init(&latencies, "insert");
+    int ids = 0;
+    for (long i = 0; i < ops; ++i){
+        uint64_t start = now_ns();
+        int id = insert(dict, words + i * workload->length_max, lengths[i]);
+        record(&latencies, start, now_ns());
+        if (id != -1){
+            ids = id + 1;
+        }
+    }
+    report(&latencies);
+
+    run_finds(workload, words, lengths, ops, "find_hit", "find_miss");
+
+    // whole words through the hash index; the first call builds it
+    lookup(dict, "a", 1);
+    latencies_init(&latencies, "lookup_hit");
+    for (long i = 0; i < ops; ++i){
+        long x = workload_random(workload, ops);
+        uint64_t start = now_ns();
+        lookup(dict, words + x * workload->length_max, lengths[x]);
+        record(&latencies, start, now_ns());
+    }
+    report(&latencies);
+    run_fuzzy(workload, words, lengths, ops);
+    // the same words once more, from the read-only compact tree
+    freeze(dict);
+    run_finds(workload, words, lengths, ops, "find_hit_frozen", "find_miss_frozen");
+    thaw(dict);
+
+    latencies_init(&latencies, "prev");
+    for (long i = 0; i < ops && ids > 0; ++i){
+        int id = workload_random(workload, ids);
+        int begin = workload_random(workload, workload->length_max);
+        int end = begin + workload_random(workload, workload->length_max);
+        uint64_t start = now_ns();
+        int result = prev(dict, id, begin, end);
+        record(&latencies, start, now_ns());
+        if (result != -1 && result + 1 > ids){
+            ids = result + 1;
+        }
+    }
+    report(&latencies);
+
+    latencies_init(&latencies, "delete");
+    for (int id = 0; id < ids; ++id){
+        uint64_t start = now_ns();
+        delete(dict, id);
+        record(&latencies, start, now_ns());
+    }
+    report(&latencies);
+
+    clear(dict);
+    free(words);
+    free(lengths);
+}
+
+
+// the words inserted again and every other one deleted, then the text
+//  compacted a slice at a time: every sample is the pause of one slice
+void run_compaction(Workload* workload, long ops){
+    char* word = malloc(workload->length_max);
+    set_compact_ratio(dict, 0);
+    for (long i = 0; i < ops; ++i){
+        insert(dict, word, workload_word(workload, word));
+    }
+    for (long id = 0; id < ops; id += 2){
+        delete(dict, id);
+    }
+    Latencies latencies;
+    latencies_init(&latencies, "compact_slice");
+    int state = 1;
+    while (state == 1){
+        uint64_t start = now_ns();
+        state = compact_step(dict);
+        record(&latencies, start, now_ns());
+    }
+    report(&latencies);
+    clear(dict);
+    set_compact_ratio(dict, COMPACT_RATIO);
+    free(word);
+}
+
+
+// suffixes of single long keys, each in an empty tree: a random one, and a
+//  periodic one, every suffix of which shares all of its letters with the
+//  one before, so that looking them up from the root takes quadratic time.
+//  Both take linear time along suffix links. The last kind is the bound
+//  insert_suffixes has with other words: the suffixes of a random key are
+//  all in the tree already as the suffixes of another word, so each one's
+//  letters are compared again, in quadratic time; it stops at the middle
+//  length
+void run_suffixes(Workload* workload){
+    static const int key_lengths[] = {1000, 10000, 100000};
+    static const char* kinds[] = {"random", "periodic", "along_words"};
+    char* key = malloc(key_lengths[2] + 1);
+    char name[64];
+    for (int kind = 0; kind < 3; ++kind){
+        for (int x = 0; x < (kind == 2 ? 2 : 3); ++x){
+            int length = key_lengths[x];
+            Latencies latencies;
+            snprintf(name, sizeof(name), "suffixes_%s_%d", kinds[kind], length);
+            latencies_init(&latencies, name);
+            for (int repeat = 0; repeat < 5; ++repeat){
+                for (int i = 0; i < length; ++i){
+                    key[i] = 'a' + (kind == 1 ? i % 2 : workload_random(workload, workload->letters));
+                }
+                if (kind == 2){
+                    // the key's suffixes are the other word's but its first
+                    suffixes(dict, insert(dict, key + 1, length - 1));
+                }
+                int id = insert(dict, key, length);
+                uint64_t start = now_ns();
+                suffixes(dict, id);
+                record(&latencies, start, now_ns());
+                clear(dict);
+            }
+            report(&latencies);
+        }
+    }
+    free(key);
+}
+
+
+// run a workload file through the parser and the trie
+int run_replay(const char* path){
+    int file = open(path, O_RDONLY);
+    if (file == -1 || dup2(file, STDIN_FILENO) == -1){
+        fprintf(stderr, "Error: cannot open %s\n", path);
+        return -1;
+    }
+    close(file);
+
+    static const char* names[] = {"replay_insert", "replay_prev", "replay_delete",
+                                  "replay_find", "replay_clear", "replay_other"};
+    Latencies latencies[6];
+    Latencies total;
+    for (int i = 0; i < 6; ++i){
+        latencies_init(&latencies[i], names[i]);
+    }
+    latencies_init(&total, "replay_all");
+
+    while (1){
+        uint64_t start = now_ns();
+        Command command = get_command();
+        int kind;
+        switch (command.query){
+        case INSERT:
+            insert(dict, command.string_arg, command.string_length);
+            kind = 0;
+            break;
+        case PREV:
+            prev(dict, command.int_args[0], command.int_args[1], command.int_args[2]);
+            kind = 1;
+            break;
+        case DELETE:
+            delete(dict, command.int_args[0]);
+            kind = 2;
+            break;
+        case FIND:
+            find(dict, command.string_arg, command.string_length);
+            kind = 3;
+            break;
+        case CLEAR:
+            clear(dict);
+            kind = 4;
+            break;
+        default:
+            kind = 5;
+            break;
+        }
+        if (command.query == END){
+            break;
+        }
+        uint64_t end = now_ns();
+        record(&latencies[kind], start, end);
+        record(&total, start, end);
+    }
+    for (int i = 0; i < 6; ++i){
+        report(&latencies[i]);
+    }
+    report(&total);
+    clear(dict);
+    return 1;
+}
+
+
+int main(int argc, char* argv[]){
+    Workload workload;
+    long ops = 200000;
+    const char* replay = NULL;
+    workload_defaults(&workload);
+    for (int i = 1; i < argc; ){
+        int used = workload_option(&workload, argc, argv, i);
+        if (used == 0 && i + 1 < argc && strcmp(argv[i], "--ops") == 0){
+            ops = atol(argv[i + 1]);
+            used = 2;
+        }
+        else if (used == 0 && i + 1 < argc && strcmp(argv[i], "--replay") == 0){
+            replay = argv[i + 1];
+            used = 2;
+        }
+        if (used <= 0){
+            fprintf(stderr, "Error: wrong parameter %s\n", argv[i]);
+            return 1;
+        }
+        i += used;
+    }
+    if (ops < 1 || workload_start(&workload) == -1){
+        fprintf(stderr, "Error: wrong workload parameters\n");
+        return 1;
+    }
+
+    dict = dictionary_create();
+    if (dict == NULL){
+        fprintf(stderr, "Error: cannot create the dictionary\n");
+        return 1;
+    }
+    run_microbenchmarks(&workload, ops);
+    run_compaction(&workload, ops);
+    run_suffixes(&workload);
+    workload_release(&workload);
+    if (replay != NULL && run_replay(replay) == -1){
+        return 1;
+    }
+    dictionary_destroy(dict);
+    return 0;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdint.h>
+
+// number of bits set in a bitmap
+static inline int count_bits(uint32_t bitmap){
+    bitmap = bitmap - ((bitmap >> 1) & 0x55555555);
+    bitmap = (bitmap & 0x33333333) + ((bitmap >> 2) & 0x33333333);
+    bitmap = (bitmap + (bitmap >> 4)) & 0x0F0F0F0F;
+    return (bitmap * 0x01010101) >> 24;
+}
+
+// number of bits set in a 64-bit bitmap
+static inline int count_bits64(uint64_t bitmap){
+    return count_bits((uint32_t)bitmap) + count_bits((uint32_t)(bitmap >> 32));
+}
@@ -1,100 +1,835 @@
 #include "trie.h"
 #include "parse.h"
+#include "output.h"
+#include "ring.h"
+#include "server.h"
+#include "journal.h"
+#include "trace.h"
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#define PIPELINE_CAPACITY 1024  // commands or results waiting between two stages
+#define BATCH_SIZE 4096         // inserts, deletes and finds run together in sharded mode
+
+/* RESULT - everything a command writes.
+     text - line for stdout, followed by number if has_number == 1;
+            nothing is written if it's NULL.
+     nodes - number of nodes to write to stderr, -1 if nothing is written.
+     report - lines of statistics for stdout, NULL if there are none.
+     dump - lines of statistics for stderr, NULL if there are none.
+     end - 1 if this was the last command.
+   report and dump are freed once they're written.
+*/
+typedef struct{
+    const char* text;
+    int number;
+    int has_number;
+    int nodes;
+    char* report;
+    char* dump;
+    int end;
+} Result;
+
+/* REQUEST - a parsed command waiting to be executed in pipelined mode.
+     storage - copy of the string argument, if the input it points to
+               would be overwritten before the command is executed.
+*/
+typedef struct{
+    Command command;
+    char* storage;
+    int storage_capacity;
+} Request;
+
+// write the number of nodes to stderr after each command
+int vmode = 0;
 
 // if nodes_info == 1 after completing a command, our program
 // writes the number of nodes to stderr.
 int nodes_info = 1;
 
-void ignore(){
+// write statistics to stderr after every stats_interval commands, never if it's 0
+long stats_interval = 0;
+long commands_done = 0;
+
+/* CONTEXT - a dictionary with a name; use <name> makes it the current one,
+   which every other command works on, and creates it if there is none with
+   that name yet. The one commands work on at the start is named "default".
+*/
+typedef struct{
+    char* name;
+    int name_length;
+    Dictionary* dictionary;
+} Context;
+
+Context* contexts = NULL;
+int context_count = 0;
+int context_capacity = 0;
+Dictionary* current = NULL;
+
+// settings of every created dictionary, from the command line
+int shard_workers = 0;
+int thaw_on_write = 1;
+int compact_ratio = -1;  // -1 leaves the default
+
+// 1 once the journal is replayed and new commands are appended to it
+int journaling = 0;
+// the dictionary the commands at the end of the journal work on
+Dictionary* journaled = NULL;
+
+// 1 if the input lines and their replies are recorded in a trace
+int tracing = 0;
+// stdout lines of the command being written, for the trace
+OutputText replies = {NULL, 0, 0};
+
+// names of the command types in statistics
+const char* const command_names[] = {
+    [INSERT] = "insert", [PREV] = "prev", [DELETE] = "delete", [FIND] = "find",
+    [CLEAR] = "clear", [SAVE] = "save", [LOAD] = "load", [STATS] = "stats",
+    [COUNT] = "count", [LIST] = "list", [BULKLOAD] = "bulkload",
+    [FREEZE] = "freeze", [THAW] = "thaw", [LOOKUP] = "lookup",
+    [SUFFIXES] = "suffixes", [FUZZYFIND] = "fuzzyfind", [COMPACT] = "compact",
+    [USE] = "use", [IGNORE] = "ignored"
+};
+
+// stages of the pipelined mode: parse -> requests -> execute -> results -> output
+Ring requests;
+Ring results;
+
+/* BATCH - inserts, deletes and finds collected for run_batch in sharded mode.
+     text - copies of the words, if the input they point to would be
+            overwritten before the batch runs; offsets[x] is where the word
+            of operations[x] starts in it.
+*/
+TrieOperation operations[BATCH_SIZE];
+int offsets[BATCH_SIZE];
+int batch_count = 0;
+char* batch_text = NULL;
+int batch_text_length = 0;
+int batch_text_capacity = 0;
+
+void ignore(Result* result){
     nodes_info = 0;
-    printf("ignored\n");
+    result->text = "ignored";
 }
 
-int main(int argc, char* argv[]){
-    int vmode = 0;
+// copy a command's string argument to a null-terminated string; needs to be freed
+char* argument_copy(Command command){
+    char* copy = malloc(command.string_length + 1);
+    memcpy(copy, command.string_arg, command.string_length);
+    copy[command.string_length] = 0;
+    return copy;
+}
+
+uint64_t now_ns(){
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1000000000ull + time.tv_nsec;
+}
+
+// all statistics as "\n"-terminated lines; needs to be freed
+char* stats_report(){
+    StatsText report = {NULL, 0, 0};
+    write_memory_stats(current, &report);
+    stats_write(&report, command_names, sizeof(command_names) / sizeof(command_names[0]));
+    return report.text;
+}
+
+// add a listed word to a report as a line of its own
+void list_line(const char* word, int length, void* report){
+    stats_printf(report, "%.*s\n", length, word);
+}
+
+// the dictionary with a given name, created if there is none yet. Returns
+//  NULL on fail
+Dictionary* context_named(const char* name, int length){
+    for (int i = 0; i < context_count; ++i){
+        if (contexts[i].name_length == length && memcmp(contexts[i].name, name, length) == 0){
+            return contexts[i].dictionary;
+        }
+    }
+    if (context_count == context_capacity){
+        int capacity = context_capacity == 0 ? 4 : 2 * context_capacity;
+        Context* grown = realloc(contexts, capacity * sizeof(Context));
+        if (grown == NULL){
+            return NULL;
+        }
+        contexts = grown;
+        context_capacity = capacity;
+    }
+    Dictionary* dictionary = dictionary_create();
+    char* copy = malloc(length + 1);
+    if (dictionary == NULL || copy == NULL ||
+        (shard_workers > 0 && set_sharded(dictionary, shard_workers) == -1)){
+        if (dictionary != NULL){
+            dictionary_destroy(dictionary);
+        }
+        free(copy);
+        return NULL;
+    }
+    set_thaw_on_write(dictionary, thaw_on_write);
+    if (compact_ratio != -1){
+        set_compact_ratio(dictionary, compact_ratio);
+    }
+    memcpy(copy, name, length);
+    copy[length] = '\0';
+    contexts[context_count].name = copy;
+    contexts[context_count].name_length = length;
+    contexts[context_count].dictionary = dictionary;
+    ++context_count;
+    return dictionary;
+}
+
+// destroy every dictionary
+void release_contexts(){
+    for (int i = 0; i < context_count; ++i){
+        dictionary_destroy(contexts[i].dictionary);
+        free(contexts[i].name);
+    }
+    free(contexts);
+    contexts = NULL;
+    context_count = 0;
+    context_capacity = 0;
+    current = NULL;
+}
+
+// append a command that was run on the current dictionary to the journal,
+//  after a use of it if the journal's commands work on another one. The
+//  commands that modify the dictionary are journaled even if they fail, so
+//  that they fail the same way when they're run again; a load or bulkload
+//  only if it succeeds, with a copy of its file kept by the journal. A save
+//  of the only dictionary starts the journal over
+void journal_command(Command command, int result){
+    if (journaling == 0){
+        return;
+    }
+    char* path = NULL;
+    switch (command.query){
+    case SAVE:
+        if (result != -1 && context_count == 1){
+            path = argument_copy(command);
+            journal_checkpoint(path, is_frozen(current));
+            free(path);
+        }
+        return;
+    case LOAD:
+    case BULKLOAD:
+        if (result == -1){
+            return;
+        }
+        char* copy = argument_copy(command);
+        path = journal_keep(copy, command.query == BULKLOAD);
+        free(copy);
+        if (path == NULL){
+            return;
+        }
+        command.string_arg = path;
+        command.string_length = strlen(path);
+        break;
+    case INSERT:
+    case PREV:
+    case DELETE:
+    case SUFFIXES:
+    case CLEAR:
+    case FREEZE:
+    case THAW:
+        break;
+    default:
+        return;
+    }
+    if (journaled != current){
+        for (int i = 0; i < context_count; ++i){
+            if (contexts[i].dictionary == current){
+                Command use = {USE, contexts[i].name, contexts[i].name_length, {0, 0, 0}};
+                journal_append(use);
+            }
+        }
+        journaled = current;
+    }
+    journal_append(command);
+    free(path);
+}
+
+// a result with a line made of text followed by a number
+void numbered(Result* result, const char* text, int number){
+    result->text = text;
+    result->number = number;
+    result->has_number = 1;
+}
+
+// a result of an insert, prev or delete that returned result
+void id_result(Result* output, const char* text, int result){
+    if (result != -1){
+        numbered(output, text, result);
+    }
+    else{
+        ignore(output);
+    }
+}
+
+// a result of a find that returned result
+void find_result(Result* output, int result){
     nodes_info = 0;
+    if (result == -1){
+        output->text = "NO";
+    }
+    else{
+        output->text = "YES";
+    }
+}
 
-    if (argc > 2){
-        puts("Error: too many parameters.\n");
-        return 1;
+// add the node count and statistics to a command's result
+void finish_result(Result* output, query_type query, uint64_t nanoseconds, int nodes){
+    if (STATS_ENABLED == 1){
+        stats_command(query, nanoseconds);
     }
-    else if (argc == 2){
-        if (strcmp(argv[1], "-v") == 0){
-            vmode = 1;
+    if (nodes_info == 1){
+        output->nodes = nodes;
+    }
+    ++commands_done;
+    if (stats_interval > 0 && commands_done % stats_interval == 0){
+        output->dump = stats_report();
+    }
+}
+
+// call one of the trie functions and return what it has to print
+Result execute(Command command){
+    Result output = {NULL, 0, 0, -1, NULL, NULL, 0};
+    int result = 0;
+    char* path;
+    uint64_t start = STATS_ENABLED == 1 ? now_ns() : 0;
+    nodes_info = vmode;
+    switch (command.query){
+    case INSERT:
+        id_result(&output, "word number: ", insert(current, command.string_arg, command.string_length));
+        break;
+    case PREV:
+        id_result(&output, "word number: ",
+                  prev(current, command.int_args[0], command.int_args[1], command.int_args[2]));
+        break;
+    case DELETE:
+        id_result(&output, "deleted: ", delete(current, command.int_args[0]));
+        break;
+    case SUFFIXES:
+        id_result(&output, "words inserted: ", suffixes(current, command.int_args[0]));
+        break;
+    case FIND:
+        find_result(&output, find(current, command.string_arg, command.string_length));
+        break;
+    case FUZZYFIND:
+        find_result(&output, fuzzy_find(current, command.string_arg, command.string_length,
+                                         command.int_args[0]));
+        break;
+    case CLEAR:
+        clear(current);
+        output.text = "cleared";
+        break;
+    case SAVE:
+        path = argument_copy(command);
+        result = save(current, path);
+        free(path);
+        if (result != -1){
+            output.text = "saved";
         }
         else{
-            printf("Error: unknown parameter %s", argv[1]);
-            return 1;
+            ignore(&output);
+        }
+        break;
+    case LOAD:
+        path = argument_copy(command);
+        result = load(current, path);
+        free(path);
+        if (result != -1){
+            output.text = "loaded";
         }
+        else{
+            ignore(&output);
+        }
+        break;
+    case BULKLOAD:
+        path = argument_copy(command);
+        result = bulkload(current, path);
+        free(path);
+        if (result != -1){
+            numbered(&output, "words loaded: ", result);
+        }
+        else{
+            ignore(&output);
+        }
+        break;
+    case FREEZE:
+        if (freeze(current) != -1){
+            output.text = "frozen";
+        }
+        else{
+            ignore(&output);
+        }
+        break;
+    case THAW:
+        thaw(current);
+        output.text = "thawed";
+        break;
+    case COMPACT:
+        result = compact(current);
+        if (result != -1){
+            numbered(&output, "text bytes: ", result);
+        }
+        else{
+            ignore(&output);
+        }
+        break;
+    case STATS:
+        nodes_info = 0;
+        output.report = stats_report();
+        break;
+    case LOOKUP:
+        nodes_info = 0;
+        result = lookup(current, command.string_arg, command.string_length);
+        if (result != -1){
+            numbered(&output, "word number: ", result);
+        }
+        else{
+            output.text = "NO";
+        }
+        break;
+    case COUNT:
+        nodes_info = 0;
+        numbered(&output, "count: ", count_prefix(current, command.string_arg, command.string_length));
+        break;
+    case LIST:{
+        // the words come before the line with their number
+        StatsText report = {NULL, 0, 0};
+        nodes_info = 0;
+        result = list_prefix(current, command.string_arg, command.string_length,
+                             command.int_args[0], list_line, &report);
+        stats_printf(&report, "listed: %d\n", result);
+        output.report = report.text;
+        break;
+    }
+    case USE:{
+        Dictionary* dictionary = context_named(command.string_arg, command.string_length);
+        if (dictionary != NULL){
+            current = dictionary;
+            output.text = "using";
+        }
+        else{
+            ignore(&output);
+        }
+        break;
+    }
+    case END:
+        release_contexts();
+        output.end = 1;
+        return output;
+    default:
+        ignore(&output);
+        break;
     }
+    journal_command(command, result);
+    uint64_t end = STATS_ENABLED == 1 ? now_ns() : 0;
+    finish_result(&output, command.query, end - start, nodes_info == 1 ? get_node_count(current) : -1);
+    return output;
+}
 
-    Command command;
-    int result;
-    // main loop: accept the command from parser and call one of the trie functions
-    while (1){
-        if (vmode == 1){
-            nodes_info = 1;
-        }
-        // string_arg might get allocated, need to free it at the end
-        command = get_command();
-        switch (command.query){
-        case INSERT:
-            result = insert(command.string_arg);
-            if (result != -1){
-                printf("word number: %d\n", result);
-            }
-            else{
-                ignore();
-            }
+// write every line of a report and free it
+void write_report(output_stream stream, char* report){
+    if (report == NULL){
+        return;
+    }
+    for (char* line = report; *line != '\0'; ){
+        char* endline = strchr(line, '\n');
+        *endline = '\0';
+        output_line(stream, line);
+        line = endline + 1;
+    }
+    free(report);
+}
+
+// record the line a command was read from in the trace
+void trace_input(Command command){
+    if (tracing == 1 && command.query != END){
+        int length;
+        const char* line = last_line(&length);
+        trace_command(line, length);
+    }
+}
+
+// write what a command printed
+void write_result(Result* result){
+    if (result->end == 1){
+        output_flush();
+        return;
+    }
+    if (tracing == 1){
+        output_copy(&replies);
+    }
+    if (result->text != NULL && result->has_number == 1){
+        output_number(STREAM_OUT, result->text, result->number);
+    }
+    else if (result->text != NULL){
+        output_line(STREAM_OUT, result->text);
+    }
+    write_report(STREAM_OUT, result->report);
+    if (result->nodes != -1){
+        output_number(STREAM_ERR, "nodes: ", result->nodes);
+    }
+    write_report(STREAM_ERR, result->dump);
+    if (tracing == 1){
+        output_copy(NULL);
+        trace_replies(replies.data, replies.used);
+        replies.used = 0;
+    }
+    output_command_done();
+}
+
+// run the collected batch and write the result of every command in it
+void flush_batch(){
+    if (batch_count == 0){
+        return;
+    }
+    for (int i = 0; i < batch_count; ++i){
+        if (offsets[i] != -1){
+            operations[i].word = batch_text + offsets[i];
+        }
+    }
+    uint64_t start = STATS_ENABLED == 1 ? now_ns() : 0;
+    run_batch(current, operations, batch_count);
+    // commands in a batch overlap, each one is counted with the mean time
+    uint64_t mean = STATS_ENABLED == 1 ? (now_ns() - start) / batch_count : 0;
+
+    static const query_type queries[] = {[TRIE_INSERT] = INSERT, [TRIE_DELETE] = DELETE,
+                                         [TRIE_FIND] = FIND};
+    for (int i = 0; i < batch_count; ++i){
+        Result output = {NULL, 0, 0, -1, NULL, NULL, 0};
+        nodes_info = vmode;
+        switch (operations[i].type){
+        case TRIE_INSERT:
+            id_result(&output, "word number: ", operations[i].result);
             break;
-        case PREV:
-            result = prev(command.int_args[0], command.int_args[1], command.int_args[2]);
-            if (result != -1){
-                printf("word number: %d\n", result);
-            }
-            else{
-                ignore();
-            }
+        case TRIE_DELETE:
+            id_result(&output, "deleted: ", operations[i].result);
             break;
-        case DELETE:
-            result = delete(command.int_args[0]);
-            if (result != -1){
-                printf("deleted: %d\n", result);
-            }
-            else{
-                ignore();
-            }
+        default:
+            find_result(&output, operations[i].result);
             break;
-        case FIND:
-            nodes_info = 0;
-            result = find(command.string_arg);
-            if (result == -1){
-                printf("NO\n");
-            }
-            else{
-                printf("YES\n");
+        }
+        if (operations[i].type != TRIE_FIND){
+            Command command = {queries[operations[i].type], operations[i].word,
+                               operations[i].length, {operations[i].id, 0, 0}};
+            journal_command(command, operations[i].result);
+        }
+        finish_result(&output, queries[operations[i].type], mean, operations[i].nodes);
+        write_result(&output);
+    }
+    batch_count = 0;
+    batch_text_length = 0;
+}
+
+// add an insert, delete or find to the batch
+void add_to_batch(Command command, int stable){
+    TrieOperation* operation = &operations[batch_count];
+    operation->type = command.query == INSERT ? TRIE_INSERT :
+                      (command.query == DELETE ? TRIE_DELETE : TRIE_FIND);
+    operation->word = command.string_arg;
+    operation->length = command.string_length;
+    operation->id = command.int_args[0];
+    offsets[batch_count] = -1;
+    if (stable == 0 && command.query != DELETE){
+        if (batch_text_length + command.string_length > batch_text_capacity){
+            batch_text_capacity = 2 * (batch_text_length + command.string_length);
+            batch_text = realloc(batch_text, batch_text_capacity);
+        }
+        memcpy(batch_text + batch_text_length, command.string_arg, command.string_length);
+        offsets[batch_count] = batch_text_length;
+        batch_text_length += command.string_length;
+    }
+    ++batch_count;
+}
+
+// main loop of the sharded mode: inserts, deletes and finds in a row are
+//  run as one batch, anything else runs on its own once the batch is done
+int run_sharded(){
+    int stable = arguments_stable();
+    while (1){
+        Command command = get_command();
+        trace_input(command);
+        if (command.query == INSERT || command.query == DELETE || command.query == FIND){
+            if (batch_count == BATCH_SIZE){
+                flush_batch();
             }
-            break;
-        case CLEAR:
-            clear();
-            printf("cleared\n");
-            break;
-        case END:
-	    clear();
+            add_to_batch(command, stable);
+            continue;
+        }
+        flush_batch();
+        Result result = execute(command);
+        write_result(&result);
+        if (result.end == 1){
             return 0;
-            break;
-        default:
-            ignore();
-            break;
         }
-        if (nodes_info == 1){
-            fprintf(stderr, "nodes: %d\n", get_node_count());
+    }
+}
+
+// run a command of the journal on recovery; what it prints is dropped
+void recover_command(Command command){
+    Result result = execute(command);
+    free(result.report);
+    free(result.dump);
+}
+
+// run a command of a server client on the dictionary it uses; every client
+//  starts on the default one
+void serve_command(Command command, void** session){
+    current = *session != NULL ? *session : contexts[0].dictionary;
+    Result result = execute(command);
+    *session = current;
+    write_result(&result);
+}
+
+// first stage of the pipelined mode, reads commands into requests
+void* parse_stage(void* unused){
+    int stable = arguments_stable();
+    query_type query = IGNORE;
+    while (query != END){
+        Request* request;
+        while ((request = ring_back(&requests)) == NULL){
+            sched_yield();
+        }
+        Command command = get_command();
+        trace_input(command);
+        if (stable == 0 && command.string_length > 0){
+            if (command.string_length > request->storage_capacity){
+                free(request->storage);
+                request->storage = malloc(command.string_length);
+                request->storage_capacity = command.string_length;
+            }
+            memcpy(request->storage, command.string_arg, command.string_length);
+            command.string_arg = request->storage;
+        }
+        request->command = command;
+        query = command.query;
+        ring_push(&requests);
+    }
+    return NULL;
+}
+
+// last stage of the pipelined mode, writes results in the order they come
+void* output_stage(void* unused){
+    int end = 0;
+    while (end == 0){
+        Result* result;
+        while ((result = ring_front(&results)) == NULL){
+            sched_yield();
+        }
+        write_result(result);
+        end = result->end;
+        ring_pop(&results);
+    }
+    return NULL;
+}
+
+// run parsing, the trie and output on three threads; same output as the loop in main
+int run_pipelined(){
+    pthread_t parser;
+    pthread_t writer;
+    if (ring_init(&requests, PIPELINE_CAPACITY, sizeof(Request)) == -1 ||
+        ring_init(&results, PIPELINE_CAPACITY, sizeof(Result)) == -1 ||
+        pthread_create(&parser, NULL, parse_stage, NULL) != 0){
+        printf("Error: cannot start the pipeline");
+        return 1;
+    }
+    if (pthread_create(&writer, NULL, output_stage, NULL) != 0){
+        printf("Error: cannot start the pipeline");
+        return 1;
+    }
+
+    int end = 0;
+    while (end == 0){
+        Request* request;
+        Result* result;
+        while ((request = ring_front(&requests)) == NULL){
+            sched_yield();
+        }
+        while ((result = ring_back(&results)) == NULL){
+            sched_yield();
         }
-        free(command.string_arg);
+        // the request keeps its slot until the command is done with its argument
+        *result = execute(request->command);
+        end = result->end;
+        ring_pop(&requests);
+        ring_push(&results);
     }
 
+    pthread_join(parser, NULL);
+    pthread_join(writer, NULL);
+    for (size_t i = 0; i < PIPELINE_CAPACITY; ++i){
+        free(((Request*)requests.elements)[i].storage);
+    }
+    ring_release(&requests);
+    ring_release(&results);
     return 0;
 }
+
+int main(int argc, char* argv[]){
+    output_mode mode = OUTPUT_SEPARATE;
+    const char* snapshot_path = NULL;
+    const char* words_path = NULL;
+    const char* serve_path = NULL;
+    const char* journal_file = NULL;
+    const char* trace_file = NULL;
+    journal_sync journal_level = JOURNAL_WRITE;
+    long crash_after = 0;
+    int pipelined = 0;
+
+    for (int i = 1; i < argc; ++i){
+        if (strcmp(argv[i], "-v") == 0){
+            vmode = 1;
+        }
+        else if (strcmp(argv[i], "--ordered") == 0){
+            // keep stdout and stderr lines in the order they were produced
+            mode = OUTPUT_ORDERED;
+        }
+        else if (strcmp(argv[i], "--merged") == 0){
+            // write stderr lines to stdout too, tagged with their stream
+            mode = OUTPUT_MERGED;
+        }
+        else if (strcmp(argv[i], "--load") == 0 && i + 1 < argc){
+            // start with the tree from a snapshot file
+            snapshot_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--bulkload") == 0 && i + 1 < argc){
+            // start with the words of a file with one word per line
+            words_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--frozen-writes") == 0 && i + 1 < argc &&
+                 (strcmp(argv[i + 1], "thaw") == 0 || strcmp(argv[i + 1], "reject") == 0)){
+            // what insert, prev, delete and bulkload do to a frozen tree
+            thaw_on_write = strcmp(argv[++i], "thaw") == 0;
+        }
+        else if (strcmp(argv[i], "--compact-ratio") == 0 && i + 1 < argc){
+            // compact the text of the words once it takes a given number of
+            //  times as much as it would after a compaction, never if it's 0
+            compact_ratio = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--stats-every") == 0 && i + 1 < argc){
+            // write statistics to stderr after every given number of commands
+            stats_interval = atol(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--shards") == 0 && i + 1 < argc){
+            // run inserts, deletes and finds for different first letters
+            //  in parallel on a given number of threads
+            shard_workers = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc){
+            // answer the commands of clients of a unix socket at a given path
+            serve_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--journal") == 0 && i + 1 < argc){
+            // run the commands of a journal file left by an earlier run, after
+            //  --load and --bulkload, then append the commands that modify
+            //  the dictionaries to it
+            journal_file = argv[++i];
+        }
+        else if (strcmp(argv[i], "--journal-sync") == 0 && i + 1 < argc &&
+                 (strcmp(argv[i + 1], "none") == 0 || strcmp(argv[i + 1], "write") == 0 ||
+                  strcmp(argv[i + 1], "fsync") == 0)){
+            // what a crash may lose, see journal_sync; write by default
+            ++i;
+            journal_level = strcmp(argv[i], "none") == 0 ? JOURNAL_NONE :
+                            (strcmp(argv[i], "write") == 0 ? JOURNAL_WRITE : JOURNAL_FSYNC);
+        }
+        else if (strcmp(argv[i], "--crash-after") == 0 && i + 1 < argc){
+            // kill the program once a given number of commands is journaled
+            crash_after = atol(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc){
+            // record the input lines, when they're read and what they print
+            //  in a trace file for replay_trace; not with --serve
+            trace_file = argv[++i];
+        }
+        else if (strcmp(argv[i], "--pipeline") == 0){
+            // parse, execute and write commands on separate threads
+            pipelined = 1;
+        }
+        else{
+            printf("Error: unknown parameter %s", argv[i]);
+            return 1;
+        }
+    }
+    output_init(mode);
+    if (trace_file != NULL && serve_path != NULL){
+        printf("Error: --trace doesn't work with --serve");
+        return 1;
+    }
+    if (trace_file != NULL && trace_open(trace_file) == -1){
+        printf("Error: cannot write trace %s", trace_file);
+        return 1;
+    }
+    tracing = trace_file != NULL;
+    // sharding is set up with the dictionary, before anything is loaded into it
+    current = context_named("default", strlen("default"));
+    if (current == NULL && shard_workers > 0){
+        printf("Error: cannot start %d shard workers", shard_workers);
+        return 1;
+    }
+    if (current == NULL){
+        printf("Error: cannot create the dictionary");
+        return 1;
+    }
+    if (snapshot_path != NULL && load(current, snapshot_path) == -1){
+        printf("Error: cannot load snapshot %s", snapshot_path);
+        return 1;
+    }
+    if (words_path != NULL && bulkload(current, words_path) == -1){
+        printf("Error: cannot load words %s", words_path);
+        return 1;
+    }
+    if (journal_file != NULL){
+        long recovered = journal_open(journal_file, journal_level, recover_command);
+        if (recovered == -1){
+            printf("Error: cannot open journal %s", journal_file);
+            return 1;
+        }
+        output_number(STREAM_ERR, "commands recovered: ", recovered);
+        // the input's commands start on the default dictionary again
+        journaled = current;
+        current = contexts[0].dictionary;
+        journaling = 1;
+        journal_crash_after(crash_after);
+        output_on_flush(journal_commit);
+    }
+    int status = 0;
+    if (serve_path != NULL){
+        int served = serve(serve_path, serve_command);
+        release_contexts();
+        output_flush();
+        if (served == -1){
+            printf("Error: cannot serve on %s", serve_path);
+            status = 1;
+        }
+    }
+    else if (pipelined == 1){
+        status = run_pipelined();
+    }
+    else if (shard_workers > 0){
+        status = run_sharded();
+    }
+    else{
+        // main loop: accept the command from parser and call one of the trie functions
+        while (1){
+            Command command = get_command();
+            trace_input(command);
+            Result result = execute(command);
+            write_result(&result);
+            if (result.end == 1){
+                break;
+            }
+        }
+    }
+    journal_close();
+    trace_close();
+    free(replies.data);
+    return status;
+}
@@ -0,0 +1,152 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <sched.h>
+#include <pthread.h>
+#include "epoch.h"
+
+// a thread's slot is the same in every domain. It's taken when the thread
+//  first enters one and given back when the thread exits, so slots are
+//  only needed for the threads alive at a time
+static _Atomic char slot_taken[EPOCH_MAX_THREADS];
+// 1 + the highest slot ever taken; the writer looks at the slots below it
+static _Atomic int thread_count = 0;
+static __thread int thread_slot = -1;
+
+// holds slot + 1 for every thread with a slot, so that it's given back on exit
+static pthread_key_t slot_key;
+static pthread_once_t slot_key_once = PTHREAD_ONCE_INIT;
+
+
+// give back the slot of an exiting thread; it left every domain before
+static void release_slot(void* value){
+    atomic_store(&slot_taken[(intptr_t)value - 1], 0);
+}
+
+
+static void create_slot_key(){
+    if (pthread_key_create(&slot_key, release_slot) != 0){
+        abort();
+    }
+}
+
+
+static int current_slot(){
+    if (thread_slot == -1){
+        pthread_once(&slot_key_once, create_slot_key);
+        for (int i = 0; i < EPOCH_MAX_THREADS && thread_slot == -1; ++i){
+            char expected = 0;
+            if (atomic_load_explicit(&slot_taken[i], memory_order_relaxed) == 0 &&
+                atomic_compare_exchange_strong(&slot_taken[i], &expected, 1)){
+                thread_slot = i;
+            }
+        }
+        if (thread_slot == -1 ||
+            pthread_setspecific(slot_key, (void*)(intptr_t)(thread_slot + 1)) != 0){
+            abort();
+        }
+        int count = atomic_load(&thread_count);
+        while (count <= thread_slot){
+            atomic_compare_exchange_weak(&thread_count, &count, thread_slot + 1);
+        }
+    }
+    return thread_slot;
+}
+
+
+void epoch_init(EpochDomain* domain){
+    atomic_init(&domain->global, 1);
+    for (int i = 0; i < 3; ++i){
+        domain->limbo[i].items = NULL;
+        domain->limbo[i].count = 0;
+        domain->limbo[i].capacity = 0;
+    }
+    for (int i = 0; i < EPOCH_MAX_THREADS; ++i){
+        atomic_init(&domain->slots[i].epoch, 0);
+    }
+}
+
+
+void epoch_enter(EpochDomain* domain){
+    EpochSlot* slot = &domain->slots[current_slot()];
+    atomic_store(&slot->epoch, atomic_load(&domain->global));
+    // the store must be visible before any protected data is read
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+
+void epoch_exit(EpochDomain* domain){
+    atomic_store_explicit(&domain->slots[current_slot()].epoch, 0, memory_order_release);
+}
+
+
+void epoch_retire(EpochDomain* domain, void* object,
+                  void (*destroy)(void* object, void* context), void* context){
+    Limbo* limbo = &domain->limbo[atomic_load_explicit(&domain->global, memory_order_relaxed) % 3];
+    if (limbo->count == limbo->capacity){
+        limbo->capacity = limbo->capacity == 0 ? 64 : limbo->capacity * 2;
+        limbo->items = realloc(limbo->items, limbo->capacity * sizeof(Retired));
+    }
+    limbo->items[limbo->count].object = object;
+    limbo->items[limbo->count].destroy = destroy;
+    limbo->items[limbo->count].context = context;
+    limbo->count++;
+}
+
+
+static void destroy_limbo(Limbo* limbo){
+    for (int i = 0; i < limbo->count; ++i){
+        limbo->items[i].destroy(limbo->items[i].object, limbo->items[i].context);
+    }
+    limbo->count = 0;
+}
+
+
+// advance the global epoch by one if no reader is behind. Returns 1 on success
+static int try_advance(EpochDomain* domain){
+    uint64_t global = atomic_load(&domain->global);
+    int count = atomic_load(&thread_count);
+    if (count > EPOCH_MAX_THREADS){
+        count = EPOCH_MAX_THREADS;
+    }
+    atomic_thread_fence(memory_order_seq_cst);
+    for (int i = 0; i < count; ++i){
+        uint64_t epoch = atomic_load(&domain->slots[i].epoch);
+        if (epoch != 0 && epoch != global){
+            return -1;
+        }
+    }
+    // objects retired two epochs ago are unreachable for everyone now
+    atomic_store(&domain->global, global + 1);
+    destroy_limbo(&domain->limbo[(global + 1) % 3]);
+    return 1;
+}
+
+
+void epoch_collect(EpochDomain* domain){
+    try_advance(domain);
+}
+
+
+void epoch_synchronize(EpochDomain* domain){
+    // after three advances all three limbo lists have been emptied, and every
+    //  reader has entered after the call began
+    int advanced = 0;
+    while (advanced < 3){
+        if (try_advance(domain) == 1){
+            ++advanced;
+        }
+        else{
+            sched_yield();
+        }
+    }
+}
+
+
+void epoch_release(EpochDomain* domain){
+    epoch_synchronize(domain);
+    for (int i = 0; i < 3; ++i){
+        free(domain->limbo[i].items);
+        domain->limbo[i].items = NULL;
+        domain->limbo[i].capacity = 0;
+    }
+}
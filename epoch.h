@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define EPOCH_MAX_THREADS 256  // threads that have entered a domain and not exited yet
+
+/* EPOCH DOMAIN - epoch-based reclamation for data read by many threads and
+   modified by one writer thread.
+     Readers wrap every access in epoch_enter / epoch_exit. The writer unlinks
+     an object first, then hands it to epoch_retire instead of freeing it.
+     A retired object is destroyed only after the global epoch has advanced
+     twice, and it can only advance when every reader inside a critical
+     section has seen the current epoch. So no reader can still hold a
+     pointer to it by then.
+   All functions except epoch_enter / epoch_exit must be called by the writer.
+*/
+
+typedef struct{
+    void* object;
+    void (*destroy)(void* object, void* context);
+    void* context;
+} Retired;
+
+typedef struct{
+    Retired* items;
+    int count;
+    int capacity;
+} Limbo;
+
+typedef struct{
+    _Atomic uint64_t epoch;  // epoch the thread entered in, 0 if it's outside
+    char padding[56];        // keep every thread's slot on its own cache line
+} EpochSlot;
+
+typedef struct{
+    _Atomic uint64_t global;
+    Limbo limbo[3];          // limbo[e % 3] holds objects retired during epoch e
+    EpochSlot slots[EPOCH_MAX_THREADS];
+} EpochDomain;
+
+// prepare an empty domain
+void epoch_init(EpochDomain* domain);
+
+// start reading data protected by a domain
+void epoch_enter(EpochDomain* domain);
+
+// stop reading data protected by a domain
+void epoch_exit(EpochDomain* domain);
+
+// destroy(object, context) once no reader can see the object anymore
+void epoch_retire(EpochDomain* domain, void* object,
+                  void (*destroy)(void* object, void* context), void* context);
+
+// advance the epoch if all readers allow it and destroy what became safe
+void epoch_collect(EpochDomain* domain);
+
+// wait until every reader that might have seen unlinked data is done, then
+//  destroy everything retired so far
+void epoch_synchronize(EpochDomain* domain);
+
+// destroy everything retired so far, once no reader can see it, and free the
+//  domain's lists; the domain may be used again afterwards
+void epoch_release(EpochDomain* domain);
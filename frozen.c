@@ -0,0 +1,484 @@
+#include <stdlib.h>
+#include <string.h>
+#include "frozen.h"
+#include "mismatch.h"
+#include "bits.h"
+#include "fuzzy.h"
+
+
+// number of bits set before bit x of a bit vector
+static inline uint64_t rank(const RankWord* vector, uint64_t x){
+    const RankWord* word = &vector[x >> 6];
+    return word->rank + count_bits64(word->bits & (((uint64_t)1 << (x & 63)) - 1));
+}
+
+
+// 1 if bit x of a bit vector is set, 0 otherwise
+static inline int bit(const RankWord* vector, uint64_t x){
+    return (vector[x >> 6].bits >> (x & 63)) & 1;
+}
+
+
+// number of 64-bit words in a bit vector with a bit for every node and one past them
+static uint64_t vector_words(uint32_t node_count){
+    return node_count / 64 + 1;
+}
+
+
+// length of a node's label, without its first letter
+static uint32_t label_length(const FrozenTrie* trie, uint32_t node){
+    uint8_t length = trie->blocks[node / LABEL_BLOCK].lengths[node % LABEL_BLOCK];
+    if (length < LONG_LABEL){
+        return length;
+    }
+    uint32_t low = 0;
+    uint32_t high = trie->long_count;
+    while (high - low > 1){
+        uint32_t middle = (low + high) / 2;
+        if (trie->long_labels[middle].node <= node){
+            low = middle;
+        }
+        else{
+            high = middle;
+        }
+    }
+    return trie->long_labels[low].length;
+}
+
+
+// pointer to a node's label without its first letter; length is set to its length
+static const char* label(const FrozenTrie* trie, uint32_t node, uint32_t* length){
+    uint64_t offset = trie->blocks[node / LABEL_BLOCK].start;
+    for (uint32_t x = node - node % LABEL_BLOCK; x < node; ++x){
+        offset += label_length(trie, x);
+    }
+    *length = label_length(trie, node);
+    return trie->labels + offset;
+}
+
+
+// number of the target of a node's edge for a given letter, -1 if there is none
+static int64_t child(const FrozenTrie* trie, uint32_t node, int letter_number){
+    if (bit(trie->inner, node) == 0){
+        return -1;
+    }
+    const FrozenEdges* edges = &trie->edges[rank(trie->inner, node)];
+    if (letters_has(&edges->bitmap, letter_number) == 0){
+        return -1;
+    }
+    return edges->first_child + letters_rank(&edges->bitmap, letter_number);
+}
+
+
+// number of the first child of the first node with children among the
+//  nodes numbered from x on; node_count if there is none
+static uint64_t children_start(const FrozenTrie* trie, uint64_t x){
+    uint64_t inner = rank(trie->inner, x);
+    return inner < trie->inner_count ? trie->edges[inner].first_child : trie->node_count;
+}
+
+
+// set the rank of every word of a bit vector
+static void count_ranks(RankWord* vector, uint64_t words){
+    uint64_t rank = 0;
+    for (uint64_t i = 0; i < words; ++i){
+        vector[i].rank = rank;
+        rank += count_bits64(vector[i].bits);
+    }
+}
+
+
+int frozen_build(FrozenTrie* trie, const Snapshot* snapshot){
+    const SnapshotHeader* header = snapshot->header;
+    const SnapshotNode* nodes = snapshot->nodes;
+    uint32_t count = header->node_count;
+    memset(trie, 0, sizeof(*trie));
+    trie->node_count = count;
+    trie->id_count = header->id_count;
+
+    // snapshot indices of the nodes in level order
+    uint32_t* order = malloc(((uint64_t)count + 1) * sizeof(uint32_t));
+    trie->inner = calloc(vector_words(count), sizeof(RankWord));
+    trie->words = calloc(vector_words(count), sizeof(RankWord));
+    trie->edges = malloc(((uint64_t)count + 1) * sizeof(FrozenEdges));
+    trie->ids = malloc(((uint64_t)count + 1) * sizeof(uint32_t));
+    trie->blocks = calloc(count / LABEL_BLOCK + 1, sizeof(LabelBlock));
+    // every label but the root's empty one loses its first letter
+    trie->labels = malloc((uint64_t)header->label_bytes - (count > 0 ? count - 1 : 0) + 1);
+    uint32_t long_capacity = 0;
+    if (order == NULL || trie->inner == NULL || trie->words == NULL || trie->edges == NULL ||
+        trie->ids == NULL || trie->blocks == NULL || trie->labels == NULL){
+        free(order);
+        frozen_release(trie);
+        return -1;
+    }
+
+    uint32_t next = 0;
+    if (count > 0){
+        order[0] = 0;
+        next = 1;
+    }
+    for (uint32_t x = 0; x < count; ++x){
+        // a loaded snapshot may come from a damaged file, check everything
+        if (order[x] >= count || nodes[order[x] + 1].label > header->label_bytes ||
+            (x > 0 && nodes[order[x]].label >= nodes[order[x] + 1].label)){
+            free(order);
+            frozen_release(trie);
+            return -1;
+        }
+        const SnapshotNode* node = &nodes[order[x]];
+        int children = letters_count(&node->bitmap);
+        if (children > 0){
+            trie->inner[x >> 6].bits |= (uint64_t)1 << (x & 63);
+            trie->edges[trie->inner_count].bitmap = node->bitmap;
+            trie->edges[trie->inner_count].first_child = next;
+            ++trie->inner_count;
+            for (int i = 0; i < children && next < count; ++i){
+                order[next++] = node->first_child + i;
+            }
+        }
+        if (node->id != SNAPSHOT_NO_ID){
+            trie->words[x >> 6].bits |= (uint64_t)1 << (x & 63);
+            trie->ids[trie->word_count++] = node->id;
+        }
+
+        LabelBlock* block = &trie->blocks[x / LABEL_BLOCK];
+        if (x % LABEL_BLOCK == 0){
+            block->start = trie->label_bytes;
+        }
+        uint32_t length = 0;
+        if (x > 0){
+            length = nodes[order[x] + 1].label - node->label - 1;
+            memcpy(trie->labels + trie->label_bytes, snapshot->labels + node->label + 1, length);
+            trie->label_bytes += length;
+        }
+        block->lengths[x % LABEL_BLOCK] = length < LONG_LABEL ? length : LONG_LABEL;
+        if (length >= LONG_LABEL){
+            if (trie->long_count == long_capacity){
+                long_capacity = long_capacity == 0 ? 16 : 2 * long_capacity;
+                trie->long_labels = realloc(trie->long_labels, long_capacity * sizeof(LongLabel));
+            }
+            trie->long_labels[trie->long_count].node = x;
+            trie->long_labels[trie->long_count].length = length;
+            ++trie->long_count;
+        }
+    }
+    count_ranks(trie->inner, vector_words(count));
+    count_ranks(trie->words, vector_words(count));
+    free(order);
+
+    // only nodes with children have edges and only words have ids
+    trie->edges = realloc(trie->edges, ((uint64_t)trie->inner_count + 1) * sizeof(FrozenEdges));
+    trie->ids = realloc(trie->ids, ((uint64_t)trie->word_count + 1) * sizeof(uint32_t));
+    return 1;
+}
+
+
+int frozen_snapshot(const FrozenTrie* trie, Snapshot* result){
+    uint32_t count = trie->node_count;
+    SnapshotHeader layout;
+    uint64_t size = snapshot_layout(&layout, count, trie->id_count,
+                                    trie->label_bytes + (count > 0 ? count - 1 : 0));
+    char* block = calloc(1, size);
+    // first letter of every node's label, given by its parent's bitmap
+    uint8_t* letters = malloc((uint64_t)count + 1);
+    if (block == NULL || letters == NULL){
+        free(block);
+        free(letters);
+        return -1;
+    }
+    memcpy(block, &layout, sizeof(layout));
+    SnapshotNode* nodes = (SnapshotNode*)(block + layout.nodes_offset);
+    uint32_t* ids = (uint32_t*)(block + layout.ids_offset);
+    char* labels = block + layout.labels_offset;
+    for (uint32_t i = 0; i < trie->id_count; ++i){
+        ids[i] = SNAPSHOT_NO_ID;
+    }
+
+    // the level order keeps children consecutive, so it's a valid snapshot order
+    uint32_t inner = 0;
+    uint32_t word = 0;
+    uint64_t label_used = 0;
+    uint64_t rest_used = 0;
+    for (uint32_t x = 0; x < count; ++x){
+        memset(&nodes[x].bitmap, 0, sizeof(LetterSet));
+        nodes[x].first_child = 0;
+        if (bit(trie->inner, x) == 1){
+            const FrozenEdges* edges = &trie->edges[inner++];
+            nodes[x].bitmap = edges->bitmap;
+            nodes[x].first_child = edges->first_child;
+            uint32_t target = edges->first_child;
+            const LetterSet* bitmap = &edges->bitmap;
+            for (int y = letters_first(bitmap); y != -1; y = letters_next(bitmap, y + 1)){
+                letters[target++] = y;
+            }
+        }
+        nodes[x].id = SNAPSHOT_NO_ID;
+        if (bit(trie->words, x) == 1){
+            nodes[x].id = trie->ids[word++];
+            ids[nodes[x].id] = x;
+        }
+
+        nodes[x].label = label_used;
+        uint32_t length = label_length(trie, x);
+        if (x > 0){
+            labels[label_used++] = letter_char(letters[x]);
+        }
+        memcpy(labels + label_used, trie->labels + rest_used, length);
+        label_used += length;
+        rest_used += length;
+    }
+    nodes[count].label = label_used;
+
+    // children come after their parents, so a backward pass sums up the words
+    for (int64_t x = (int64_t)count - 1; x >= 0; --x){
+        uint32_t words = nodes[x].id != SNAPSHOT_NO_ID;
+        for (int i = 0; i < letters_count(&nodes[x].bitmap); ++i){
+            words += nodes[nodes[x].first_child + i].words;
+        }
+        nodes[x].words = words;
+    }
+    free(letters);
+    if (snapshot_attach(result, block, size) == -1){
+        free(block);
+        return -1;
+    }
+    return 1;
+}
+
+
+void frozen_release(FrozenTrie* trie){
+    free(trie->inner);
+    free(trie->words);
+    free(trie->edges);
+    free(trie->ids);
+    free(trie->blocks);
+    free(trie->labels);
+    free(trie->long_labels);
+    memset(trie, 0, sizeof(*trie));
+}
+
+
+size_t frozen_node_bytes(const FrozenTrie* trie){
+    return 2 * vector_words(trie->node_count) * sizeof(RankWord) +
+           trie->inner_count * sizeof(FrozenEdges) +
+           (trie->node_count / LABEL_BLOCK + 1) * sizeof(LabelBlock) +
+           trie->long_count * sizeof(LongLabel);
+}
+
+
+size_t frozen_label_bytes(const FrozenTrie* trie){
+    return trie->label_bytes;
+}
+
+
+size_t frozen_id_bytes(const FrozenTrie* trie){
+    return trie->word_count * sizeof(uint32_t);
+}
+
+
+// get the highest node whose word begins with a pattern, -1 if no word does;
+//  depth is set to the length of its parent's word
+static int64_t locate(const FrozenTrie* trie, const char* pattern, int length, int* depth){
+    uint32_t node = 0;
+    int index = 0;
+    *depth = 0;
+    if (trie->node_count == 0){
+        return -1;
+    }
+    while (index < length){
+        int64_t next = child(trie, node, letter_number_of(pattern[index]));
+        if (next == -1){
+            return -1;
+        }
+        // the edge has matched the first letter already
+        uint32_t rest_length;
+        const char* rest = label(trie, next, &rest_length);
+        int compared = length - index - 1 < rest_length ? length - index - 1 : rest_length;
+        if (mismatch(pattern + index + 1, rest, compared) < compared){
+            return -1;
+        }
+        *depth = index;
+        index += compared + 1;
+        node = next;
+    }
+    return node;
+}
+
+
+int frozen_find(const FrozenTrie* trie, const char* pattern, int length){
+    int depth;
+    return locate(trie, pattern, length, &depth) == -1 ? -1 : 1;
+}
+
+
+int frozen_lookup(const FrozenTrie* trie, const char* word, int length){
+    int depth;
+    int64_t node = locate(trie, word, length, &depth);
+    if (node <= 0 || bit(trie->words, node) == 0 || depth + 1 + label_length(trie, node) != (uint32_t)length){
+        return -1;
+    }
+    return trie->ids[rank(trie->words, node)];
+}
+
+
+int frozen_count(const FrozenTrie* trie, const char* prefix, int length){
+    int depth;
+    int64_t node = locate(trie, prefix, length, &depth);
+    if (node == -1){
+        return 0;
+    }
+    // the subtree's nodes at every depth are a range of numbers
+    uint64_t left = node;
+    uint64_t right = node + 1;
+    int count = 0;
+    while (left < right){
+        count += rank(trie->words, right) - rank(trie->words, left);
+        left = children_start(trie, left);
+        right = children_start(trie, right);
+    }
+    return count;
+}
+
+
+int frozen_fuzzy_find(const FrozenTrie* trie, const char* pattern, int length, int k){
+    if (trie->node_count == 0 || bit(trie->inner, 0) == 0){
+        return -1;
+    }
+    FuzzyRows rows;
+    if (length <= k || fuzzy_init(&rows, pattern, length, k) == -1){
+        return length <= k ? 1 : -1;
+    }
+
+    // depth-first; the stack holds nodes still to visit, the length of their
+    //  parents' words and their first letters
+    int stack_capacity = 64;
+    uint32_t* stack_node = malloc(stack_capacity * sizeof(uint32_t));
+    int* stack_depth = malloc(stack_capacity * sizeof(int));
+    char* stack_letter = malloc(stack_capacity);
+    stack_node[0] = 0;
+    stack_depth[0] = 0;
+    int stack_size = 1;
+    int state = FUZZY_ALIVE;
+    while (stack_size > 0 && state != FUZZY_FOUND){
+        --stack_size;
+        uint32_t node = stack_node[stack_size];
+        int depth = stack_depth[stack_size];
+        state = FUZZY_ALIVE;
+        if (node != 0){
+            uint32_t rest_length;
+            const char* rest = label(trie, node, &rest_length);
+            state = fuzzy_label(&rows, depth, &stack_letter[stack_size], 1);
+            if (state == FUZZY_ALIVE){
+                state = fuzzy_label(&rows, depth + 1, rest, rest_length);
+            }
+            depth += 1 + rest_length;
+        }
+        if (state != FUZZY_ALIVE || bit(trie->inner, node) == 0){
+            continue;
+        }
+        const FrozenEdges* edges = &trie->edges[rank(trie->inner, node)];
+        while (stack_size + letters_count(&edges->bitmap) > stack_capacity){
+            stack_capacity *= 2;
+            stack_node = realloc(stack_node, stack_capacity * sizeof(uint32_t));
+            stack_depth = realloc(stack_depth, stack_capacity * sizeof(int));
+            stack_letter = realloc(stack_letter, stack_capacity);
+        }
+        uint32_t target = edges->first_child;
+        const LetterSet* bitmap = &edges->bitmap;
+        for (int x = letters_first(bitmap); x != -1; x = letters_next(bitmap, x + 1)){
+            stack_node[stack_size] = target++;
+            stack_depth[stack_size] = depth;
+            stack_letter[stack_size] = letter_char(x);
+            ++stack_size;
+        }
+        // the child that continues the pattern is visited first
+        int next = fuzzy_next_letter(&rows, depth);
+        if (next != -1 && letters_has(bitmap, next)){
+            int first = stack_size - letters_count(bitmap) + letters_rank(bitmap, next);
+            stack_node[first] = stack_node[stack_size - 1];
+            stack_letter[first] = stack_letter[stack_size - 1];
+            stack_node[stack_size - 1] = edges->first_child + letters_rank(bitmap, next);
+            stack_letter[stack_size - 1] = letter_char(next);
+        }
+    }
+    free(stack_node);
+    free(stack_depth);
+    free(stack_letter);
+    fuzzy_release(&rows);
+    return state == FUZZY_FOUND ? 1 : -1;
+}
+
+
+int frozen_list(const FrozenTrie* trie, const char* prefix, int length, int limit,
+                void (*emit)(const char* word, int length, void* context), void* context){
+    int depth;
+    int64_t top = locate(trie, prefix, length, &depth);
+    if (top == -1 || limit <= 0){
+        return 0;
+    }
+
+    // words are rebuilt in path on the way down; the stack holds nodes still
+    //  to visit, the length of their parents' words and their first letters
+    int path_capacity = depth + 64;
+    char* path = malloc(path_capacity);
+    int stack_capacity = 64;
+    uint32_t* stack_node = malloc(stack_capacity * sizeof(uint32_t));
+    int* stack_depth = malloc(stack_capacity * sizeof(int));
+    char* stack_letter = malloc(stack_capacity);
+    memcpy(path, prefix, depth);
+    stack_node[0] = top;
+    stack_depth[0] = depth;
+    stack_letter[0] = prefix[depth];
+    int stack_size = 1;
+    int listed = 0;
+
+    while (stack_size > 0 && listed < limit){
+        --stack_size;
+        uint32_t node = stack_node[stack_size];
+        int node_depth = stack_depth[stack_size];
+        if (node != 0){
+            uint32_t rest_length;
+            const char* rest = label(trie, node, &rest_length);
+            while (node_depth + 1 + rest_length > path_capacity){
+                path_capacity *= 2;
+                path = realloc(path, path_capacity);
+            }
+            path[node_depth] = stack_letter[stack_size];
+            memcpy(path + node_depth + 1, rest, rest_length);
+            node_depth += 1 + rest_length;
+            if (bit(trie->words, node) == 1){
+                emit(path, node_depth, context);
+                ++listed;
+            }
+        }
+        if (bit(trie->inner, node) == 0){
+            continue;
+        }
+
+        // the children are pushed backwards, so the first one is on top
+        const FrozenEdges* edges = &trie->edges[rank(trie->inner, node)];
+        int children = letters_count(&edges->bitmap);
+        while (stack_size + children > stack_capacity){
+            stack_capacity *= 2;
+            stack_node = realloc(stack_node, stack_capacity * sizeof(uint32_t));
+            stack_depth = realloc(stack_depth, stack_capacity * sizeof(int));
+            stack_letter = realloc(stack_letter, stack_capacity);
+        }
+        int position = stack_size + children;
+        uint32_t target = edges->first_child;
+        const LetterSet* bitmap = &edges->bitmap;
+        for (int x = letters_first(bitmap); x != -1; x = letters_next(bitmap, x + 1)){
+            --position;
+            stack_node[position] = target++;
+            stack_depth[position] = node_depth;
+            stack_letter[position] = letter_char(x);
+        }
+        stack_size += children;
+    }
+    free(path);
+    free(stack_node);
+    free(stack_depth);
+    free(stack_letter);
+    return listed;
+}
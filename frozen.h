@@ -0,0 +1,108 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "snapshot.h"
+
+/* FROZEN TRIE - a read-only tree in a few flat arrays, a fraction of the
+   size of the live nodes. Nodes are numbered in level order: the root is 0,
+   and the children of a node get consecutive numbers, sorted by first
+   letter, right after the children of all nodes numbered before it. So the
+   nodes of a subtree at one depth are consecutive too, and a subtree's words
+   are counted level by level without visiting its nodes.
+     node_count - root included; 0 if the tree is empty.
+     id_count - id to be given to the next inserted word.
+     inner - bit x is set if node x has children.
+     words - bit x is set if node x represents a word.
+     edges[r] - children of the node with the r-th set bit of inner.
+     ids[r] - id of the word of the node with the r-th set bit of words.
+     blocks, labels - labels without their first letter, which the parent's
+                      edge bitmap tells; see LabelBlock.
+     long_labels - lengths of labels that don't fit in a LabelBlock, sorted
+                   by node.
+*/
+
+// 64 bits of a bit vector and the number of bits set before them
+typedef struct{
+    uint64_t bits;
+    uint64_t rank;
+} RankWord;
+
+/* FROZEN EDGES - children of a node.
+     bitmap - letter x is in it if there is an edge with label that begins
+              on letter x.
+     first_child - number of the target of the alphabetically first edge; the
+                   target of the edge for letter x is first_child + (letters
+                   below x).
+*/
+typedef struct{
+    LetterSet bitmap;
+    uint32_t first_child;
+} FrozenEdges;
+
+#define LABEL_BLOCK 16    // nodes per LabelBlock
+#define LONG_LABEL 255    // length stored for labels found in long_labels
+
+/* LABEL BLOCK - where the labels of LABEL_BLOCK consecutive nodes are.
+     start - offset in labels of the first node's label; the others follow.
+     lengths[x] - length of the x-th node's label, LONG_LABEL if it's that
+                  long or longer.
+*/
+typedef struct{
+    uint32_t start;
+    uint8_t lengths[LABEL_BLOCK];
+} LabelBlock;
+
+typedef struct{
+    uint32_t node;
+    uint32_t length;
+} LongLabel;
+
+typedef struct{
+    uint32_t node_count;
+    uint32_t id_count;
+    RankWord* inner;
+    RankWord* words;
+    FrozenEdges* edges;
+    uint32_t* ids;
+    LabelBlock* blocks;
+    char* labels;
+    LongLabel* long_labels;
+    uint32_t inner_count;
+    uint32_t word_count;
+    uint64_t label_bytes;
+    uint32_t long_count;
+} FrozenTrie;
+
+// build a frozen tree from a snapshot. Returns -1 on fail, 1 otherwise
+int frozen_build(FrozenTrie* trie, const Snapshot* snapshot);
+
+// store a frozen tree in a newly allocated snapshot. Returns -1 on fail, 1 otherwise
+int frozen_snapshot(const FrozenTrie* trie, Snapshot* snapshot);
+
+// free everything a frozen tree holds
+void frozen_release(FrozenTrie* trie);
+
+// bytes taken by a frozen tree's nodes (bit vectors, edges and label
+//  blocks), labels and ids
+size_t frozen_node_bytes(const FrozenTrie* trie);
+size_t frozen_label_bytes(const FrozenTrie* trie);
+size_t frozen_id_bytes(const FrozenTrie* trie);
+
+// check if a stored word has a given prefix. Returns 1 if it does, -1 otherwise
+int frozen_find(const FrozenTrie* trie, const char* pattern, int length);
+
+// check if a stored word has a prefix within edit distance k of a pattern.
+//  Returns 1 if one has, -1 otherwise
+int frozen_fuzzy_find(const FrozenTrie* trie, const char* pattern, int length, int k);
+
+// id of a stored word, -1 if it isn't stored
+int frozen_lookup(const FrozenTrie* trie, const char* word, int length);
+
+// count the stored words that begin with a prefix
+int frozen_count(const FrozenTrie* trie, const char* prefix, int length);
+
+// pass at most limit stored words that begin with a prefix to emit, in
+//  lexicographic order. Returns the number of words passed
+int frozen_list(const FrozenTrie* trie, const char* prefix, int length, int limit,
+                void (*emit)(const char* word, int length, void* context), void* context);
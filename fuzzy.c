@@ -0,0 +1,124 @@
+#include <stdlib.h>
+#include "fuzzy.h"
+#include "mismatch.h"
+#include "alphabet.h"
+
+
+int fuzzy_init(FuzzyRows* rows, const char* pattern, int length, int k){
+    size_t row_count = (size_t)length + k + 1;
+    rows->pattern = pattern;
+    rows->length = length;
+    rows->k = k;
+    rows->width = 2 * k + 3;
+    rows->cells = malloc(row_count * rows->width * sizeof(int));
+    rows->exact = malloc(row_count * sizeof(int));
+    if (rows->cells == NULL || rows->exact == NULL){
+        fuzzy_release(rows);
+        return -1;
+    }
+    // the empty path is j letters away from the first j letters of the pattern
+    for (int cell = 0; cell < rows->width; ++cell){
+        int j = cell - k - 1;
+        rows->cells[cell] = j >= 0 && j <= k ? j : k + 1;
+    }
+    rows->exact[0] = k == 0 ? 0 : -1;
+    return 1;
+}
+
+
+int fuzzy_next_letter(const FuzzyRows* rows, int depth){
+    if (depth >= rows->length || is_letter(rows->pattern[depth]) == 0){
+        return -1;
+    }
+    return letter_number_of(rows->pattern[depth]);
+}
+
+
+void fuzzy_release(FuzzyRows* rows){
+    free(rows->cells);
+    free(rows->exact);
+    rows->cells = NULL;
+    rows->exact = NULL;
+}
+
+
+// compute row depth + 1 for the next letter of a path
+static int step(FuzzyRows* rows, int depth, char letter){
+    int k = rows->k;
+    int width = rows->width;
+    const int* above = rows->cells + (size_t)depth * width;
+    int* row = rows->cells + (size_t)(depth + 1) * width;
+    int d = depth + 1;
+    // j of cell 0; cell c of the row above is (d - 1, first + c - 1)
+    int first = d - k - 1;
+    int alive = 0;
+    int last = -1;
+    row[0] = k + 1;
+    for (int cell = 1; cell < width - 1; ++cell){
+        int j = first + cell;
+        int value = k + 1;
+        if (j == 0){
+            value = d;
+        }
+        else if (j > 0 && j <= rows->length){
+            value = above[cell] + (rows->pattern[j - 1] != letter);
+            if (above[cell + 1] + 1 < value){
+                value = above[cell + 1] + 1;
+            }
+            if (row[cell - 1] + 1 < value){
+                value = row[cell - 1] + 1;
+            }
+        }
+        if (value > k){
+            value = k + 1;
+        }
+        else{
+            ++alive;
+            last = j;
+        }
+        row[cell] = value;
+    }
+    row[width - 1] = k + 1;
+
+    rows->exact[d] = alive == 1 && row[last - first] == k ? last : -1;
+    if (alive == 0){
+        return FUZZY_DEAD;
+    }
+    int end = rows->length - first;
+    return end > 0 && end < width - 1 && row[end] <= k ? FUZZY_FOUND : FUZZY_ALIVE;
+}
+
+
+int fuzzy_label(FuzzyRows* rows, int depth, const char* label, int length){
+    int i = 0;
+    while (i < length){
+        int j = rows->exact[depth + i];
+        if (j == -1){
+            int state = step(rows, depth + i, label[i]);
+            if (state != FUZZY_ALIVE){
+                return state;
+            }
+            ++i;
+            continue;
+        }
+
+        // every edit is spent, the rest of the label has to match the pattern
+        int rest = rows->length - j;
+        int compared = length - i < rest ? length - i : rest;
+        if (mismatch(label + i, rows->pattern + j, compared) < compared){
+            return FUZZY_DEAD;
+        }
+        if (compared == rest){
+            return FUZZY_FOUND;
+        }
+        // the label ends first: the same cell of the band, deeper down
+        int* row = rows->cells + (size_t)(depth + length) * rows->width;
+        for (int cell = 0; cell < rows->width; ++cell){
+            row[cell] = rows->k + 1;
+        }
+        row[j - (depth + i) + rows->k + 1] = rows->k;
+        rows->exact[depth + length] = j + compared;
+        return FUZZY_ALIVE;
+    }
+    return FUZZY_ALIVE;
+}
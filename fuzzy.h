@@ -0,0 +1,49 @@
+#pragma once
+
+// what a path down a tree is, after a letter or a label
+#define FUZZY_FOUND 1    // its word has a prefix within k of the pattern
+#define FUZZY_ALIVE 0    // longer paths through it may have one
+#define FUZZY_DEAD -1    // no path through it has one
+
+/* FUZZY ROWS - the Levenshtein table of a pattern against the letters of a
+   path down a tree, for telling if a stored word has a prefix within edit
+   distance k of the pattern. Cell (d, j) is the distance between the first
+   d letters of the path and the first j letters of the pattern; row d is
+   computed from row d - 1 when the path gets its d-th letter, so the
+   children of a node start from the rows of their parent's path. Only cells
+   with |j - d| <= k can be k or less, so a row keeps just that band and a
+   cell on each side of it; anything above k is stored as k + 1. Paths
+   longer than length + k are never within k, rows stop there.
+     width - cells in a row, 2k + 3: cell (d, j) is
+             cells[d * width + j - d + k + 1].
+     exact[d] - j if (d, j) is the only cell of row d that's k or less, and
+                it's k: then the path stays within k only while its letters
+                are the pattern's from j on, and labels are compared with it
+                at once. -1 otherwise.
+*/
+typedef struct{
+    const char* pattern;
+    int length;
+    int k;
+    int width;
+    int* cells;
+    int* exact;
+} FuzzyRows;
+
+// set up the rows of a pattern longer than k (a shorter one is within k
+//  of the empty prefix of any word) for the empty path. Returns -1 on fail,
+//  1 otherwise
+int fuzzy_init(FuzzyRows* rows, const char* pattern, int length, int k);
+
+// number of the letter that follows a path of depth letters without an
+//  edit, -1 if there's none. Trying the child with it first finds words
+//  close to the pattern sooner
+int fuzzy_next_letter(const FuzzyRows* rows, int depth);
+
+// free the rows
+void fuzzy_release(FuzzyRows* rows);
+
+// extend a path of depth letters, whose rows are computed, by a label and
+//  compute the rows of its letters, as far as it's alive. Returns
+//  FUZZY_FOUND, FUZZY_ALIVE or FUZZY_DEAD for the extended path
+int fuzzy_label(FuzzyRows* rows, int depth, const char* label, int length);
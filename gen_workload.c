@@ -0,0 +1,36 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "workload.h"
+
+/* Print a synthetic workload for the dictionary program.
+   Usage: gen_workload [--seed n] [--commands n] [--mix i:p:d:f:c]
+                       [--lengths uniform:min:max | geometric:min:max:mean]
+                       [--shared-prefix rate] [--dictionary n] [--letters n]
+*/
+
+int main(int argc, char* argv[]){
+    Workload workload;
+    workload_defaults(&workload);
+    for (int i = 1; i < argc; ){
+        int used = workload_option(&workload, argc, argv, i);
+        if (used <= 0){
+            fprintf(stderr, "Error: wrong parameter %s\n", argv[i]);
+            return 1;
+        }
+        i += used;
+    }
+    if (workload_start(&workload) == -1){
+        fprintf(stderr, "Error: wrong workload parameters\n");
+        return 1;
+    }
+
+    char* line = malloc(WORKLOAD_MAX_LENGTH + 32);
+    for (long i = 0; i < workload.commands; ++i){
+        int length = workload_command(&workload, line);
+        line[length] = '\n';
+        fwrite(line, 1, length + 1, stdout);
+    }
+    free(line);
+    workload_release(&workload);
+    return 0;
+}
@@ -0,0 +1,550 @@
+#define _GNU_SOURCE  // O_CLOEXEC, fdatasync
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <libgen.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "journal.h"
+
+#define JOURNAL_BUFFER_SIZE (1 << 16)  // records gathered before they're written out
+#define RECORD_HEAD_SIZE 16            // a tag and at most three numbers of 5 bytes
+#define COPY_BUFFER_SIZE (1 << 16)     // block of a file copied by journal_keep
+
+/* RECORD TYPE - how a command is stored.
+     tag - first byte of its records; never 0, so zeros left at the end of
+           the file by a crash of the system end the journal.
+     has_string - 1 if string_arg follows the tag, as its length and
+                  characters.
+     numbers - how many of int_args follow, after the string if any.
+*/
+typedef struct{
+    char tag;
+    query_type query;
+    int has_string;
+    int numbers;
+} RecordType;
+
+static const RecordType record_types[] = {
+    {'i', INSERT, 1, 0}, {'p', PREV, 0, 3}, {'d', DELETE, 0, 1}, {'s', SUFFIXES, 0, 1},
+    {'c', CLEAR, 0, 0}, {'l', LOAD, 1, 0}, {'b', BULKLOAD, 1, 0}, {'f', FREEZE, 0, 0},
+    {'t', THAW, 0, 0}, {'u', USE, 1, 0}
+};
+
+#define RECORD_TYPE_COUNT (int)(sizeof(record_types) / sizeof(record_types[0]))
+
+/* BUFFER - records waiting to be written out, data[0 .. used - 1]. */
+typedef struct{
+    char* data;
+    size_t used;
+} Buffer;
+
+/* The journal. journal_append fills filling under lock; writing it out
+   swaps it with writing under lock and then writes writing without it, so
+   the thread appending isn't held up by the write. commit_lock keeps the
+   writes in order and is held while fd is changed.
+     fd - the open journal, -1 if there is none.
+     file - its absolute path.
+     link_number - the journal starts by loading file.<link_number>, a hard
+                   link made by journal_checkpoint; -1 if it doesn't.
+     kept_count - the journal's records may refer to file.file.<x> for x
+                  below it, the files kept by journal_keep.
+     unsynced - 1 if something was written after the last sync.
+*/
+static int fd = -1;
+static char* file = NULL;
+static int link_number = -1;
+static int kept_count = 0;
+static journal_sync level = JOURNAL_WRITE;
+static Buffer filling = {NULL, 0};
+static Buffer writing = {NULL, 0};
+static int unsynced = 0;
+static long crash_countdown = 0;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t commit_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+// the type of a command's records, NULL if it isn't journaled
+static const RecordType* type_of_query(query_type query){
+    for (int i = 0; i < RECORD_TYPE_COUNT; ++i){
+        if (record_types[i].query == query){
+            return &record_types[i];
+        }
+    }
+    return NULL;
+}
+
+
+// the type of records with a tag, NULL if there is none
+static const RecordType* type_of_tag(char tag){
+    for (int i = 0; i < RECORD_TYPE_COUNT; ++i){
+        if (record_types[i].tag == tag){
+            return &record_types[i];
+        }
+    }
+    return NULL;
+}
+
+
+// store a number as unsigned LEB128, returns the number of bytes used
+static int encode_number(char* out, uint32_t value){
+    int length = 0;
+    while (value >= 0x80){
+        out[length++] = (char)(value | 0x80);
+        value >>= 7;
+    }
+    out[length++] = (char)value;
+    return length;
+}
+
+
+// read a number stored by encode_number into value. Returns the number of
+//  bytes read, 0 if the data ends first or the number is above INT_MAX
+static int decode_number(const char* data, size_t size, int* value){
+    uint32_t result = 0;
+    for (int i = 0; i < 5 && (size_t)i < size; ++i){
+        uint8_t byte = data[i];
+        result |= (uint32_t)(byte & 0x7f) << (7 * i);
+        if ((byte & 0x80) == 0){
+            if (result > INT_MAX){
+                return 0;
+            }
+            *value = result;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+
+// store everything of a command's record but the characters of its string.
+//  Returns the number of bytes used, at most RECORD_HEAD_SIZE
+static int encode_head(char* out, const RecordType* type, Command command){
+    int length = 0;
+    out[length++] = type->tag;
+    if (type->has_string == 1){
+        length += encode_number(out + length, command.string_length);
+    }
+    for (int i = 0; i < type->numbers; ++i){
+        length += encode_number(out + length, command.int_args[i]);
+    }
+    return length;
+}
+
+
+// read the record at the start of data into command; its string points
+//  into data. Returns its size, 0 if it's cut short or isn't a record
+static size_t decode_record(const char* data, size_t size, Command* command){
+    if (size == 0){
+        return 0;
+    }
+    const RecordType* type = type_of_tag(data[0]);
+    if (type == NULL){
+        return 0;
+    }
+    memset(command, 0, sizeof(Command));
+    command->query = type->query;
+    size_t used = 1;
+    int length = 0;
+    if (type->has_string == 1){
+        int count = decode_number(data + used, size - used, &length);
+        if (count == 0){
+            return 0;
+        }
+        used += count;
+    }
+    for (int i = 0; i < type->numbers; ++i){
+        int count = decode_number(data + used, size - used, &command->int_args[i]);
+        if (count == 0){
+            return 0;
+        }
+        used += count;
+    }
+    if ((size_t)length > size - used){
+        return 0;
+    }
+    command->string_arg = data + used;
+    command->string_length = length;
+    return used + length;
+}
+
+
+// write a whole block to a file, stopping the program if it can't: the
+//  commands that were run would be missing after a crash
+static void write_all(int file_fd, const char* data, size_t length){
+    size_t done = 0;
+    while (done < length){
+        ssize_t count = write(file_fd, data + done, length - done);
+        if (count < 0 && errno == EINTR){
+            continue;
+        }
+        if (count <= 0){
+            fprintf(stderr, "Error: cannot write the journal\n");
+            abort();
+        }
+        done += count;
+    }
+}
+
+
+// write out the records appended so far, then a record given as its head
+//  and its string (both may be empty), and sync the journal if sync == 1
+static void write_out(const char* head, int head_length, const char* string, int string_length,
+                      int sync){
+    pthread_mutex_lock(&commit_lock);
+    pthread_mutex_lock(&lock);
+    Buffer swapped = filling;
+    filling = writing;
+    writing = swapped;
+    pthread_mutex_unlock(&lock);
+
+    if (fd != -1 && writing.used + head_length + string_length > 0){
+        write_all(fd, writing.data, writing.used);
+        write_all(fd, head, head_length);
+        write_all(fd, string, string_length);
+        unsynced = 1;
+    }
+    writing.used = 0;
+    if (fd != -1 && sync == 1 && unsynced == 1){
+        if (fdatasync(fd) == -1){
+            fprintf(stderr, "Error: cannot sync the journal\n");
+            abort();
+        }
+        unsynced = 0;
+    }
+    pthread_mutex_unlock(&commit_lock);
+}
+
+
+// sync the directory of a file, so that a file renamed or linked into it
+//  stays there after a crash of the system. Returns -1 on fail
+static int sync_directory(const char* path){
+    char* copy = strdup(path);
+    if (copy == NULL){
+        return -1;
+    }
+    int directory = open(dirname(copy), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    free(copy);
+    if (directory < 0){
+        return -1;
+    }
+    int result = fsync(directory);
+    close(directory);
+    return result == 0 ? 1 : -1;
+}
+
+
+// a path followed by a suffix; needs to be freed
+static char* suffixed(const char* path, const char* suffix){
+    size_t length = strlen(path);
+    char* result = malloc(length + strlen(suffix) + 1);
+    if (result != NULL){
+        memcpy(result, path, length);
+        strcpy(result + length, suffix);
+    }
+    return result;
+}
+
+
+// the number of the link a record loads if it's one made by
+//  journal_checkpoint, -1 otherwise
+static int checkpoint_link(Command command){
+    size_t length = strlen(file);
+    if (command.query != LOAD || command.string_length != length + 2 ||
+        memcmp(command.string_arg, file, length) != 0 || command.string_arg[length] != '.'){
+        return -1;
+    }
+    char number = command.string_arg[length + 1];
+    return number == '0' || number == '1' ? number - '0' : -1;
+}
+
+
+// the path of a file kept by journal_keep; needs to be freed
+static char* kept_path(int number){
+    char suffix[24];
+    snprintf(suffix, sizeof(suffix), ".file.%d", number);
+    return suffixed(file, suffix);
+}
+
+
+// the number of the file a record loads if it's one kept by journal_keep,
+//  -1 otherwise
+static int kept_number(Command command){
+    size_t length = strlen(file);
+    if ((command.query != LOAD && command.query != BULKLOAD) ||
+        command.string_length <= length + 6 || memcmp(command.string_arg, file, length) != 0 ||
+        memcmp(command.string_arg + length, ".file.", 6) != 0){
+        return -1;
+    }
+    int number = 0;
+    for (int i = length + 6; i < command.string_length; ++i){
+        char digit = command.string_arg[i];
+        if (digit < '0' || digit > '9' || number > (INT_MAX - 9) / 10){
+            return -1;
+        }
+        number = 10 * number + digit - '0';
+    }
+    return number;
+}
+
+
+// copy a file to a new one at path, synced if sync == 1. Returns -1 on fail
+static int copy_file(const char* from, const char* path, int sync){
+    int source = open(from, O_RDONLY | O_CLOEXEC);
+    if (source < 0){
+        return -1;
+    }
+    int copy = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    char* buffer = malloc(COPY_BUFFER_SIZE);
+    int result = copy < 0 || buffer == NULL ? -1 : 1;
+    while (result == 1){
+        ssize_t count = read(source, buffer, COPY_BUFFER_SIZE);
+        if (count < 0 && errno == EINTR){
+            continue;
+        }
+        if (count <= 0){
+            result = count == 0 ? 1 : -1;
+            break;
+        }
+        for (ssize_t done = 0; done < count && result == 1; ){
+            ssize_t written = write(copy, buffer + done, count - done);
+            if (written < 0 && errno == EINTR){
+                continue;
+            }
+            if (written <= 0){
+                result = -1;
+            }
+            done += written;
+        }
+    }
+    if (result == 1 && sync == 1 && fsync(copy) == -1){
+        result = -1;
+    }
+    free(buffer);
+    close(source);
+    if (copy >= 0 && close(copy) == -1){
+        result = -1;
+    }
+    return result;
+}
+
+
+long journal_open(const char* path, journal_sync sync, void (*run)(Command command)){
+    int journal = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    struct stat info;
+    if (journal < 0){
+        return -1;
+    }
+    file = realpath(path, NULL);
+    filling.data = malloc(JOURNAL_BUFFER_SIZE);
+    writing.data = malloc(JOURNAL_BUFFER_SIZE);
+    if (file == NULL || filling.data == NULL || writing.data == NULL ||
+        fstat(journal, &info) == -1){
+        close(journal);
+        journal_close();
+        return -1;
+    }
+
+    long count = 0;
+    size_t valid = 0;
+    if (info.st_size > 0){
+        const char* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, journal, 0);
+        if (data == MAP_FAILED){
+            close(journal);
+            journal_close();
+            return -1;
+        }
+        Command command;
+        size_t size;
+        while ((size = decode_record(data + valid, info.st_size - valid, &command)) > 0){
+            if (count == 0){
+                link_number = checkpoint_link(command);
+            }
+            if (kept_number(command) >= kept_count){
+                kept_count = kept_number(command) + 1;
+            }
+            run(command);
+            valid += size;
+            ++count;
+        }
+        munmap((void*)data, info.st_size);
+    }
+    // the rest was cut short by a crash, new records go where it starts
+    if (valid < info.st_size && (ftruncate(journal, valid) == -1 || fsync(journal) == -1)){
+        close(journal);
+        journal_close();
+        return -1;
+    }
+    fd = journal;
+    level = sync;
+    return count;
+}
+
+
+void journal_append(Command command){
+    const RecordType* type = type_of_query(command.query);
+    if (fd == -1 || type == NULL){
+        return;
+    }
+    int string_length = type->has_string == 1 ? command.string_length : 0;
+    if (RECORD_HEAD_SIZE + string_length > JOURNAL_BUFFER_SIZE){
+        // too long for the buffer, it's written out right after it
+        char head[RECORD_HEAD_SIZE];
+        int head_length = encode_head(head, type, command);
+        write_out(head, head_length, command.string_arg, string_length, 0);
+    }
+    else{
+        pthread_mutex_lock(&lock);
+        if (filling.used + RECORD_HEAD_SIZE + string_length > JOURNAL_BUFFER_SIZE){
+            pthread_mutex_unlock(&lock);
+            write_out(NULL, 0, NULL, 0, 0);
+            pthread_mutex_lock(&lock);
+        }
+        filling.used += encode_head(filling.data + filling.used, type, command);
+        memcpy(filling.data + filling.used, command.string_arg, string_length);
+        filling.used += string_length;
+        pthread_mutex_unlock(&lock);
+    }
+    if (crash_countdown > 0 && --crash_countdown == 0){
+        kill(getpid(), SIGKILL);
+    }
+}
+
+
+void journal_commit(){
+    if (level != JOURNAL_NONE){
+        write_out(NULL, 0, NULL, 0, level == JOURNAL_FSYNC);
+    }
+}
+
+
+char* journal_keep(const char* path, int copy){
+    if (fd == -1){
+        return NULL;
+    }
+    char* kept = kept_path(kept_count);
+    if (kept == NULL){
+        fprintf(stderr, "Error: cannot keep %s for the journal\n", path);
+        abort();
+    }
+    // left by a crash before its record was written, if it's there
+    unlink(kept);
+    if ((copy == 1 || link(path, kept) == -1) &&
+        copy_file(path, kept, level == JOURNAL_FSYNC) == -1){
+        // the command has been run, and it would be missing after a crash
+        fprintf(stderr, "Error: cannot keep %s for the journal\n", path);
+        abort();
+    }
+    if (level == JOURNAL_FSYNC){
+        sync_directory(kept);
+    }
+    ++kept_count;
+    return kept;
+}
+
+
+int journal_checkpoint(const char* path, int frozen){
+    if (fd == -1){
+        return -1;
+    }
+    int number = link_number == 0 ? 1 : 0;
+    char suffix[3] = {'.', '0' + number, '\0'};
+    char* link_path = suffixed(file, suffix);
+    char* temporary = suffixed(file, ".tmp");
+    int journal = -1;
+    int result = -1;
+    if (link_path != NULL && temporary != NULL){
+        unlink(link_path);
+        journal = link(path, link_path) == 0 ?
+                  open(temporary, O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644) : -1;
+    }
+    if (journal >= 0){
+        // the new journal: the snapshot, and nothing else yet
+        Command command = {LOAD, link_path, strlen(link_path), {0, 0, 0}};
+        char head[RECORD_HEAD_SIZE];
+        int head_length = encode_head(head, type_of_query(LOAD), command);
+        write_all(journal, head, head_length);
+        write_all(journal, link_path, command.string_length);
+        if (frozen == 0){
+            write_all(journal, &type_of_query(THAW)->tag, 1);
+        }
+        if (fsync(journal) == 0 && rename(temporary, file) == 0){
+            // the new journal is in place even if the rename isn't synced
+            //  yet; a crash of the system before it is leaves the old one
+            sync_directory(file);
+            result = 1;
+        }
+    }
+    if (result == 1){
+        // the records appended before the save are in the snapshot
+        pthread_mutex_lock(&commit_lock);
+        pthread_mutex_lock(&lock);
+        filling.used = 0;
+        pthread_mutex_unlock(&lock);
+        close(fd);
+        fd = journal;
+        unsynced = 0;
+        pthread_mutex_unlock(&commit_lock);
+        if (link_number != -1){
+            char old_suffix[3] = {'.', '0' + link_number, '\0'};
+            char* old_link = suffixed(file, old_suffix);
+            if (old_link != NULL){
+                unlink(old_link);
+            }
+            free(old_link);
+        }
+        link_number = number;
+        // nor does it refer to the kept files anymore
+        for (int i = 0; i < kept_count; ++i){
+            char* kept = kept_path(i);
+            if (kept != NULL){
+                unlink(kept);
+            }
+            free(kept);
+        }
+        kept_count = 0;
+    }
+    else{
+        if (journal >= 0){
+            close(journal);
+            unlink(temporary);
+        }
+        if (link_path != NULL){
+            unlink(link_path);
+        }
+    }
+    free(link_path);
+    free(temporary);
+    return result;
+}
+
+
+void journal_crash_after(long count){
+    crash_countdown = count;
+}
+
+
+void journal_close(){
+    if (fd != -1){
+        write_out(NULL, 0, NULL, 0, level == JOURNAL_FSYNC);
+        pthread_mutex_lock(&commit_lock);
+        close(fd);
+        fd = -1;
+        pthread_mutex_unlock(&commit_lock);
+    }
+    free(file);
+    free(filling.data);
+    free(writing.data);
+    file = NULL;
+    filling = (Buffer){NULL, 0};
+    writing = (Buffer){NULL, 0};
+    link_number = -1;
+    kept_count = 0;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "parse.h"
+
+/* JOURNAL - a file the commands that modify dictionaries are appended to,
+   so that after a crash the dictionaries are rebuilt by running them again.
+   The commands are stored as records of a tag byte followed by their
+   arguments: numbers as unsigned LEB128, strings as their length and
+   characters. Records are gathered in a buffer and written out, a whole
+   number of records at a time, when the buffer fills up or when the
+   replies of the commands are about to be output, so that every reply a
+   client sees is covered by the journal; with JOURNAL_FSYNC that one write
+   is synced once for all the commands whose replies go out together.
+
+   A record that was cut short by a crash ends the journal; it's cut off
+   when the journal is opened. The files of loads and bulkloads are kept
+   next to the journal, see journal_keep. A save of the only dictionary
+   replaces the journal with one that starts by loading a hard link to the
+   snapshot that was saved, see journal_checkpoint.
+*/
+
+// how much of the journal survives a crash
+typedef enum{
+    JOURNAL_NONE,   // records are written when the buffer fills up: a crash of
+                    //  the process loses the commands since then
+    JOURNAL_WRITE,  // records are written before the replies: a crash of the
+                    //  process loses no replied command, one of the system may
+    JOURNAL_FSYNC   // records are written and synced before the replies: no
+                    //  replied command is lost
+} journal_sync;
+
+// run every command of the journal at path, if there is one, with run, then
+//  open it for appending. Returns -1 on fail, the number of commands that
+//  were run otherwise
+long journal_open(const char* path, journal_sync sync, void (*run)(Command command));
+
+// append a command that has been run; a no-op while no journal is open.
+//  Takes INSERT, PREV, DELETE, SUFFIXES, CLEAR, FREEZE, THAW, USE, and
+//  LOAD and BULKLOAD with a path from journal_keep
+void journal_append(Command command);
+
+// write out the appended records, synced if the journal is JOURNAL_FSYNC.
+//  May be called from another thread than journal_append
+void journal_commit();
+
+// keep the file at path that a LOAD or BULKLOAD has just read next to the
+//  journal, as file.file.<x>, so that the command is recovered the same
+//  whatever happens to the file afterwards, and return the absolute path of
+//  the kept file for its record; needs to be freed. NULL while no journal is
+//  open. A snapshot is kept as a hard link, like the ones journal_checkpoint
+//  makes, since save and the loaded dictionary already need it never to be
+//  written in place; it's copied if copy == 1, as word lists are, or if the
+//  link can't be made. Stops the program if the file can't be kept. The
+//  kept files are removed when a checkpoint starts the journal over
+char* journal_keep(const char* path, int copy);
+
+// start the journal over after the only dictionary was saved to a snapshot
+//  at path: the new journal loads a hard link to the snapshot kept next to
+//  it, and thaws it unless the dictionary is frozen. The old journal is
+//  replaced at once, so a crash leaves one or the other. Returns -1 if it
+//  can't be done (the journal then goes on as it was), 1 otherwise
+int journal_checkpoint(const char* path, int frozen);
+
+// kill the process with SIGKILL as soon as count more commands are appended,
+//  to test recovery
+void journal_crash_after(long count);
+
+// write out what's left and close the journal
+void journal_close();
@@ -0,0 +1,86 @@
+#include "mismatch.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MISMATCH_X86
+#endif
+
+
+static int mismatch_scalar(const char* a, const char* b, int length){
+    int i = 0;
+    while (i < length && a[i] == b[i]){
+        ++i;
+    }
+    return i;
+}
+
+
+#ifdef MISMATCH_X86
+
+// All vector kernels below expect length >= 16. A block is only loaded if it
+//  fits before length; the last partial block is handled by loading the last
+//  16 bytes again, overlapping the ones already compared.
+
+__attribute__((target("sse2")))
+static int mismatch_sse2(const char* a, const char* b, int length){
+    int i = 0;
+    while (1){
+        if (i > length - 16){
+            i = length - 16;
+        }
+        __m128i x = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i y = _mm_loadu_si128((const __m128i*)(b + i));
+        unsigned int equal = _mm_movemask_epi8(_mm_cmpeq_epi8(x, y));
+        if (equal != 0xFFFF){
+            return i + __builtin_ctz(~equal);
+        }
+        if (i == length - 16){
+            return length;
+        }
+        i += 16;
+    }
+}
+
+
+__attribute__((target("avx2")))
+static int mismatch_avx2(const char* a, const char* b, int length){
+    int i = 0;
+    while (i <= length - 32){
+        __m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i*)(b + i));
+        unsigned int equal = _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+        if (equal != 0xFFFFFFFFu){
+            return i + __builtin_ctz(~equal);
+        }
+        i += 32;
+    }
+    if (i == length){
+        return length;
+    }
+    // at most 31 characters left, at least 16 available before them
+    int start = length - 16 < i ? length - 16 : i;
+    return start + mismatch_sse2(a + start, b + start, length - start);
+}
+
+#endif
+
+
+// pick the best kernel on the first call
+static int mismatch_resolve(const char* a, const char* b, int length){
+    int (*kernel)(const char* a, const char* b, int length) = mismatch_scalar;
+#ifdef MISMATCH_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")){
+        kernel = mismatch_avx2;
+    }
+    else if (__builtin_cpu_supports("sse2")){
+        kernel = mismatch_sse2;
+    }
+#endif
+    // threads resolving it at the same time all store the same kernel
+    __atomic_store_n(&mismatch_kernel, kernel, __ATOMIC_RELAXED);
+    return kernel(a, b, length);
+}
+
+
+int (*mismatch_kernel)(const char* a, const char* b, int length) = mismatch_resolve;
@@ -0,0 +1,21 @@
+#pragma once
+
+// labels shorter than this are compared one character at a time
+#define MISMATCH_VECTOR_MIN 16
+
+// vectorized comparison for longer labels, chosen for the CPU on first use;
+//  read and set atomically, as the first use may be in several threads at once
+extern int (*mismatch_kernel)(const char* a, const char* b, int length);
+
+// return the first position among the first length characters where a and b
+//  differ, or length if they don't. Never reads a[length] or b[length].
+static inline int mismatch(const char* a, const char* b, int length){
+    if (length < MISMATCH_VECTOR_MIN){
+        int i = 0;
+        while (i < length && a[i] == b[i]){
+            ++i;
+        }
+        return i;
+    }
+    return __atomic_load_n(&mismatch_kernel, __ATOMIC_RELAXED)(a, b, length);
+}
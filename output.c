@@ -0,0 +1,233 @@
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include "output.h"
+
+#define OUTPUT_BUFFER_SIZE (1 << 18)
+
+/* BUFFER - lines waiting to be written to a file descriptor.
+     Everything is formatted straight into data and handed to the kernel in
+     big writes when it fills up, instead of going through stdio per line.
+*/
+typedef struct{
+    int fd;
+    int used;
+    char data[OUTPUT_BUFFER_SIZE];
+} Buffer;
+
+static Buffer out_buffer = {STDOUT_FILENO, 0, {0}};
+static Buffer err_buffer = {STDERR_FILENO, 0, {0}};
+
+static output_mode mode = OUTPUT_SEPARATE;
+
+// if 1, buffers are flushed after every command
+static int interactive = 0;
+
+// where stdout lines go instead of stdout, NULL if they don't
+static OutputText* capture = NULL;
+
+// where stdout lines are copied to, NULL if they aren't
+static OutputText* copy = NULL;
+
+// called before a buffer is written out, see output_on_flush
+static void (*flush_hook)() = NULL;
+
+
+// write all of a text to a file descriptor
+static void write_all(int fd, const char* text, int length){
+    int done = 0;
+    while (done < length){
+        ssize_t count = write(fd, text + done, length - done);
+        if (count < 0){
+            if (errno == EINTR){
+                continue;
+            }
+            // nobody is reading anymore, drop the output
+            break;
+        }
+        done += count;
+    }
+}
+
+
+// write the whole buffer to its file descriptor
+static void flush_buffer(Buffer* buffer){
+    if (flush_hook != NULL){
+        flush_hook();
+    }
+    write_all(buffer->fd, buffer->data, buffer->used);
+    buffer->used = 0;
+}
+
+
+// append raw characters to a buffer
+static void append(Buffer* buffer, const char* text, int length){
+    if (buffer->used + length > OUTPUT_BUFFER_SIZE){
+        flush_buffer(buffer);
+        if (length > OUTPUT_BUFFER_SIZE){
+            write_all(buffer->fd, text, length);
+            return;
+        }
+    }
+    memcpy(buffer->data + buffer->used, text, length);
+    buffer->used += length;
+}
+
+
+// write a number in decimal at the end of digits; returns where it starts
+static int format_number(char digits[12], int number){
+    int position = 12;
+    unsigned int value = number < 0 ? -(unsigned int)number : (unsigned int)number;
+    do{
+        digits[--position] = '0' + value % 10;
+        value /= 10;
+    } while (value != 0);
+    if (number < 0){
+        digits[--position] = '-';
+    }
+    return position;
+}
+
+
+// append a number in decimal
+static void append_number(Buffer* buffer, int number){
+    char digits[12];
+    int position = format_number(digits, number);
+    append(buffer, digits + position, sizeof(digits) - position);
+}
+
+
+// append raw characters to an output text
+static void text_append(OutputText* target, const char* text, int length){
+    if (target->used + length > target->capacity){
+        int capacity = target->capacity == 0 ? 256 : target->capacity;
+        while (target->used + length > capacity){
+            capacity *= 2;
+        }
+        char* data = realloc(target->data, capacity);
+        if (data == NULL){
+            return;
+        }
+        target->data = data;
+        target->capacity = capacity;
+    }
+    memcpy(target->data + target->used, text, length);
+    target->used += length;
+}
+
+
+// append raw characters to the captured text
+static void capture_append(const char* text, int length){
+    text_append(capture, text, length);
+}
+
+
+// copy a stdout line, made of a text and a number if has_number == 1, to
+//  the copied text if there is one
+static void copy_line(output_stream stream, const char* text, int has_number, int number){
+    if (copy == NULL || stream != STREAM_OUT){
+        return;
+    }
+    text_append(copy, text, strlen(text));
+    if (has_number == 1){
+        char digits[12];
+        int position = format_number(digits, number);
+        text_append(copy, digits + position, sizeof(digits) - position);
+    }
+    text_append(copy, "\n", 1);
+}
+
+
+// start a line in the captured text if it takes the stream's lines.
+//  Returns 1 if it does, 0 otherwise
+static int begin_captured_line(output_stream stream){
+    if (capture == NULL){
+        return 0;
+    }
+    if (mode == OUTPUT_MERGED){
+        capture_append(stream == STREAM_OUT ? "out " : "err ", 4);
+        return 1;
+    }
+    return stream == STREAM_OUT;
+}
+
+
+// get the buffer for a stream, flushing the other one first if lines must stay in order,
+//  and start the line with a tag if the streams are merged
+static Buffer* begin_line(output_stream stream){
+    if (mode == OUTPUT_MERGED){
+        append(&out_buffer, stream == STREAM_OUT ? "out " : "err ", 4);
+        return &out_buffer;
+    }
+    Buffer* buffer = stream == STREAM_OUT ? &out_buffer : &err_buffer;
+    Buffer* other = stream == STREAM_OUT ? &err_buffer : &out_buffer;
+    if (mode == OUTPUT_ORDERED && other->used > 0){
+        flush_buffer(other);
+    }
+    return buffer;
+}
+
+
+void output_init(output_mode new_mode){
+    mode = new_mode;
+    interactive = isatty(STDOUT_FILENO) || isatty(STDERR_FILENO);
+}
+
+
+void output_line(output_stream stream, const char* text){
+    copy_line(stream, text, 0, 0);
+    if (begin_captured_line(stream) == 1){
+        capture_append(text, strlen(text));
+        capture_append("\n", 1);
+        return;
+    }
+    Buffer* buffer = begin_line(stream);
+    append(buffer, text, strlen(text));
+    append(buffer, "\n", 1);
+}
+
+
+void output_number(output_stream stream, const char* text, int number){
+    copy_line(stream, text, 1, number);
+    if (begin_captured_line(stream) == 1){
+        char digits[12];
+        int position = format_number(digits, number);
+        capture_append(text, strlen(text));
+        capture_append(digits + position, sizeof(digits) - position);
+        capture_append("\n", 1);
+        return;
+    }
+    Buffer* buffer = begin_line(stream);
+    append(buffer, text, strlen(text));
+    append_number(buffer, number);
+    append(buffer, "\n", 1);
+}
+
+
+void output_command_done(){
+    if (interactive){
+        output_flush();
+    }
+}
+
+
+void output_flush(){
+    flush_buffer(&out_buffer);
+    flush_buffer(&err_buffer);
+}
+
+
+void output_capture(OutputText* text){
+    capture = text;
+}
+
+
+void output_copy(OutputText* text){
+    copy = text;
+}
+
+
+void output_on_flush(void (*hook)()){
+    flush_hook = hook;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+// where a line is meant to go
+typedef enum{
+    STREAM_OUT,
+    STREAM_ERR
+} output_stream;
+
+typedef enum{
+    OUTPUT_SEPARATE,  // stdout and stderr are buffered and flushed independently
+    OUTPUT_ORDERED,   // a stream is flushed before the other one gets a line,
+                      //  so lines keep their relative order across both
+    OUTPUT_MERGED     // everything goes to stdout, lines tagged with their stream
+} output_mode;
+
+// choose how results are written; the default is OUTPUT_SEPARATE
+void output_init(output_mode mode);
+
+// write a line of text to a stream
+void output_line(output_stream stream, const char* text);
+
+// write a line made of a text followed by a number to a stream
+void output_number(output_stream stream, const char* text, int number);
+
+// called after each command; flushes the buffers if a terminal is waiting for them
+void output_command_done();
+
+// write out everything that's buffered
+void output_flush();
+
+// call hook before buffered lines are written out, e.g. to make the commands
+//  they reply to durable first; a server calls output_flush before it sends
+//  replies, so the hook runs then too. NULL removes it
+void output_on_flush(void (*hook)());
+
+/* OUTPUT TEXT - a growable buffer that takes the lines meant for stdout
+   while it's captured, instead of stdout itself. In OUTPUT_MERGED mode it
+   takes the tagged stderr lines too; otherwise those still go to stderr.
+     data - the lines, data[0 .. used - 1]; NULL until the first line.
+*/
+typedef struct{
+    char* data;
+    int used;
+    int capacity;
+} OutputText;
+
+// send stdout lines to a text from now on, or to stdout again if it's NULL
+void output_capture(OutputText* text);
+
+// copy stdout lines to a text as well from now on, or stop if it's NULL;
+//  they still go where they would without it
+void output_copy(OutputText* text);
@@ -1,11 +1,34 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "parse.h"
+#include "alphabet.h"
 
-#define MAX_WORD_LENGTH 100500
+#define BLOCK_SIZE (1 << 20)  // bytes requested from stdin by a single read
 
-char buffer[MAX_WORD_LENGTH];
+/* INPUT - stdin is either mapped into memory as a whole (if it's a regular
+   file) or read in big blocks into buffer. Commands are parsed in place.
+     buffer - read blocks; a line that is cut by the end of a block is moved
+              to the front before the next read. Also holds the last line
+              of a mapped file if it has no endline.
+     input_next - first character of the next line.
+     input_end - end of the input read or mapped so far.
+   Every line handed to the parser ends with '\n', or with '\0' if it's
+   the last one and has no endline.
+*/
+char* buffer = NULL;
+size_t buffer_size = 0;
+const char* input_next = NULL;
+const char* input_end = NULL;
+int input_ready = 0;
+int input_mapped = 0;
+int input_eof = 0;
+
+// the line get_command parsed last, NULL if it found no more lines
+const char* last_line_start = NULL;
 
 
 int is_small_letter(char x){
@@ -18,6 +41,18 @@ int is_small_letter(char x){
 }
 
 
+// a character of a word: a letter of the alphabet the program is built with,
+//  looked up in its table
+int is_a_word_char(char x){
+    if (is_letter(x)){
+        return 1;
+    }
+    else{
+        return -1;
+    }
+}
+
+
 int is_a_space(char x){
     if (x == ' '){
         return 1;
@@ -28,6 +63,17 @@ int is_a_space(char x){
 }
 
 
+// any character allowed in a path: everything but spaces and control characters
+int is_a_path_char(char x){
+    if ((unsigned char)x > ' ' && x != 127){
+        return 1;
+    }
+    else{
+        return -1;
+    }
+}
+
+
 int is_a_digit(char x){
     if (x >= '0' && x <= '9'){
         return 1;
@@ -38,11 +84,11 @@ int is_a_digit(char x){
 }
 
 // returns a number parsed from a string
-int parse_number(char* number){
+int parse_number(const char* number, int length){
     // number is guaranteed to contain only digits, and less than 8 of them.
     int result = 0;
-    for (int i = 0; i < strlen(number); ++i){
-        if (number[i] == '0' && result == 0 && i != strlen(number) - 1){
+    for (int i = 0; i < length; ++i){
+        if (number[i] == '0' && result == 0 && i != length - 1){
             // leading 0 - that's an error.
             return -1;
         }
@@ -55,59 +101,153 @@ int parse_number(char* number){
 }
 
 
-// returns a struct containing command enum and arguments based on file input.
-Command get_command(){
+// make sure buffer can hold a given number of characters and a '\0' after them
+void reserve_buffer(size_t size){
+    if (size + 1 > buffer_size){
+        while (size + 1 > buffer_size){
+            buffer_size = buffer_size == 0 ? BLOCK_SIZE + 1 : buffer_size * 2;
+        }
+        buffer = realloc(buffer, buffer_size);
+    }
+}
+
+
+// map stdin if it's a non-empty regular file
+void init_input(){
+    struct stat info;
+    input_ready = 1;
+    if (fstat(STDIN_FILENO, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0){
+        off_t position = lseek(STDIN_FILENO, 0, SEEK_CUR);
+        void* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, STDIN_FILENO, 0);
+        if (position >= 0 && position <= info.st_size && data != MAP_FAILED){
+            madvise(data, info.st_size, MADV_SEQUENTIAL);
+            input_next = (const char*)data + position;
+            input_end = (const char*)data + info.st_size;
+            input_mapped = 1;
+            input_eof = 1;
+            return;
+        }
+        if (data != MAP_FAILED){
+            munmap(data, info.st_size);
+        }
+    }
+    reserve_buffer(BLOCK_SIZE);
+    input_next = input_end = buffer;
+}
+
+
+// return the beginning of the next input line, NULL if there are no more lines
+const char* next_line(){
+    if (input_ready == 0){
+        init_input();
+    }
+    while (1){
+        const char* endline = memchr(input_next, '\n', input_end - input_next);
+        if (endline != NULL){
+            const char* line = input_next;
+            input_next = endline + 1;
+            return line;
+        }
+        size_t rest = input_end - input_next;
+        if (input_eof == 1){
+            if (rest == 0){
+                return NULL;
+            }
+            // the last line has no endline
+            if (input_mapped == 1){
+                reserve_buffer(rest);
+                memcpy(buffer, input_next, rest);
+                input_next = buffer;
+            }
+            buffer[(input_next - buffer) + rest] = '\0';
+            const char* line = input_next;
+            input_next = input_end = input_next + rest;
+            return line;
+        }
+
+        // move the unfinished line to the front and read more after it
+        memmove(buffer, input_next, rest);
+        if (buffer_size - 1 - rest < BLOCK_SIZE / 2){
+            reserve_buffer(rest + BLOCK_SIZE);
+        }
+        ssize_t count = read(STDIN_FILENO, buffer + rest, buffer_size - 1 - rest);
+        if (count <= 0){
+            input_eof = 1;
+            count = 0;
+        }
+        input_next = buffer;
+        input_end = buffer + rest + count;
+    }
+}
+
+
+int arguments_stable(){
+    if (input_ready == 0){
+        init_input();
+    }
+    return input_mapped;
+}
+
+
+// returns a struct containing command enum and arguments based on a line
+//  ending with '\n' (or '\0' at the end of input).
+Command parse_line(const char* buffer){
     Command new_command;
     new_command.string_arg = NULL;
+    new_command.string_length = 0;
     
     // COMMAND TEMPLATES
-    // '$' - a word; '#' - a number; ' ' - 1 or more spaces; '!' - 0 or more spaces, then endline
-    static const char* ins = "insert $!";
-    static const char* pre = "prev # # #!";
-    static const char* del = "delete #!";
-    static const char* fin = "find $!";
-    static const char* cle = "clear!";
-
-    const char* expression;
-    void* status = fgets(buffer, MAX_WORD_LENGTH, stdin);
+    // '$' - a word; '#' - a number; '@' - a path;
+    // ' ' - 1 or more spaces; '!' - 0 or more spaces, then endline
+    static const struct{
+        query_type query;
+        const char* expression;
+    } templates[] = {
+        {INSERT, "insert $!"},
+        {PREV, "prev # # #!"},
+        {DELETE, "delete #!"},
+        {FIND, "find $!"},
+        {CLEAR, "clear!"},
+        {SAVE, "save @!"},
+        {LOAD, "load @!"},
+        {STATS, "stats!"},
+        {COUNT, "count $!"},
+        {LIST, "list $ #!"},
+        {BULKLOAD, "bulkload @!"},
+        {FREEZE, "freeze!"},
+        {THAW, "thaw!"},
+        {LOOKUP, "lookup $!"},
+        {SUFFIXES, "suffixes #!"},
+        {FUZZYFIND, "fuzzyfind $ #!"},
+        {COMPACT, "compact!"},
+        {USE, "use @!"}
+    };
+
+    const char* expression = NULL;
     int index = 0;
     int current_int_arg = 0;
-    if (status == NULL){
-        // fgets read an EOF, end the program.
-        new_command.query = END;
-        return new_command;
-    }
     while (is_a_space(buffer[index]) == 1){
         index++;
     }
     // now we are on the first non-space character.
 
-    char first_letter = buffer[index];
-    switch (first_letter){
-    case 'i':
-        new_command.query = INSERT;
-        expression = ins;
-        break;
-    case 'p':
-        new_command.query = PREV;
-        expression = pre;
-        break;
-    case 'd':
-        new_command.query = DELETE;
-        expression = del;
-        break;
-    case 'f':
-        new_command.query = FIND;
-        expression = fin;
-        break;
-    case 'c':
-        new_command.query = CLEAR;
-        expression = cle;
-        break;
-    default:
+    // the command name is the run of letters here; pick the template starting with it
+    int name_length = 0;
+    while (is_small_letter(buffer[index + name_length]) == 1){
+        ++name_length;
+    }
+    for (int i = 0; i < sizeof(templates) / sizeof(templates[0]); ++i){
+        const char* candidate = templates[i].expression;
+        if (strncmp(candidate, buffer + index, name_length) == 0 &&
+            (candidate[name_length] == ' ' || candidate[name_length] == '!')){
+            new_command.query = templates[i].query;
+            expression = candidate;
+            break;
+        }
+    }
+    if (expression == NULL){
         new_command.query = IGNORE;
         return new_command;
-        break;
     }
 
     for (int i = 0; i < strlen(expression); ++i){
@@ -123,35 +263,28 @@ Command get_command(){
             }
         }
         else if (expression[i] == '#'){
-            char* number = calloc(7, sizeof(char));
-            int number_length = 0;
+            int number_begin = index;
             while (is_a_digit(buffer[index]) == 1){
-                if (number_length < 6){
-                    number[number_length] = buffer[index];
-                }
-                ++number_length;
                 ++index;
             }
+            int number_length = index - number_begin;
             // We don't accept numbers longer than 6 digits because they're too big anyway.
             if (number_length == 0 || number_length > 6 || (is_a_space(buffer[index]) == -1 && buffer[index] != '\n')){
                 new_command.query = IGNORE;
-                free(number);
                 return new_command;
             }
-            int result = parse_number(number);
+            int result = parse_number(buffer + number_begin, number_length);
             if (result == -1){
                 new_command.query = IGNORE;
-                free(number);
                 return new_command;
             }
             new_command.int_args[current_int_arg] = result;
             current_int_arg++;
-            free(number);
         }
         else if (expression[i] == '$'){
             int word_begin = index;
             int word_length = 0;
-            while (is_small_letter(buffer[index]) == 1){
+            while (is_a_word_char(buffer[index]) == 1){
                 ++word_length;
                 ++index;
             }
@@ -160,12 +293,20 @@ Command get_command(){
                 new_command.query = IGNORE;
                 return new_command;
             }
-            index = word_begin;
-            new_command.string_arg = calloc(word_length + 1, sizeof(char));
-            for (int i = 0; i < word_length; i++){
-                new_command.string_arg[i] = buffer[index];
+            new_command.string_arg = buffer + word_begin;
+            new_command.string_length = word_length;
+        }
+        else if (expression[i] == '@'){
+            int path_begin = index;
+            while (is_a_path_char(buffer[index]) == 1){
                 ++index;
             }
+            if (index == path_begin){
+                new_command.query = IGNORE;
+                return new_command;
+            }
+            new_command.string_arg = buffer + path_begin;
+            new_command.string_length = index - path_begin;
         }
         else if (expression[i] == '!'){
             while (is_a_space(buffer[index]) == 1){
@@ -187,3 +328,27 @@ Command get_command(){
     }
     return new_command;
 }
+
+
+// returns a struct containing command enum and arguments based on file input.
+Command get_command(){
+    const char* line = next_line();
+    last_line_start = line;
+    if (line == NULL){
+        // there is no more input, end the program.
+        Command end = {END, NULL, 0, {0, 0, 0}};
+        return end;
+    }
+    return parse_line(line);
+}
+
+
+const char* last_line(int* length){
+    int size = 0;
+    while (last_line_start != NULL && last_line_start[size] != '\n' &&
+           last_line_start[size] != '\0'){
+        ++size;
+    }
+    *length = size;
+    return last_line_start;
+}
@@ -6,16 +6,45 @@ typedef enum{
     DELETE,
     FIND,
     CLEAR,
+    SAVE,
+    LOAD,
+    STATS,
+    COUNT,
+    LIST,
+    BULKLOAD,
+    FREEZE,
+    THAW,
+    LOOKUP,
+    SUFFIXES,
+    FUZZYFIND,
+    COMPACT,
+    USE,
     END,
     IGNORE
 } query_type;
 
-// all information our program needs to process a parsed query
+// all information our program needs to process a parsed query.
+//   string_arg points straight into the input and is not null-terminated;
+//   it is valid until the next call to get_command.
 typedef struct{
     query_type query;
-    char* string_arg;
+    const char* string_arg;
+    int string_length;
     int int_args[3];
 } Command;
 
 // process one line of input and return necessary information
-Command get_command();
\ No newline at end of file
+Command get_command();
+
+// parse a line that ends with '\n' the way get_command parses input lines;
+//  string_arg points into the line
+Command parse_line(const char* line);
+
+// the input line the last command of get_command was parsed from, without
+//  its endline, and its length; valid as long as that command's string_arg.
+//  NULL at the end of the input
+const char* last_line(int* length);
+
+// 1 if the string_arg of every command stays valid until the program ends
+//  (the input is mapped), 0 if it's overwritten by the next get_command
+int arguments_stable();
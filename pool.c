@@ -0,0 +1,86 @@
+#include <stdlib.h>
+#include "pool.h"
+
+#define SLAB_SIZE (1 << 16)   // bytes per slab, including its header
+#define SLAB_FIRST (1 << 10)  // bytes of a pool's first slab; each next one is twice as big,
+                              //  up to SLAB_SIZE, so small pools stay small
+
+// every slab starts with a pointer to the previous one; objects follow,
+//  aligned like a pointer.
+#define SLAB_HEADER sizeof(void*)
+
+
+void pool_init(Pool* pool, size_t object_size){
+    // objects on the free list must be able to hold a pointer
+    if (object_size < sizeof(void*)){
+        object_size = sizeof(void*);
+    }
+    object_size = (object_size + sizeof(void*) - 1) / sizeof(void*) * sizeof(void*);
+
+    pool->object_size = object_size;
+    pool->free_list = NULL;
+    pool->slabs = NULL;
+    pool->next = NULL;
+    pool->end = NULL;
+    pool->slab_size = SLAB_FIRST;
+}
+
+
+// allocate a new slab and make it the one objects are carved from.
+//  Returns -1 if there's no memory for it
+static int pool_grow(Pool* pool){
+    size_t slab_size = pool->slab_size;
+    if (slab_size < SLAB_HEADER + pool->object_size){
+        slab_size = SLAB_HEADER + pool->object_size;
+    }
+    char* slab = malloc(slab_size);
+    if (slab == NULL){
+        return -1;
+    }
+    *(void**)slab = pool->slabs;
+    pool->slabs = slab;
+    pool->next = slab + SLAB_HEADER;
+    pool->end = slab + slab_size;
+    if (pool->slab_size < SLAB_SIZE){
+        pool->slab_size *= 2;
+    }
+    return 1;
+}
+
+
+void* pool_alloc(Pool* pool){
+    if (pool->free_list != NULL){
+        void* object = pool->free_list;
+        pool->free_list = *(void**)object;
+        return object;
+    }
+    if (pool->next == NULL || (size_t)(pool->end - pool->next) < pool->object_size){
+        if (pool_grow(pool) == -1){
+            return NULL;
+        }
+    }
+    void* object = pool->next;
+    pool->next += pool->object_size;
+    return object;
+}
+
+
+void pool_free(Pool* pool, void* object){
+    *(void**)object = pool->free_list;
+    pool->free_list = object;
+}
+
+
+void pool_release(Pool* pool){
+    void* slab = pool->slabs;
+    while (slab != NULL){
+        void* previous = *(void**)slab;
+        free(slab);
+        slab = previous;
+    }
+    pool->free_list = NULL;
+    pool->slabs = NULL;
+    pool->next = NULL;
+    pool->end = NULL;
+    pool->slab_size = SLAB_FIRST;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stddef.h>
+
+/* POOL - allocator for objects of one fixed size.
+     Objects are carved from slabs that grow up to a large size; freed
+     objects are kept on a free list and handed out again before new slabs
+     are allocated. Releasing the pool drops all slabs at once, without
+     visiting the objects.
+*/
+typedef struct{
+    size_t object_size;
+    void* free_list;   // freed objects, linked through their first bytes
+    void* slabs;       // allocated slabs, linked through their first bytes
+    char* next;        // first unused byte of the newest slab
+    char* end;         // end of the newest slab
+    size_t slab_size;  // bytes of the next slab
+} Pool;
+
+// prepare an empty pool for objects of a given size
+void pool_init(Pool* pool, size_t object_size);
+
+// get memory for one object, NULL if there's none left
+void* pool_alloc(Pool* pool);
+
+// give an object back to the pool
+void pool_free(Pool* pool, void* object);
+
+// free all slabs; every object taken from the pool becomes invalid
+void pool_release(Pool* pool);
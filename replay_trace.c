@@ -0,0 +1,482 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* Replay of a trace recorded by dictionary --trace against dictionary
+   --serve, over one connection. The commands are sent at the times they
+   were read, divided by --speed, without waiting for the replies, or each
+   one as soon as the one before is answered with --speed 0. The replies are
+   compared with the recorded ones; those of stats, which change from run
+   to run, only by their number of lines. The server must not be run with
+   --merged. Prints a line for every command name, then one for all of them:
+     bench=replay command=<name> ops=<n> p50_ns=<x> p99_ns=<x> p999_ns=<x>
+     bench=replay ops=<n> seconds=<s> ops_per_s=<x> p50_ns=<x> p99_ns=<x>
+     p999_ns=<x> behind_ns=<x> mismatches=<n>
+   The latency of a command is the time from sending it to receiving the
+   last line of its reply; behind_ns is how late the latest command was sent.
+   Usage: replay_trace <socket path> <trace file> [--speed x]
+                       [--baseline file] [--tolerance percent]
+     --speed - 1 (the default) keeps the recorded pace, 2 is twice as fast,
+               0 as fast as possible.
+     --baseline - a file whose last line was printed by an earlier replay;
+                  the replay fails if its p50_ns or p99_ns is more than
+                  --tolerance percent (default 25) above the baseline's.
+   Exits with 1 if a reply differs or the connection fails, 2 if the latency
+   is above the baseline's, 0 otherwise.
+*/
+
+#define REPLY_BUFFER_SIZE (1 << 16)
+#define MAX_NAMES 32           // command names reported separately, the rest as "other"
+#define CONNECT_TRIES 50       // a server that's just been started gets 5 seconds
+#define STALL_MS 1000          // no reply for this long while one is awaited is an error
+
+/* TRACE COMMAND - a command of the trace.
+     time - when it was read, in nanoseconds since the trace was started.
+     line - the input line, followed by its endline in the trace.
+     replies - offset of its reply lines in the recorded replies, each line
+               ended by '\n'.
+     compared - 0 if only the number of its reply lines is compared.
+     name - index of its command name in names.
+*/
+typedef struct{
+    uint64_t time;
+    const char* line;
+    int length;
+    long replies;
+    int reply_length;
+    int reply_lines;
+    int compared;
+    int name;
+} TraceCommand;
+
+TraceCommand* commands = NULL;
+long command_count = 0;
+char* replies = NULL;
+
+const char* names[MAX_NAMES + 1];
+int name_lengths[MAX_NAMES + 1];
+int name_count = 0;
+
+double speed = 1;
+int fd = -1;
+
+// written by the sender: sent_at[x] for x < sent
+uint64_t* sent_at = NULL;
+_Atomic long sent = 0;
+// written by the receiver: commands whose whole reply has arrived
+_Atomic long answered = 0;
+// 1 while the sender waits for answered with --speed 0
+_Atomic int waiting = 0;
+_Atomic int failed = 0;
+uint64_t behind = 0;
+
+
+uint64_t now_ns(){
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1000000000ull + time.tv_nsec;
+}
+
+
+int compare_samples(const void* a, const void* b){
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+
+uint32_t percentile(const uint32_t* samples, long count, double fraction){
+    long index = (long)(fraction * count);
+    return samples[index < count ? index : count - 1];
+}
+
+
+// a socket connected to the server, -1 on fail
+int connect_to(const char* path){
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)){
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+    for (int i = 0; i < CONNECT_TRIES; ++i){
+        int socket_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (socket_fd == -1){
+            return -1;
+        }
+        if (connect(socket_fd, (struct sockaddr*)&address, sizeof(address)) == 0){
+            return socket_fd;
+        }
+        close(socket_fd);
+        usleep(100000);
+    }
+    return -1;
+}
+
+
+// send a whole line. Returns -1 on fail
+int send_line(const char* line, int length){
+    int done = 0;
+    while (done < length){
+        ssize_t count = send(fd, line + done, length - done, MSG_NOSIGNAL);
+        if (count < 0 && errno == EINTR){
+            continue;
+        }
+        if (count <= 0){
+            return -1;
+        }
+        done += count;
+    }
+    return 1;
+}
+
+
+// the index of a command's name (the letters it starts with) in names
+int name_of(const char* line, int length){
+    int start = 0;
+    while (start < length && line[start] == ' '){
+        ++start;
+    }
+    int end = start;
+    while (end < length && line[end] >= 'a' && line[end] <= 'z'){
+        ++end;
+    }
+    for (int i = 0; i < name_count; ++i){
+        if (name_lengths[i] == end - start && memcmp(names[i], line + start, end - start) == 0){
+            return i;
+        }
+    }
+    if (name_count == MAX_NAMES){
+        names[MAX_NAMES] = "other";
+        name_lengths[MAX_NAMES] = 5;
+        return MAX_NAMES;
+    }
+    names[name_count] = end > start ? line + start : "empty";
+    name_lengths[name_count] = end > start ? end - start : 5;
+    return name_count++;
+}
+
+
+// read a trace into commands and replies; the lines point into data.
+//  Returns -1 if it isn't a trace
+int read_trace(char* data, size_t size){
+    long capacity = 0;
+    long reply_used = 0;
+    long reply_capacity = 0;
+    for (char* line = data; line < data + size; ){
+        char* endline = memchr(line, '\n', data + size - line);
+        if (endline == NULL || endline - line < 2 || line[1] != ' '){
+            return -1;
+        }
+        if (line[0] == 'T'){
+            if (command_count == capacity){
+                capacity = capacity == 0 ? 1024 : 2 * capacity;
+                commands = realloc(commands, capacity * sizeof(TraceCommand));
+            }
+            TraceCommand* command = &commands[command_count++];
+            char* end;
+            command->time = strtoull(line + 2, &end, 10);
+            if (end == line + 2 || *end != ' '){
+                return -1;
+            }
+            command->line = end + 1;
+            command->length = endline - command->line;
+            command->replies = reply_used;
+            command->reply_length = 0;
+            command->reply_lines = 0;
+            command->name = name_of(command->line, command->length);
+            command->compared = name_lengths[command->name] != 5 ||
+                                memcmp(names[command->name], "stats", 5) != 0;
+        }
+        else if (line[0] == 'R' && command_count > 0){
+            int length = endline + 1 - (line + 2);
+            if (reply_used + length > reply_capacity){
+                reply_capacity = 2 * (reply_used + length);
+                replies = realloc(replies, reply_capacity);
+            }
+            memcpy(replies + reply_used, line + 2, length);
+            reply_used += length;
+            commands[command_count - 1].reply_length += length;
+            commands[command_count - 1].reply_lines += 1;
+        }
+        else{
+            return -1;
+        }
+        line = endline + 1;
+    }
+    return 1;
+}
+
+
+// send the commands at their times, or each once the previous one is answered
+void* run_sender(void* unused){
+    uint64_t start = now_ns();
+    for (long i = 0; i < command_count && failed == 0; ++i){
+        if (speed > 0){
+            uint64_t target = start + (uint64_t)(commands[i].time / speed);
+            uint64_t now = now_ns();
+            if (now < target){
+                struct timespec delay = {(target - now) / 1000000000ull,
+                                         (target - now) % 1000000000ull};
+                nanosleep(&delay, NULL);
+                now = now_ns();
+            }
+            if (now > target && now - target > behind){
+                behind = now - target;
+            }
+        }
+        else{
+            waiting = 1;
+            while (answered < i && failed == 0){
+                sched_yield();
+            }
+            waiting = 0;
+        }
+        sent_at[i] = now_ns();
+        atomic_store_explicit(&sent, i + 1, memory_order_release);
+        if (send_line(commands[i].line, commands[i].length + 1) == -1){
+            failed = 1;
+        }
+    }
+    // the server answers what's left and closes the connection
+    shutdown(fd, SHUT_WR);
+    return NULL;
+}
+
+
+// receive the replies in order and time them. Returns the number of
+//  commands whose reply differs from the recorded one
+long receive_replies(uint32_t* samples){
+    char* reply = malloc(REPLY_BUFFER_SIZE);
+    int used = 0;
+    long mismatches = 0;
+    long i = 0;
+    while (i < command_count){
+        if (commands[i].reply_lines == 0){
+            samples[i] = 0;
+            answered = ++i;
+            continue;
+        }
+        // reply[0 .. used - 1] is received, the first lines of it are the
+        //  lines of command i's reply that have arrived
+        char* end = reply;
+        int lines = 0;
+        while (lines < commands[i].reply_lines){
+            char* endline = memchr(end, '\n', reply + used - end);
+            if (endline == NULL){
+                break;
+            }
+            end = endline + 1;
+            ++lines;
+        }
+        if (lines == commands[i].reply_lines){
+            // the reply came after the command, so sent is past i
+            atomic_load_explicit(&sent, memory_order_acquire);
+            uint64_t time = now_ns() - sent_at[i];
+            samples[i] = time > UINT32_MAX ? UINT32_MAX : time;
+            const char* expected = replies + commands[i].replies;
+            if (commands[i].compared == 1 && (end - reply != commands[i].reply_length ||
+                                              memcmp(reply, expected, end - reply) != 0)){
+                if (mismatches == 0){
+                    fprintf(stderr, "Error: command %ld (%.*s) got a different reply\n", i,
+                            commands[i].length, commands[i].line);
+                }
+                ++mismatches;
+            }
+            memmove(reply, end, reply + used - end);
+            used -= end - reply;
+            answered = ++i;
+            continue;
+        }
+
+        if (used == REPLY_BUFFER_SIZE){
+            fprintf(stderr, "Error: the reply to command %ld is too long\n", i);
+            break;
+        }
+        struct pollfd ready = {fd, POLLIN, 0};
+        int count = poll(&ready, 1, STALL_MS);
+        if (count == 0 && waiting == 1){
+            fprintf(stderr, "Error: no reply to command %ld\n", i);
+            break;
+        }
+        if (count <= 0){
+            if (count < 0 && errno != EINTR){
+                break;
+            }
+            continue;
+        }
+        ssize_t received = recv(fd, reply + used, REPLY_BUFFER_SIZE - used, 0);
+        if (received < 0 && errno == EINTR){
+            continue;
+        }
+        if (received <= 0){
+            fprintf(stderr, "Error: the server closed the connection at command %ld\n", i);
+            break;
+        }
+        used += received;
+    }
+    if (i < command_count){
+        failed = 1;
+    }
+    free(reply);
+    return mismatches;
+}
+
+
+// print the latencies of the commands with a given name, or of all of
+//  them if name is -1. Returns the line's p50 and p99
+void report(const uint32_t* samples, int name, double seconds, long mismatches,
+            uint32_t* p50, uint32_t* p99){
+    uint32_t* chosen = malloc(command_count * sizeof(uint32_t) + 1);
+    long count = 0;
+    for (long i = 0; i < command_count; ++i){
+        if ((name == -1 || commands[i].name == name) && commands[i].reply_lines > 0){
+            chosen[count++] = samples[i];
+        }
+    }
+    if (count > 0){
+        qsort(chosen, count, sizeof(uint32_t), compare_samples);
+        *p50 = percentile(chosen, count, 0.5);
+        *p99 = percentile(chosen, count, 0.99);
+        if (name != -1){
+            printf("bench=replay command=%.*s ops=%ld p50_ns=%u p99_ns=%u p999_ns=%u\n",
+                   name_lengths[name], names[name], count, *p50, *p99,
+                   percentile(chosen, count, 0.999));
+        }
+        else{
+            printf("bench=replay ops=%ld seconds=%.6f ops_per_s=%.0f p50_ns=%u p99_ns=%u "
+                   "p999_ns=%u behind_ns=%llu mismatches=%ld\n",
+                   count, seconds, count / seconds, *p50, *p99, percentile(chosen, count, 0.999),
+                   (unsigned long long)behind, mismatches);
+        }
+    }
+    free(chosen);
+}
+
+
+// compare p50 and p99 with the last line of a baseline file. Returns 1 if
+//  they're within tolerance percent of it or there is no baseline, -1 otherwise
+int check_baseline(const char* path, double tolerance, uint32_t p50, uint32_t p99){
+    FILE* file = fopen(path, "r");
+    if (file == NULL){
+        fprintf(stderr, "No baseline in %s yet\n", path);
+        return 1;
+    }
+    char line[1024];
+    char last[1024] = "";
+    while (fgets(line, sizeof(line), file) != NULL){
+        strcpy(last, line);
+    }
+    fclose(file);
+    const char* p50_field = strstr(last, "p50_ns=");
+    const char* p99_field = strstr(last, "p99_ns=");
+    unsigned int base50;
+    unsigned int base99;
+    if (p50_field == NULL || p99_field == NULL || sscanf(p50_field, "p50_ns=%u", &base50) != 1 ||
+        sscanf(p99_field, "p99_ns=%u", &base99) != 1){
+        fprintf(stderr, "Error: %s is not a result of replay_trace\n", path);
+        return -1;
+    }
+    double limit = 1 + tolerance / 100;
+    if (p50 > base50 * limit || p99 > base99 * limit){
+        fprintf(stderr, "Regression: p50_ns=%u p99_ns=%u, baseline p50_ns=%u p99_ns=%u\n",
+                p50, p99, base50, base99);
+        return -1;
+    }
+    return 1;
+}
+
+
+int main(int argc, char* argv[]){
+    const char* baseline = NULL;
+    double tolerance = 25;
+    if (argc < 3){
+        fprintf(stderr, "Usage: replay_trace <socket path> <trace file> [--speed x] "
+                        "[--baseline file] [--tolerance percent]\n");
+        return 1;
+    }
+    for (int i = 3; i < argc; i += 2){
+        if (i + 1 < argc && strcmp(argv[i], "--speed") == 0){
+            speed = atof(argv[i + 1]);
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--baseline") == 0){
+            baseline = argv[i + 1];
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--tolerance") == 0){
+            tolerance = atof(argv[i + 1]);
+        }
+        else{
+            fprintf(stderr, "Error: wrong parameter %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (speed < 0){
+        fprintf(stderr, "Error: wrong speed\n");
+        return 1;
+    }
+
+    FILE* file = fopen(argv[2], "r");
+    char* data = NULL;
+    long size = 0;
+    if (file != NULL && fseek(file, 0, SEEK_END) == 0 && (size = ftell(file)) >= 0){
+        data = malloc(size + 1);
+        rewind(file);
+        if (data != NULL && fread(data, 1, size, file) != size){
+            free(data);
+            data = NULL;
+        }
+    }
+    if (file != NULL){
+        fclose(file);
+    }
+    if (data == NULL || read_trace(data, size) == -1){
+        fprintf(stderr, "Error: cannot read trace %s\n", argv[2]);
+        return 1;
+    }
+    fd = connect_to(argv[1]);
+    if (fd == -1){
+        fprintf(stderr, "Error: cannot connect to %s\n", argv[1]);
+        return 1;
+    }
+
+    sent_at = malloc(command_count * sizeof(uint64_t) + 1);
+    uint32_t* samples = malloc(command_count * sizeof(uint32_t) + 1);
+    pthread_t sender;
+    uint64_t start = now_ns();
+    if (pthread_create(&sender, NULL, run_sender, NULL) != 0){
+        fprintf(stderr, "Error: cannot start the sender\n");
+        return 1;
+    }
+    long mismatches = receive_replies(samples);
+    pthread_join(sender, NULL);
+    double seconds = (now_ns() - start) * 1e-9;
+    close(fd);
+
+    uint32_t p50 = 0;
+    uint32_t p99 = 0;
+    for (int name = 0; name < name_count + (name_count == MAX_NAMES); ++name){
+        report(samples, name, seconds, mismatches, &p50, &p99);
+    }
+    report(samples, -1, seconds, mismatches, &p50, &p99);
+    int status = failed == 1 || mismatches > 0 ? 1 : 0;
+    if (status == 0 && baseline != NULL && check_baseline(baseline, tolerance, p50, p99) == -1){
+        status = 2;
+    }
+    free(sent_at);
+    free(samples);
+    free(commands);
+    free(replies);
+    free(data);
+    return status;
+}
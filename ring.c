@@ -0,0 +1,54 @@
+#include <stdlib.h>
+#include "ring.h"
+
+
+int ring_init(Ring* ring, size_t capacity, size_t element_size){
+    ring->elements = calloc(capacity, element_size);
+    if (ring->elements == NULL){
+        return -1;
+    }
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    ring->mask = capacity - 1;
+    ring->element_size = element_size;
+    return 1;
+}
+
+
+void* ring_back(Ring* ring){
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    // the consumer must be done with the slot before it's filled again
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (tail - head > ring->mask){
+        return NULL;
+    }
+    return ring->elements + (tail & ring->mask) * ring->element_size;
+}
+
+
+void ring_push(Ring* ring){
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+
+void* ring_front(Ring* ring){
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head == tail){
+        return NULL;
+    }
+    return ring->elements + (head & ring->mask) * ring->element_size;
+}
+
+
+void ring_pop(Ring* ring){
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+
+void ring_release(Ring* ring){
+    free(ring->elements);
+    ring->elements = NULL;
+}
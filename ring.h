@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+/* RING - bounded queue of fixed-size elements between exactly one producer
+   thread and exactly one consumer thread, without locks.
+     Elements are filled and read in place: the producer takes a free slot
+     with ring_back, fills it and publishes it with ring_push; the consumer
+     reads the oldest element through ring_front and gives its slot back
+     with ring_pop. A slot is not reused until it's popped.
+     head - number of elements popped so far, written by the consumer.
+     tail - number of elements pushed so far, written by the producer.
+*/
+typedef struct{
+    _Atomic size_t head;
+    char head_padding[56];   // head and tail are written by different threads
+    _Atomic size_t tail;
+    char tail_padding[56];
+    size_t mask;             // capacity - 1, the capacity is a power of 2
+    size_t element_size;
+    char* elements;
+} Ring;
+
+// prepare an empty ring for capacity (a power of 2) elements. Returns -1 on fail
+int ring_init(Ring* ring, size_t capacity, size_t element_size);
+
+// producer: a free slot to fill, NULL if the ring is full
+void* ring_back(Ring* ring);
+
+// producer: make the slot from ring_back visible to the consumer
+void ring_push(Ring* ring);
+
+// consumer: the oldest element, NULL if the ring is empty
+void* ring_front(Ring* ring);
+
+// consumer: free the slot of the element from ring_front
+void ring_pop(Ring* ring);
+
+// free the ring's memory
+void ring_release(Ring* ring);
@@ -0,0 +1,359 @@
+#define _GNU_SOURCE  // accept4
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include "server.h"
+#include "output.h"
+
+#define SERVER_EVENTS 64          // events taken from epoll at once
+#define SERVER_BACKLOG 128        // connections waiting to be accepted
+#define READ_SIZE (1 << 16)       // bytes requested from a client by a single read
+#define MAX_LINE (1 << 24)        // a client sending a longer line is dropped
+#define WRITE_LIMIT (1 << 22)     // a client with more replies waiting isn't read from
+
+/* CONNECTION - a client.
+     fd - its socket.
+     index - its place in connections.
+     input - received characters that aren't part of a handled line yet,
+             input[0 .. input_used - 1].
+     output - replies, the ones from output.data + sent on haven't been sent yet.
+     events - what epoll waits for on the socket.
+     closing - 1 once the client has stopped sending; the connection is
+               closed when every reply is sent.
+     session - see server_handler.
+*/
+typedef struct{
+    int fd;
+    int index;
+    char* input;
+    int input_used;
+    int input_capacity;
+    OutputText output;
+    int sent;
+    uint32_t events;
+    int closing;
+    void* session;
+} Connection;
+
+static Connection** connections = NULL;
+static int connection_count = 0;
+static int connection_capacity = 0;
+
+static volatile sig_atomic_t stopping = 0;
+
+
+static void stop(int number){
+    stopping = 1;
+}
+
+
+// make room for a given number of received characters and a '\0' after them
+static int reserve_input(Connection* connection, int size){
+    if (size + 1 > connection->input_capacity){
+        int capacity = connection->input_capacity == 0 ? READ_SIZE + 1 : connection->input_capacity;
+        while (size + 1 > capacity){
+            capacity *= 2;
+        }
+        char* input = realloc(connection->input, capacity);
+        if (input == NULL){
+            return -1;
+        }
+        connection->input = input;
+        connection->input_capacity = capacity;
+    }
+    return 1;
+}
+
+
+// register a new client. Returns -1 on fail
+static int add_connection(int epoll, int fd){
+    if (connection_count == connection_capacity){
+        int capacity = connection_capacity == 0 ? 16 : 2 * connection_capacity;
+        Connection** grown = realloc(connections, capacity * sizeof(Connection*));
+        if (grown == NULL){
+            return -1;
+        }
+        connections = grown;
+        connection_capacity = capacity;
+    }
+    Connection* connection = calloc(1, sizeof(Connection));
+    if (connection == NULL){
+        return -1;
+    }
+    connection->fd = fd;
+    connection->events = EPOLLIN;
+    struct epoll_event event = {EPOLLIN, {.ptr = connection}};
+    if (epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event) == -1){
+        free(connection);
+        return -1;
+    }
+    connection->index = connection_count;
+    connections[connection_count++] = connection;
+    return 1;
+}
+
+
+// close a client's socket and forget it
+static void remove_connection(Connection* connection){
+    close(connection->fd);
+    Connection* last = connections[--connection_count];
+    connections[connection->index] = last;
+    last->index = connection->index;
+    free(connection->input);
+    free(connection->output.data);
+    free(connection);
+}
+
+
+// accept every client that's waiting
+static void accept_clients(int epoll, int listener){
+    while (1){
+        int fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1){
+            // EAGAIN once there are no more; anything else is the client's problem
+            if (errno == EINTR || errno == ECONNABORTED){
+                continue;
+            }
+            return;
+        }
+        if (add_connection(epoll, fd) == -1){
+            close(fd);
+        }
+    }
+}
+
+
+// handle every complete line a client has sent, and the last one without
+//  endline too if the client has stopped sending
+static void handle_lines(Connection* connection, server_handler handle){
+    output_capture(&connection->output);
+    int start = 0;
+    while (start < connection->input_used){
+        char* line = connection->input + start;
+        char* endline = memchr(line, '\n', connection->input_used - start);
+        if (endline == NULL && connection->closing == 0){
+            break;
+        }
+        if (endline == NULL){
+            // like the last line of the input, it ends with '\0'
+            connection->input[connection->input_used] = '\0';
+            endline = connection->input + connection->input_used;
+        }
+        handle(parse_line(line), &connection->session);
+        start = endline - connection->input + 1;
+    }
+    output_capture(NULL);
+    if (start >= connection->input_used){
+        connection->input_used = 0;
+    }
+    else if (start > 0){
+        memmove(connection->input, connection->input + start, connection->input_used - start);
+        connection->input_used -= start;
+    }
+}
+
+
+// read what a client has sent. Returns -1 if the connection is broken
+static int receive(Connection* connection){
+    if (reserve_input(connection, connection->input_used + READ_SIZE) == -1){
+        return -1;
+    }
+    ssize_t count = read(connection->fd, connection->input + connection->input_used, READ_SIZE);
+    if (count < 0){
+        return errno == EAGAIN || errno == EINTR ? 1 : -1;
+    }
+    if (count == 0){
+        connection->closing = 1;
+    }
+    connection->input_used += count;
+    return 1;
+}
+
+
+// send as many waiting replies as the socket takes. Returns -1 if the
+//  connection is broken
+static int send_replies(Connection* connection){
+    OutputText* output = &connection->output;
+    while (connection->sent < output->used){
+        ssize_t count = send(connection->fd, output->data + connection->sent,
+                             output->used - connection->sent, MSG_NOSIGNAL);
+        if (count < 0){
+            if (errno == EINTR){
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK){
+                break;
+            }
+            return -1;
+        }
+        connection->sent += count;
+    }
+    if (connection->sent == output->used){
+        connection->sent = 0;
+        output->used = 0;
+    }
+    else if (connection->sent > output->used / 2){
+        memmove(output->data, output->data + connection->sent, output->used - connection->sent);
+        output->used -= connection->sent;
+        connection->sent = 0;
+    }
+    return 1;
+}
+
+
+// wait for what a client needs next: its lines, unless it has stopped
+//  sending or has too many replies waiting, and room in the socket if any
+//  reply is waiting. Returns -1 on fail
+static int watch(int epoll, Connection* connection){
+    int waiting = connection->output.used - connection->sent;
+    uint32_t events = 0;
+    if (connection->closing == 0 && waiting < WRITE_LIMIT){
+        events |= EPOLLIN;
+    }
+    if (waiting > 0){
+        events |= EPOLLOUT;
+    }
+    if (events == connection->events){
+        return 1;
+    }
+    connection->events = events;
+    struct epoll_event event = {events, {.ptr = connection}};
+    return epoll_ctl(epoll, EPOLL_CTL_MOD, connection->fd, &event) == -1 ? -1 : 1;
+}
+
+
+// read and handle what a client has sent, if its socket is ready for it.
+//  Returns -1 if the connection is broken
+static int serve_lines(Connection* connection, uint32_t events, server_handler handle){
+    if ((events & EPOLLERR) != 0){
+        return -1;
+    }
+    if ((events & (EPOLLIN | EPOLLHUP)) != 0 && connection->closing == 0){
+        if (receive(connection) == -1){
+            return -1;
+        }
+        handle_lines(connection, handle);
+        if (connection->input_used >= MAX_LINE){
+            return -1;
+        }
+    }
+    return 1;
+}
+
+
+// send a client's replies and wait for what it needs next. Returns -1 if the
+//  connection is over: broken, or the client has stopped sending and has
+//  every reply
+static int serve_replies(int epoll, Connection* connection){
+    if (send_replies(connection) == -1){
+        return -1;
+    }
+    if (connection->closing == 1 && connection->output.used == 0){
+        return -1;
+    }
+    return watch(epoll, connection);
+}
+
+
+// a listening unix socket at path, -1 on fail. A socket left there by an
+//  earlier server is replaced, any other file isn't
+static int listen_at(const char* path){
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)){
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+    struct stat info;
+    if (lstat(path, &info) == 0 && S_ISSOCK(info.st_mode)){
+        unlink(path);
+    }
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listener == -1){
+        return -1;
+    }
+    if (bind(listener, (struct sockaddr*)&address, sizeof(address)) == -1){
+        close(listener);
+        return -1;
+    }
+    // clients can read and write files as the server's user with save, load
+    //  and bulkload, so only that user may connect. Nobody can connect
+    //  before listen, so there's no moment where others could
+    if (chmod(path, S_IRUSR | S_IWUSR) == -1 || listen(listener, SERVER_BACKLOG) == -1){
+        close(listener);
+        unlink(path);
+        return -1;
+    }
+    return listener;
+}
+
+
+int serve(const char* path, server_handler handle){
+    int listener = listen_at(path);
+    if (listener == -1){
+        return -1;
+    }
+    int epoll = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event event = {EPOLLIN, {.ptr = NULL}};
+    if (epoll == -1 || epoll_ctl(epoll, EPOLL_CTL_ADD, listener, &event) == -1){
+        close(listener);
+        unlink(path);
+        return -1;
+    }
+
+    // without SA_RESTART the signals interrupt epoll_wait
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    struct epoll_event events[SERVER_EVENTS];
+    Connection* ready[SERVER_EVENTS];
+    while (stopping == 0){
+        int count = epoll_wait(epoll, events, SERVER_EVENTS, -1);
+        if (count == -1 && errno != EINTR){
+            break;
+        }
+        int ready_count = 0;
+        for (int i = 0; i < count; ++i){
+            Connection* connection = events[i].data.ptr;
+            if (connection == NULL){
+                accept_clients(epoll, listener);
+            }
+            else if (serve_lines(connection, events[i].events, handle) == -1){
+                remove_connection(connection);
+            }
+            else{
+                ready[ready_count++] = connection;
+            }
+        }
+        // lines the commands wrote to stderr; the flush hook runs once for
+        //  the replies of all the clients, before any of them is sent
+        output_flush();
+        for (int i = 0; i < ready_count; ++i){
+            if (serve_replies(epoll, ready[i]) == -1){
+                remove_connection(ready[i]);
+            }
+        }
+    }
+
+    while (connection_count > 0){
+        remove_connection(connections[0]);
+    }
+    free(connections);
+    connections = NULL;
+    connection_capacity = 0;
+    close(epoll);
+    close(listener);
+    unlink(path);
+    return 1;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "parse.h"
+
+/* SERVER - answers the commands of any number of clients connected to a
+   unix socket, on one thread with an epoll loop. A client sends command
+   lines like the ones of the input and gets back what they print to stdout,
+   in the same order; the lines of a client are handled in the order they
+   come, the lines of different clients in any order. Every connection has
+   a read buffer, holding the part of a line that hasn't arrived yet, and a
+   write buffer, holding replies the client hasn't taken yet. A client that
+   doesn't read its replies isn't read from until it does. The replies to
+   the lines handled after a wait for the sockets are sent after an
+   output_flush, so its hook runs once for all of them.
+*/
+
+/* SERVER HANDLER - runs one command of a client and prints its result
+   with the output functions, whose stdout lines go to the client.
+     session - NULL for a new client, then whatever the handler stores in
+               it; the handler keeps its state of the client there.
+*/
+typedef void (*server_handler)(Command command, void** session);
+
+// serve clients on a unix socket at path until SIGINT or SIGTERM, then
+//  remove the socket. Only the user running the server may connect to it.
+//  Returns -1 if it can't be set up, 1 otherwise
+int serve(const char* path, server_handler handle);
@@ -0,0 +1,349 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "snapshot.h"
+#include "mismatch.h"
+#include "fuzzy.h"
+
+
+static uint64_t align8(uint64_t offset){
+    return (offset + 7) & ~(uint64_t)7;
+}
+
+
+uint64_t snapshot_layout(SnapshotHeader* header, uint32_t node_count, uint32_t id_count,
+                         uint32_t label_bytes){
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic));
+    header->version = SNAPSHOT_VERSION;
+    header->byte_order = SNAPSHOT_BYTE_ORDER;
+    header->alphabet_size = ALPHABET_SIZE;
+    header->node_count = node_count;
+    header->id_count = id_count;
+    header->label_bytes = label_bytes;
+
+    header->nodes_offset = align8(sizeof(*header));
+    header->ids_offset = align8(header->nodes_offset + ((uint64_t)node_count + 1) * sizeof(SnapshotNode));
+    header->labels_offset = align8(header->ids_offset + (uint64_t)id_count * sizeof(uint32_t));
+    header->size = header->labels_offset + label_bytes;
+    return header->size;
+}
+
+
+int snapshot_attach(Snapshot* snapshot, const void* block, size_t size){
+    const SnapshotHeader* header = block;
+    SnapshotHeader expected;
+    if (size < sizeof(*header)){
+        return -1;
+    }
+    // the layout is fully determined by the numbers in the header
+    snapshot_layout(&expected, header->node_count, header->id_count, header->label_bytes);
+    if (memcmp(header->magic, expected.magic, sizeof(expected.magic)) != 0 ||
+        header->version != expected.version ||
+        header->byte_order != expected.byte_order ||
+        header->alphabet_size != expected.alphabet_size ||
+        header->nodes_offset != expected.nodes_offset ||
+        header->ids_offset != expected.ids_offset ||
+        header->labels_offset != expected.labels_offset ||
+        header->size != expected.size || header->size > size){
+        return -1;
+    }
+
+    snapshot->header = header;
+    snapshot->nodes = (const SnapshotNode*)((const char*)block + header->nodes_offset);
+    snapshot->ids = (const uint32_t*)((const char*)block + header->ids_offset);
+    snapshot->labels = (const char*)block + header->labels_offset;
+    snapshot->mapped_size = 0;
+    if (snapshot->nodes[header->node_count].label != header->label_bytes){
+        return -1;
+    }
+    return 1;
+}
+
+
+int snapshot_map(Snapshot* snapshot, const char* path){
+    int fd = open(path, O_RDONLY);
+    if (fd < 0){
+        return -1;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < sizeof(SnapshotHeader)){
+        close(fd);
+        return -1;
+    }
+    void* block = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (block == MAP_FAILED){
+        return -1;
+    }
+    if (snapshot_attach(snapshot, block, info.st_size) == -1){
+        munmap(block, info.st_size);
+        return -1;
+    }
+    snapshot->mapped_size = info.st_size;
+    return 1;
+}
+
+
+int snapshot_write(const Snapshot* snapshot, const char* path){
+    // write to a temporary file first, so a failed save doesn't destroy an older snapshot
+    size_t path_length = strlen(path);
+    char* temporary = malloc(path_length + 5);
+    memcpy(temporary, path, path_length);
+    memcpy(temporary + path_length, ".tmp", 5);
+
+    int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0){
+        free(temporary);
+        return -1;
+    }
+    const char* data = (const char*)snapshot->header;
+    uint64_t done = 0;
+    while (done < snapshot->header->size){
+        ssize_t count = write(fd, data + done, snapshot->header->size - done);
+        if (count < 0 && errno == EINTR){
+            continue;
+        }
+        if (count <= 0){
+            break;
+        }
+        done += count;
+    }
+    int result = -1;
+    if (done == snapshot->header->size && fsync(fd) == 0 && close(fd) == 0){
+        fd = -1;
+        if (rename(temporary, path) == 0){
+            result = 1;
+        }
+    }
+    if (fd >= 0){
+        close(fd);
+    }
+    if (result == -1){
+        unlink(temporary);
+    }
+    free(temporary);
+    return result;
+}
+
+
+void snapshot_release(Snapshot* snapshot){
+    if (snapshot->header != NULL){
+        if (snapshot->mapped_size != 0){
+            munmap((void*)snapshot->header, snapshot->mapped_size);
+        }
+        else{
+            free((void*)snapshot->header);
+        }
+    }
+    snapshot->header = NULL;
+    snapshot->nodes = NULL;
+    snapshot->ids = NULL;
+    snapshot->labels = NULL;
+    snapshot->mapped_size = 0;
+}
+
+
+// check that a node index and its label come from a valid snapshot
+static int node_valid(const Snapshot* snapshot, uint32_t node){
+    const SnapshotNode* nodes = snapshot->nodes;
+    // indices and offsets come from a file, don't trust them
+    return node < snapshot->header->node_count && nodes[node].label < nodes[node + 1].label &&
+           nodes[node + 1].label <= snapshot->header->label_bytes;
+}
+
+
+// get the highest node whose word begins with a pattern, -1 if no word does;
+//  depth is set to the length of its parent's word
+static int64_t locate(const Snapshot* snapshot, const char* pattern, int length, int* depth){
+    const SnapshotNode* nodes = snapshot->nodes;
+    uint32_t node = 0;
+    int index = 0;
+    *depth = 0;
+    if (snapshot->header->node_count == 0){
+        return -1;
+    }
+    while (index < length){
+        int letter_number = letter_number_of(pattern[index]);
+        const LetterSet* bitmap = &nodes[node].bitmap;
+        if (letters_has(bitmap, letter_number) == 0){
+            return -1;
+        }
+        uint32_t child = nodes[node].first_child + letters_rank(bitmap, letter_number);
+        if (node_valid(snapshot, child) == 0){
+            return -1;
+        }
+
+        int label_length = nodes[child + 1].label - nodes[child].label;
+        int compared = length - index < label_length ? length - index : label_length;
+        if (mismatch(pattern + index, snapshot->labels + nodes[child].label, compared) < compared){
+            return -1;
+        }
+        *depth = index;
+        index += compared;
+        node = child;
+    }
+    return node;
+}
+
+
+int snapshot_find(const Snapshot* snapshot, const char* pattern, int length){
+    int depth;
+    return locate(snapshot, pattern, length, &depth) == -1 ? -1 : 1;
+}
+
+
+int snapshot_lookup(const Snapshot* snapshot, const char* word, int length){
+    int depth;
+    int64_t node = locate(snapshot, word, length, &depth);
+    if (node <= 0){
+        return -1;
+    }
+    // the word must end where the node's label does
+    const SnapshotNode* nodes = snapshot->nodes;
+    if (depth + nodes[node + 1].label - nodes[node].label != (uint32_t)length ||
+        nodes[node].id == SNAPSHOT_NO_ID){
+        return -1;
+    }
+    return nodes[node].id;
+}
+
+
+int snapshot_count(const Snapshot* snapshot, const char* prefix, int length){
+    int depth;
+    int64_t node = locate(snapshot, prefix, length, &depth);
+    return node == -1 ? 0 : snapshot->nodes[node].words;
+}
+
+
+int snapshot_fuzzy_find(const Snapshot* snapshot, const char* pattern, int length, int k){
+    const SnapshotNode* nodes = snapshot->nodes;
+    if (snapshot->header->node_count == 0 || letters_empty(&nodes[0].bitmap)){
+        return -1;
+    }
+    FuzzyRows rows;
+    if (length <= k || fuzzy_init(&rows, pattern, length, k) == -1){
+        return length <= k ? 1 : -1;
+    }
+
+    // depth-first; the stack holds nodes still to visit and the length of
+    //  their parents' words
+    int stack_capacity = 64;
+    uint32_t* stack_node = malloc(stack_capacity * sizeof(uint32_t));
+    int* stack_depth = malloc(stack_capacity * sizeof(int));
+    stack_node[0] = 0;
+    stack_depth[0] = 0;
+    int stack_size = 1;
+    int state = FUZZY_ALIVE;
+    uint32_t visited = 0;
+    while (stack_size > 0 && state != FUZZY_FOUND && visited < snapshot->header->node_count){
+        --stack_size;
+        ++visited;
+        uint32_t node = stack_node[stack_size];
+        int depth = stack_depth[stack_size];
+        state = FUZZY_ALIVE;
+        if (node != 0){
+            if (node_valid(snapshot, node) == 0){
+                break;
+            }
+            int label_length = nodes[node + 1].label - nodes[node].label;
+            state = fuzzy_label(&rows, depth, snapshot->labels + nodes[node].label, label_length);
+            depth += label_length;
+        }
+        if (state != FUZZY_ALIVE){
+            continue;
+        }
+        int children = letters_count(&nodes[node].bitmap);
+        while (stack_size + children > stack_capacity){
+            stack_capacity *= 2;
+            stack_node = realloc(stack_node, stack_capacity * sizeof(uint32_t));
+            stack_depth = realloc(stack_depth, stack_capacity * sizeof(int));
+        }
+        for (int i = 0; i < children; ++i){
+            stack_node[stack_size] = nodes[node].first_child + i;
+            stack_depth[stack_size] = depth;
+            ++stack_size;
+        }
+        // the child that continues the pattern is visited first
+        int next = fuzzy_next_letter(&rows, depth);
+        if (next != -1 && letters_has(&nodes[node].bitmap, next)){
+            int rank = letters_rank(&nodes[node].bitmap, next);
+            stack_node[stack_size - children + rank] = stack_node[stack_size - 1];
+            stack_node[stack_size - 1] = nodes[node].first_child + rank;
+        }
+    }
+    free(stack_node);
+    free(stack_depth);
+    fuzzy_release(&rows);
+    return state == FUZZY_FOUND ? 1 : -1;
+}
+
+
+int snapshot_list(const Snapshot* snapshot, const char* prefix, int length, int limit,
+                  void (*emit)(const char* word, int length, void* context), void* context){
+    const SnapshotNode* nodes = snapshot->nodes;
+    int depth;
+    int64_t top = locate(snapshot, prefix, length, &depth);
+    if (top == -1 || limit <= 0){
+        return 0;
+    }
+
+    // words are rebuilt in path from the labels on the way down; the stack
+    //  holds nodes still to visit and the length of their parents' words
+    int path_capacity = depth + 64;
+    char* path = malloc(path_capacity);
+    int stack_capacity = 64;
+    uint32_t* stack_node = malloc(stack_capacity * sizeof(uint32_t));
+    int* stack_depth = malloc(stack_capacity * sizeof(int));
+    memcpy(path, prefix, depth);
+    stack_node[0] = top;
+    stack_depth[0] = depth;
+    int stack_size = 1;
+    int listed = 0;
+    uint32_t visited = 0;
+
+    while (stack_size > 0 && listed < limit && visited < snapshot->header->node_count){
+        --stack_size;
+        ++visited;
+        uint32_t node = stack_node[stack_size];
+        int node_depth = stack_depth[stack_size];
+        if (node != 0){
+            if (node_valid(snapshot, node) == 0){
+                break;
+            }
+            int label_length = nodes[node + 1].label - nodes[node].label;
+            while (node_depth + label_length > path_capacity){
+                path_capacity *= 2;
+                path = realloc(path, path_capacity);
+            }
+            memcpy(path + node_depth, snapshot->labels + nodes[node].label, label_length);
+            node_depth += label_length;
+            if (nodes[node].id != SNAPSHOT_NO_ID){
+                emit(path, node_depth, context);
+                ++listed;
+            }
+        }
+
+        // the children are pushed backwards, so the first one is on top
+        int children = letters_count(&nodes[node].bitmap);
+        while (stack_size + children > stack_capacity){
+            stack_capacity *= 2;
+            stack_node = realloc(stack_node, stack_capacity * sizeof(uint32_t));
+            stack_depth = realloc(stack_depth, stack_capacity * sizeof(int));
+        }
+        for (int i = children - 1; i >= 0; --i){
+            stack_node[stack_size] = nodes[node].first_child + i;
+            stack_depth[stack_size] = node_depth;
+            ++stack_size;
+        }
+    }
+    free(path);
+    free(stack_node);
+    free(stack_depth);
+    return listed;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "alphabet.h"
+
+#define SNAPSHOT_MAGIC "IPPTRIE"  // with the terminating null, fills SnapshotHeader.magic
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_BYTE_ORDER 0x01020304u
+#define SNAPSHOT_NO_ID 0xFFFFFFFFu
+
+/* SNAPSHOT - a tree stored in one position-independent block of memory, as
+   written to a file by save and mapped back by load. Every reference is an
+   index or an offset, so the block can be used wherever it's mapped.
+
+   The block holds, in this order, each part starting at an 8-byte boundary:
+     SnapshotHeader
+     SnapshotNode nodes[node_count + 1] - the last one only marks where the
+         labels end.
+     uint32_t ids[id_count] - ids[x] is the index of the node representing
+         the word with id = x, SNAPSHOT_NO_ID if there is none.
+     char labels[label_bytes] - labels of all nodes, in the order of nodes.
+
+   Node 0 is the root. Children of a node occupy consecutive indices, sorted
+   by first letter, and each subtree is laid out right after the children of
+   its root's parent, so subtrees stay close together in memory.
+*/
+typedef struct{
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;     // SNAPSHOT_BYTE_ORDER as written by the saving machine
+    uint32_t alphabet_size;
+    uint32_t node_count;     // root included; 0 if the tree is empty
+    uint32_t id_count;       // id to be given to the next inserted word
+    uint32_t label_bytes;
+    uint64_t nodes_offset;   // offsets of the parts from the start of the block
+    uint64_t ids_offset;
+    uint64_t labels_offset;
+    uint64_t size;           // size of the whole block
+} SnapshotHeader;
+
+/* SNAPSHOTNODE - a node of the stored tree.
+     bitmap - letter x is in it if there is an edge with label that begins
+              on letter x.
+     first_child - index of the target of the alphabetically first edge; the
+                   target of the edge for letter x is first_child + (letters
+                   below x).
+     label - offset of the node's label in labels; it ends where the label of
+             the next node begins.
+     id - id of the word represented by the node, SNAPSHOT_NO_ID if none.
+     words - number of words in the node's subtree, its own word included.
+*/
+typedef struct{
+    LetterSet bitmap;
+    uint32_t first_child;
+    uint32_t label;
+    uint32_t id;
+    uint32_t words;
+} SnapshotNode;
+
+// a snapshot in memory, either mapped from a file or built by the tree
+typedef struct{
+    const SnapshotHeader* header;
+    const SnapshotNode* nodes;
+    const uint32_t* ids;
+    const char* labels;
+    size_t mapped_size;      // size of the mapping if the block was mapped, 0 otherwise
+} Snapshot;
+
+// compute the layout of a snapshot of a given size; fills all fields of the header
+//  except the tree's own numbers and magic, and returns the size of the block
+uint64_t snapshot_layout(SnapshotHeader* header, uint32_t node_count, uint32_t id_count,
+                         uint32_t label_bytes);
+
+// attach to a block laid out by snapshot_layout. Returns -1 if the header is
+//  invalid or doesn't fit in size bytes, 1 otherwise
+int snapshot_attach(Snapshot* snapshot, const void* block, size_t size);
+
+// map a snapshot file. Returns -1 if it can't be read or isn't a valid snapshot
+int snapshot_map(Snapshot* snapshot, const char* path);
+
+// write a snapshot to a file, replacing it only once it's complete. Returns -1 on fail
+int snapshot_write(const Snapshot* snapshot, const char* path);
+
+// unmap or free the block of a snapshot
+void snapshot_release(Snapshot* snapshot);
+
+// check if a stored word has a given prefix. Returns 1 if it does, -1 otherwise
+int snapshot_find(const Snapshot* snapshot, const char* pattern, int length);
+
+// check if a stored word has a prefix within edit distance k of a pattern.
+//  Returns 1 if one has, -1 otherwise
+int snapshot_fuzzy_find(const Snapshot* snapshot, const char* pattern, int length, int k);
+
+// id of a stored word, -1 if it isn't stored
+int snapshot_lookup(const Snapshot* snapshot, const char* word, int length);
+
+// count the stored words that begin with a prefix
+int snapshot_count(const Snapshot* snapshot, const char* prefix, int length);
+
+// pass at most limit stored words that begin with a prefix to emit, in
+//  lexicographic order. Returns the number of words passed
+int snapshot_list(const Snapshot* snapshot, const char* prefix, int length, int limit,
+                  void (*emit)(const char* word, int length, void* context), void* context);
@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include "stats.h"
+
+Statistics statistics;
+
+
+void stats_printf(StatsText* report, const char* format, ...){
+    va_list arguments;
+    while (1){
+        int room = report->capacity - report->length;
+        va_start(arguments, format);
+        int length = vsnprintf(report->text + report->length, room, format, arguments);
+        va_end(arguments);
+        if (length < 0){
+            return;
+        }
+        if (length < room){
+            report->length += length;
+            return;
+        }
+        int capacity = report->capacity == 0 ? 1024 : report->capacity;
+        while (capacity - report->length <= length){
+            capacity *= 2;
+        }
+        char* text = realloc(report->text, capacity);
+        if (text == NULL){
+            return;
+        }
+        report->text = text;
+        report->capacity = capacity;
+    }
+}
+
+
+void stats_command(int type, uint64_t nanoseconds){
+    int bucket = nanoseconds == 0 ? 0 : 63 - __builtin_clzll(nanoseconds);
+    if (bucket >= STATS_BUCKETS){
+        bucket = STATS_BUCKETS - 1;
+    }
+    STAT_ADD(commands[type], 1);
+    STAT_ADD(command_ns[type], nanoseconds);
+    STAT_ADD(latency[type][bucket], 1);
+}
+
+
+void stats_write(StatsText* report, const char* const* names, int name_count){
+    if (STATS_ENABLED == 0){
+        stats_printf(report, "counters disabled\n");
+        return;
+    }
+    const Statistics* s = &statistics;
+    for (int type = 0; type < name_count && type < STATS_COMMAND_TYPES; ++type){
+        if (names[type] == NULL || s->commands[type] == 0){
+            continue;
+        }
+        stats_printf(report, "command name=%s count=%llu mean_ns=%llu histogram=", names[type],
+                     (unsigned long long)s->commands[type],
+                     (unsigned long long)(s->command_ns[type] / s->commands[type]));
+        // lower bound of every non-empty bucket and its count
+        const char* separator = "";
+        for (int bucket = 0; bucket < STATS_BUCKETS; ++bucket){
+            if (s->latency[type][bucket] != 0){
+                stats_printf(report, "%s%llu:%llu", separator, 1ull << bucket,
+                             (unsigned long long)s->latency[type][bucket]);
+                separator = ",";
+            }
+        }
+        stats_printf(report, "\n");
+    }
+    stats_printf(report, "find calls=%llu edges=%llu compared=%llu\n",
+                 (unsigned long long)s->find_calls, (unsigned long long)s->find_edges,
+                 (unsigned long long)s->find_compared);
+    stats_printf(report, "insert_word calls=%llu edges=%llu compared=%llu\n",
+                 (unsigned long long)s->insert_calls, (unsigned long long)s->insert_edges,
+                 (unsigned long long)s->insert_compared);
+    stats_printf(report, "allocations nodes=%llu nodes_freed=%llu children=%llu children_freed=%llu layout_changes=%llu\n",
+                 (unsigned long long)s->nodes_allocated, (unsigned long long)s->nodes_freed,
+                 (unsigned long long)s->children_allocated, (unsigned long long)s->children_freed,
+                 (unsigned long long)s->layout_changes);
+    stats_printf(report, "unions count=%llu\n", (unsigned long long)s->unions);
+    stats_printf(report, "compactions count=%llu slices=%llu copied=%llu\n",
+                 (unsigned long long)s->compactions, (unsigned long long)s->compaction_slices,
+                 (unsigned long long)s->compaction_copied);
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+
+#define STATS_COMMAND_TYPES 24
+#define STATS_BUCKETS 40  // bucket x holds latencies in [2^x, 2^(x + 1)) ns
+
+/* STATISTICS - counters of what the program does, for the stats command.
+   They are only kept if the program is built with TRIE_STATS defined
+   (make STATS=1); otherwise STAT_ADD compiles to nothing and the counters
+   stay at zero. Counters bumped by concurrent readers may lose updates,
+   but they never tear and never slow the readers down with locked
+   instructions.
+*/
+#ifdef TRIE_STATS
+#define STATS_ENABLED 1
+#define STAT_ADD(counter, amount) \
+    __atomic_store_n(&statistics.counter, \
+                     __atomic_load_n(&statistics.counter, __ATOMIC_RELAXED) + (amount), \
+                     __ATOMIC_RELAXED)
+#else
+#define STATS_ENABLED 0
+#define STAT_ADD(counter, amount) ((void)0)
+#endif
+
+typedef struct{
+    uint64_t commands[STATS_COMMAND_TYPES];
+    uint64_t command_ns[STATS_COMMAND_TYPES];
+    uint64_t latency[STATS_COMMAND_TYPES][STATS_BUCKETS];
+    uint64_t find_calls;
+    uint64_t find_edges;        // edges followed by find
+    uint64_t find_compared;     // label characters compared by find
+    uint64_t insert_calls;      // calls of insert_word, by insert and prev
+    uint64_t insert_edges;
+    uint64_t insert_compared;
+    uint64_t nodes_allocated;
+    uint64_t nodes_freed;
+    uint64_t children_allocated;
+    uint64_t children_freed;
+    uint64_t layout_changes;    // children moved to a bigger or smaller layout
+    uint64_t unions;            // calls of union_with_parent
+    uint64_t compactions;       // compactions of the text that were finished
+    uint64_t compaction_slices;
+    uint64_t compaction_copied; // characters copied by compactions
+} Statistics;
+
+extern Statistics statistics;
+
+/* STATS TEXT - a growing buffer that reports are written to, one line
+   per "\n"-terminated record. */
+typedef struct{
+    char* text;
+    int length;
+    int capacity;
+} StatsText;
+
+// append printf-formatted text to a report
+void stats_printf(StatsText* report, const char* format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+// count a command of a given type that took a given time
+void stats_command(int type, uint64_t nanoseconds);
+
+// write the counters; names[x] is the name of command type x, NULL for
+//  types that aren't reported
+void stats_write(StatsText* report, const char* const* names, int name_count);
@@ -0,0 +1,166 @@
+#include <stdlib.h>
+#include <string.h>
+#include "text.h"
+
+
+// the page of the chunk table for a chunk number
+static TextPage* page_of(const Text* text, int chunk){
+    return text->pages[chunk >> TEXT_PAGE_BITS];
+}
+
+
+// take a chunk number given back by text_free, -1 if there's none
+static int reuse_number(Text* text){
+    int count = atomic_load(&text->chunk_count);
+    for (int x = 0; x < count && atomic_load(&text->freed_count) > 0; ++x){
+        TextPage* page = __atomic_load_n(&text->pages[x >> TEXT_PAGE_BITS], __ATOMIC_ACQUIRE);
+        if (page == NULL){
+            // handed out right now, it can't have been freed
+            continue;
+        }
+        char expected = 1;
+        if (__atomic_compare_exchange_n(&page->freed[x & (TEXT_PAGE_SIZE - 1)], &expected, 0, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)){
+            atomic_fetch_sub(&text->freed_count, 1);
+            return x;
+        }
+    }
+    return -1;
+}
+
+
+// make sure the chunk table has the pages for a number of chunk numbers
+//  from first on. Returns -1 if there's no memory for them
+static int add_pages(Text* text, int first, int span){
+    for (int x = first >> TEXT_PAGE_BITS; x <= (first + span - 1) >> TEXT_PAGE_BITS; ++x){
+        if (__atomic_load_n(&text->pages[x], __ATOMIC_ACQUIRE) != NULL){
+            continue;
+        }
+        TextPage* page = calloc(1, sizeof(TextPage));
+        if (page == NULL){
+            return -1;
+        }
+        TextPage* expected = NULL;
+        // other cursors may be adding the same page
+        if (__atomic_compare_exchange_n(&text->pages[x], &expected, page, 0, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE) == 0){
+            free(page);
+        }
+    }
+    return 1;
+}
+
+
+// bytes of a new block for a word of a given length: a block spanning
+//  several chunk numbers for a word longer than a chunk, otherwise at least
+//  as many as the text has allocated so far, rounded up to a power of two,
+//  and at most a chunk
+static long block_size(Text* text, int length, int span){
+    if (span > 1){
+        return (long)span * TEXT_CHUNK_SIZE;
+    }
+    long size = TEXT_FIRST_BLOCK;
+    long allocated = atomic_load(&text->allocated);
+    while (size < TEXT_CHUNK_SIZE && (size < allocated || size < length)){
+        size *= 2;
+    }
+    return size;
+}
+
+
+// allocate a block for a word of a given length, spanning a given number of
+//  chunk numbers, and continue appending at its start. A single chunk reuses
+//  a freed number if there is one, longer blocks go after the last one.
+//  Returns -1 if there's no room for it
+static int text_grow(Text* text, TextCursor* cursor, int length, int span){
+    long size = block_size(text, length, span);
+    char* block = malloc(size);
+    if (block == NULL){
+        return -1;
+    }
+    int first = span == 1 ? reuse_number(text) : -1;
+    if (first == -1){
+        first = atomic_load(&text->chunk_count);
+        do{
+            if (span > TEXT_MAX_CHUNKS - first){
+                free(block);
+                return -1;
+            }
+        } while (atomic_compare_exchange_weak(&text->chunk_count, &first, first + span) == 0);
+        if (add_pages(text, first, span) == -1){
+            // the numbers stay without memory
+            free(block);
+            return -1;
+        }
+    }
+    atomic_fetch_add(&text->allocated, size);
+    for (int i = 0; i < span; ++i){
+        TextPage* page = page_of(text, first + i);
+        page->chunks[(first + i) & (TEXT_PAGE_SIZE - 1)] = block + (size_t)i * TEXT_CHUNK_SIZE;
+        page->spans[(first + i) & (TEXT_PAGE_SIZE - 1)] = 0;
+    }
+    page_of(text, first)->spans[first & (TEXT_PAGE_SIZE - 1)] = span;
+    page_of(text, first)->sizes[first & (TEXT_PAGE_SIZE - 1)] = size;
+    cursor->next = first * TEXT_CHUNK_SIZE;
+    cursor->end = first * TEXT_CHUNK_SIZE + size;
+    return 1;
+}
+
+
+int text_append(Text* text, TextCursor* cursor, const char* word, int length){
+    if (length > cursor->end - cursor->next){
+        int span = length <= TEXT_CHUNK_SIZE ? 1 : (length + TEXT_CHUNK_SIZE - 1) / TEXT_CHUNK_SIZE;
+        if (text_grow(text, cursor, length, span) == -1){
+            return -1;
+        }
+    }
+    int offset = cursor->next;
+    memcpy(text_at(text, offset), word, length);
+    cursor->next += length;
+    cursor->used += length;
+    return offset;
+}
+
+
+void text_free(Text* text, int chunk){
+    TextPage* first = page_of(text, chunk);
+    int span = first->spans[chunk & (TEXT_PAGE_SIZE - 1)];
+    long size = first->sizes[chunk & (TEXT_PAGE_SIZE - 1)];
+    free(first->chunks[chunk & (TEXT_PAGE_SIZE - 1)]);
+    for (int i = 0; i < span; ++i){
+        TextPage* page = page_of(text, chunk + i);
+        page->chunks[(chunk + i) & (TEXT_PAGE_SIZE - 1)] = NULL;
+        page->spans[(chunk + i) & (TEXT_PAGE_SIZE - 1)] = 0;
+        page->sizes[(chunk + i) & (TEXT_PAGE_SIZE - 1)] = 0;
+        page->freed[(chunk + i) & (TEXT_PAGE_SIZE - 1)] = 1;
+    }
+    atomic_fetch_add(&text->freed_count, span);
+    atomic_fetch_sub(&text->allocated, size);
+}
+
+
+void text_cursor_reset(TextCursor* cursor){
+    cursor->next = 0;
+    cursor->end = 0;
+    cursor->used = 0;
+}
+
+
+void text_release(Text* text){
+    for (int x = 0; x < TEXT_PAGES; ++x){
+        TextPage* page = text->pages[x];
+        if (page == NULL){
+            continue;
+        }
+        for (int i = 0; i < TEXT_PAGE_SIZE; ++i){
+            if (page->spans[i] != 0){
+                free(page->chunks[i]);
+            }
+        }
+        free(page);
+        text->pages[x] = NULL;
+    }
+    atomic_store(&text->chunk_count, 0);
+    atomic_store(&text->freed_count, 0);
+    atomic_store(&text->allocated, 0);
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <stdatomic.h>
+
+#define TEXT_CHUNK_BITS 20
+#define TEXT_CHUNK_SIZE (1 << TEXT_CHUNK_BITS)
+#define TEXT_MAX_CHUNKS ((1 << (31 - TEXT_CHUNK_BITS)) - 1)  // every offset fits in an int
+#define TEXT_PAGE_BITS 6
+#define TEXT_PAGE_SIZE (1 << TEXT_PAGE_BITS)  // chunk numbers per page of the chunk table
+#define TEXT_PAGES ((TEXT_MAX_CHUNKS + TEXT_PAGE_SIZE - 1) / TEXT_PAGE_SIZE)
+#define TEXT_FIRST_BLOCK (1 << 12)  // bytes of the smallest block
+
+/* TEXT PAGE - the part of a text's chunk table for TEXT_PAGE_SIZE
+   consecutive chunk numbers, see Text.
+*/
+typedef struct{
+    char* chunks[TEXT_PAGE_SIZE];
+    int spans[TEXT_PAGE_SIZE];
+    int sizes[TEXT_PAGE_SIZE];
+    char freed[TEXT_PAGE_SIZE];
+} TextPage;
+
+/* TEXT - append-only store for the characters of inserted words.
+     Characters live in blocks that are never moved, so an offset returned
+     by text_append stays valid until its block is given back by text_free
+     or everything by text_release. A block takes one chunk number and at
+     most TEXT_CHUNK_SIZE bytes; the first ones are small, and each new one
+     is about as big as all the text's blocks before it, so a text with few
+     words takes little memory.
+     A word never crosses a block boundary: all of its characters can be
+     read through a single pointer. Words longer than a chunk get a block
+     spanning several consecutive chunk numbers.
+     The chunk table is made of pages that are allocated as chunk numbers
+     are handed out and never move, so other threads may read through it
+     while words are appended.
+     Words are appended through cursors, each filling blocks of its own, so
+     threads with different cursors may append to one text at the same time.
+     pages[x] - the table for chunk numbers [x * TEXT_PAGE_SIZE, (x + 1) * TEXT_PAGE_SIZE),
+                NULL until one of them is handed out. For chunk number y
+                in it:
+       chunks[y] - characters at offsets [y * TEXT_CHUNK_SIZE, (y + 1) * TEXT_CHUNK_SIZE).
+       spans[y] - number of chunk numbers of the block allocated at
+                  chunks[y], 0 if chunks[y] is a later part of a longer block.
+       sizes[y] - bytes of the block allocated at chunks[y].
+       freed[y] - 1 if chunk number y was freed by text_free and may be
+                  handed out again to a single-chunk block.
+     chunk_count - chunk numbers handed out so far; chunks[y] is NULL for
+                   the ones below it that have been freed.
+     freed_count - number of chunk numbers with freed[y] = 1.
+     allocated - bytes of the blocks with memory.
+*/
+typedef struct{
+    TextPage* pages[TEXT_PAGES];
+    _Atomic int chunk_count;
+    _Atomic int freed_count;
+    _Atomic long allocated;
+} Text;
+
+/* TEXT CURSOR - the place where one writer appends words to a text.
+     next - offset where the next word will be stored.
+     end - end of the block next points into.
+     used - number of characters appended through the cursor.
+*/
+typedef struct{
+    int next;
+    int end;
+    long used;
+} TextCursor;
+
+// store a word and return the offset of its first character, -1 if the
+//  store is full
+int text_append(Text* text, TextCursor* cursor, const char* word, int length);
+
+// pointer to the character at a given offset
+static inline char* text_at(const Text* text, int offset){
+    int chunk = offset >> TEXT_CHUNK_BITS;
+    return text->pages[chunk >> TEXT_PAGE_BITS]->chunks[chunk & (TEXT_PAGE_SIZE - 1)]
+           + (offset & (TEXT_CHUNK_SIZE - 1));
+}
+
+// memory of a chunk number, NULL if it has none
+static inline char* text_chunk(const Text* text, int chunk){
+    const TextPage* page = text->pages[chunk >> TEXT_PAGE_BITS];
+    return page == NULL ? NULL : page->chunks[chunk & (TEXT_PAGE_SIZE - 1)];
+}
+
+// 1 if a block begins at a chunk number, 0 otherwise
+static inline int text_block_at(const Text* text, int chunk){
+    const TextPage* page = text->pages[chunk >> TEXT_PAGE_BITS];
+    return page != NULL && page->spans[chunk & (TEXT_PAGE_SIZE - 1)] != 0;
+}
+
+// free the block that begins at a given chunk number; nothing may read the
+//  characters at its offsets anymore, and no cursor may append to it
+void text_free(Text* text, int chunk);
+
+// forget where a cursor was; it's used again with an empty or released text
+void text_cursor_reset(TextCursor* cursor);
+
+// free all blocks and pages; every offset becomes invalid and every cursor
+//  has to be reset
+void text_release(Text* text);
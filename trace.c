@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include "trace.h"
+
+#define TRACE_BUFFER_SIZE (1 << 18)  // stdio buffer of the trace file
+
+/* The trace.
+     file - the open trace, NULL if there is none.
+     start - time it was opened.
+     pending - "T" lines of the commands recorded but not written out yet,
+               pending[written .. used - 1].
+*/
+static FILE* file = NULL;
+static uint64_t start = 0;
+static char* pending = NULL;
+static size_t written = 0;
+static size_t used = 0;
+static size_t capacity = 0;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static uint64_t now_ns(){
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1000000000ull + time.tv_nsec;
+}
+
+
+int trace_open(const char* path){
+    file = fopen(path, "w");
+    if (file == NULL){
+        return -1;
+    }
+    setvbuf(file, NULL, _IOFBF, TRACE_BUFFER_SIZE);
+    start = now_ns();
+    return 1;
+}
+
+
+void trace_command(const char* line, int length){
+    if (file == NULL){
+        return;
+    }
+    char stamp[32];
+    int stamp_length = snprintf(stamp, sizeof(stamp), "T %llu ",
+                                (unsigned long long)(now_ns() - start));
+    pthread_mutex_lock(&lock);
+    if (written == used){
+        written = used = 0;
+    }
+    size_t size = stamp_length + length + 1;
+    if (used + size > capacity){
+        size_t grown = capacity == 0 ? 4096 : capacity;
+        while (used + size > grown){
+            grown *= 2;
+        }
+        char* data = realloc(pending, grown);
+        if (data == NULL){
+            pthread_mutex_unlock(&lock);
+            return;
+        }
+        pending = data;
+        capacity = grown;
+    }
+    memcpy(pending + used, stamp, stamp_length);
+    memcpy(pending + used + stamp_length, line, length);
+    pending[used + size - 1] = '\n';
+    used += size;
+    pthread_mutex_unlock(&lock);
+}
+
+
+void trace_replies(const char* text, int length){
+    if (file == NULL){
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    char* endline = written < used ? memchr(pending + written, '\n', used - written) : NULL;
+    if (endline != NULL){
+        fwrite(pending + written, 1, endline + 1 - (pending + written), file);
+        written = endline + 1 - pending;
+    }
+    pthread_mutex_unlock(&lock);
+    for (const char* line = text; line < text + length; ){
+        const char* end = memchr(line, '\n', text + length - line);
+        end = end == NULL ? text + length : end;
+        fputs("R ", file);
+        fwrite(line, 1, end - line, file);
+        fputc('\n', file);
+        line = end + 1;
+    }
+}
+
+
+void trace_close(){
+    if (file != NULL){
+        fwrite(pending + written, 1, used - written, file);
+        fclose(file);
+    }
+    free(pending);
+    file = NULL;
+    pending = NULL;
+    written = used = capacity = 0;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+/* TRACE - a text file of the commands the program has read, when it read
+   them, and the lines each of them printed to stdout, for replaying them
+   later with replay_trace. Every command is a line
+     T <nanoseconds since the trace was opened> <the input line>
+   followed by a line
+     R <line>
+   for each of the lines it printed, in order. The commands are recorded as
+   they're read and written out with their replies, so a command read
+   ahead, in a batch or by another thread, still comes right before its
+   replies. The end of the input isn't recorded.
+*/
+
+// start a trace in a new file at path. Returns -1 on fail, 1 otherwise
+int trace_open(const char* path);
+
+// record an input line, of a given length without its endline, as read now;
+//  a no-op while no trace is open
+void trace_command(const char* line, int length);
+
+// write out the oldest recorded command that isn't written yet, with the
+//  lines it printed, text[0 .. length - 1]. May be called from another
+//  thread than trace_command
+void trace_replies(const char* text, int length);
+
+// write out what's left and close the trace
+void trace_close();
@@ -1,463 +1,2901 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <pthread.h>
 #include "trie.h"
-
-#define ALPHABET_SIZE 26  // all small english letters
-#define MAX_WORDS 220000  // based on maximum test file size
-#define STARTING_WORDS_CAPACITY 8
+#include "pool.h"
+#include "text.h"
+#include "mismatch.h"
+#include "snapshot.h"
+#include "epoch.h"
+#include "stats.h"
+#include "wordlist.h"
+#include "frozen.h"
+#include "alphabet.h"
+#include "fuzzy.h"
+
+#define STARTING_IDS_CAPACITY 1024
+
+// capacities of the children layouts, see Children below
+#define NODE4 4
+#define NODE16 16
+#define NODE64 64
+#define NODE_DIRECT ALPHABET_SIZE
+#if ALPHABET_SIZE > NODE64
+// 256 direct pointers take 2KB, nodes keep up to NODE64 edges sorted first
+#define LAYOUT_COUNT 4
+const int layout_capacity[LAYOUT_COUNT] = {NODE4, NODE16, NODE64, NODE_DIRECT};
+#else
+#define LAYOUT_COUNT 3
+const int layout_capacity[LAYOUT_COUNT] = {NODE4, NODE16, NODE_DIRECT};
+#endif
+
+#define SHARD_COUNT ALPHABET_SIZE  // one shard per first letter
+#define ID_PENDING -2              // id of a word whose id is given out later
+#define PARALLEL_MINIMUM 64        // fewer operations in a row are run one by one
+#define COMPACT_SLICE (1 << 15)    // work of a compaction slice, in characters of words gone through
+#define COMPACT_LEAF 64            // work of reaching a leaf, counted as this many characters
+
+// fields find reads while a concurrent writer may be changing them: a load
+//  acquires everything written before the store of the value it sees
+#define SHARED_LOAD(field) __atomic_load_n(&(field), __ATOMIC_ACQUIRE)
+#define SHARED_STORE(field, value) __atomic_store_n(&(field), (value), __ATOMIC_RELEASE)
 
 typedef struct Node Node;
 
 
+/* CHILDREN - edges leaving a node. Most nodes have very few children, so
+   the edges are kept in the smallest of the layouts that fits them.
+     bitmap - letter x is in it if there is an edge with label that begins
+              on letter x.
+     capacity - NODE_DIRECT: path[x] is the target of the edge for letter x.
+                Any other: path[] holds the targets sorted by first letter,
+                the edge for letter x is path[letters below x].
+*/
+typedef struct{
+    LetterSet bitmap;
+    int capacity;
+    Node* path[];
+} Children;
+
+
 /* NODE - represents a node in the tree.
      label_start - index in the words array where this node's label starts.
      label_end - index in the words array where this node's label ends.
      word_start - index in the words array where this node's whole word starts.
-     parent - target of an edge leading upwards, to reconstruct a word based on its ID.
      id - id given to the full word represented by this node.
           -1 if it does not represent a full word.
-     path[x] - target of an edge with label that begins on ('a' + x).
+     words - number of words in the node's subtree, its own word included;
+             not kept for the root.
+     shard - number of the shard the node's memory belongs to.
+     marked - while insert_suffixes runs, 1 + the node's place in the list
+              of marked nodes if it's on the path of the word or of a
+              suffix it has inserted, 0 otherwise. It fills the padding
+              after shard.
+     parent - target of an edge leading upwards, to reconstruct a word based on its ID.
+     children - edges leading downwards, NULL if there are none.
 */
 struct Node{
     int label_start;
     int label_end;
     int word_start;
-    Node* parent;
     int id;
-    Node* path[ALPHABET_SIZE];
+    int words;
+    uint8_t shard;
+    unsigned int marked : 24;
+    Node* parent;
+    Children* children;
 };
 
 
 
-/* ******************
- * GLOBAL VARIABLES *
- * ******************/
+/* ************
+ * DICTIONARY *
+ * ************/
 
 
- 
-// Global trie to use in this task
-Node* tree = NULL;
 
-// total number of nodes in the global tree
-int node_count = 0;
+/* SHARD - memory and counters of a part of a dictionary's tree. Without
+   sharding all nodes belong to shard 0. In sharded mode the root belongs
+   to shard 0 and the subtree below the root's edge for letter x to shard x,
+   so operations on words with different first letters never touch the
+   same memory and may run in parallel.
+     node_pool, children_pool - memory for the shard's nodes and their
+                                children, one pool for each children layout.
+     words - where the shard's words are appended to all_words.
+     node_count - number of the shard's nodes.
+     label_bytes - total length of the labels of the shard's nodes.
+     lock - held by the thread that changes the shard in a batch.
+*/
+typedef struct{
+    Pool node_pool;
+    Pool children_pool[LAYOUT_COUNT];
+    TextCursor words;
+    int node_count;
+    int label_bytes;
+    pthread_mutex_t lock;
+} Shard;
+
+#define STARTING_INDEX_CAPACITY 1024
+#define STARTING_MARKS_CAPACITY 1024
+#define MARKS_MAX ((1 << 24) - 1)  // nodes past this many stay unmarked
+
+/* WORD INDEX - open addressing table from whole words to their nodes, so
+   lookup takes one probe instead of a walk down the tree. Collisions go to
+   the next slots; a removed entry is filled by the ones after it that may
+   move back, so there are no tombstones. The first lookup builds it, and
+   from then on give_id and delete_word keep it up to date.
+     slots[x] - node of a word and the word's hash, node NULL if the slot
+                is empty.
+     mask - number of slots minus 1; there are at least twice as many
+            slots as words.
+     count - number of words in the table.
+     ready - 1 if the table holds every word of the tree, 0 if it isn't kept.
+     lock - held by deletes of a sharded batch while they change the table.
+*/
+typedef struct{
+    Node* node;
+    uint32_t hash;
+} IndexSlot;
+
+typedef struct{
+    IndexSlot* slots;
+    uint32_t mask;
+    int count;
+    int ready;
+    pthread_mutex_t lock;
+} WordIndex;
+
+/* BATCH - the part of run_batch's operations that the shards run in parallel.
+     order - indices of the operations grouped by shard: shard x runs
+             order[start[x]], ..., order[start[x + 1] - 1], in this order.
+     shard_of - shard of each operation, -1 if it fails without running.
+     nodes - node of the word each insert has added, NULL if it failed.
+     node_change - change of the node count caused by each operation.
+     next_shard - next shard to be taken by a thread.
+     finished - number of shards done, protected by batch_lock.
+     generation - number of batches started, protected by batch_lock.
+     stopping - 1 once the workers have to quit, protected by batch_lock.
+*/
+typedef struct{
+    TrieOperation* operations;
+    int capacity;
+    int* order;
+    int start[SHARD_COUNT + 1];
+    int* shard_of;
+    Node** nodes;
+    int* node_change;
+    _Atomic int next_shard;
+    int finished;
+    long generation;
+    int stopping;
+} Batch;
+
+/* COMPACTION - a copy of the text the nodes refer to into new chunks, so
+   that the chunks with the text of deleted words can be freed. It runs in
+   slices between modifications: every slice goes through the next leaves
+   in the order of the tree, appends each leaf's word through cursor and
+   moves the leaf and every node above it whose text is still old to the
+   copy, like thaw_tree stores words. Words inserted meanwhile go to new
+   chunks too, and prev and suffixes copy an old word before they refer to
+   it, so once the last leaf is reached no node refers to an old chunk.
+     running - 1 from the first slice until the last one.
+     old[x] - 1 if chunk x held text when the compaction started; the last
+              slice frees these chunks. There are old_count entries, one for
+              every chunk number handed out by then.
+     position - word of the last leaf a slice went through, position_length
+                characters, -1 before the first one. The next slice starts
+                at the first leaf after it in the order of the tree, so it
+                doesn't matter what was inserted or deleted in between.
+     old_used - characters appended to the old chunks.
+     last_size - characters in use right after the last compaction.
+     ratio - see set_compact_ratio.
+     checked - bytes allocated when the text was last checked against ratio.
+*/
+typedef struct{
+    int running;
+    char* old;
+    int old_count;
+    TextCursor cursor;
+    char* position;
+    int position_length;
+    int position_capacity;
+    long old_used;
+    long last_size;
+    int ratio;
+    long checked;
+} Compaction;
+
+/* SUFFIX LINKS - what insert_suffixes keeps while it runs.
+     marked - the nodes it has marked, marked_count of them; a node's
+              ancestors are marked with it.
+     links[x] - link of marked[x], NULL if it has none yet: a node on the
+                path of its string without the first letter, at or above
+                where that ends. Only marked nodes get links.
+     unlinked - the nodes above a suffix that get their links while the
+                next one is looked up, unlinked_count of them, the deepest
+                first.
+*/
+typedef struct{
+    Node** marked;
+    Node** links;
+    int marked_count;
+    int marked_capacity;
+    Node** unlinked;
+    int unlinked_count;
+    int unlinked_capacity;
+} SuffixLinks;
+
+/* DICTIONARY - a tree and everything kept for it. Dictionaries share only
+   the statistics counters, so each may be used by its own thread.
+     tree - root of the tree, NULL if it's empty.
+     shards - see Shard, shard_count of them: SHARD_COUNT in sharded mode,
+              1 otherwise, 0 until the first insert sets them up.
+     current_id - id to be given to the next inserted node, managed by
+                  next_id().
+     full_word[x] - node representing a full word with id = x. Only entries
+                    below current_id are meaningful: the ones above it are
+                    left over from before the last clear and get
+                    overwritten as ids are reused.
+     all_words - text of all words added using the insert command, used to
+                 optimize prev operation memory usage.
+     compaction - see Compaction.
+     word_index - see WordIndex.
+     sharded - if 1, nodes are spread over shards by first letter and
+               run_batch runs operations of different shards on the
+               workers in parallel; batch_running is 1 while it does.
+               Words inserted in a batch get ID_PENDING, their ids are
+               given in the order of the operations afterwards.
+     batch, batch_lock, batch_started, batch_finished - see Batch.
+     workers, worker_count - threads helping with batches, the calling one
+                             not included.
+     frozen - if 1, the tree is served straight from a loaded snapshot, or
+              from compact if compacted == 1 (after freeze), and everything
+              above is empty until it's thawed: by the first modification
+              if thaw_on_write == 1, by thaw otherwise.
+     concurrent - if 1, find may run in other threads while this one
+                  modifies the tree. Every modification makes
+                  write_sequence odd while it runs, so readers can tell they
+                  saw a half-done change and look again, and memory they
+                  might still be reading goes through epochs before reuse.
+*/
+struct Dictionary{
+    Node* tree;
+    Shard* shards;
+    int shard_count;
+    int current_id;
+    Node** full_word;
+    int full_word_capacity;
+    Text all_words;
+    Compaction compaction;
+    WordIndex word_index;
+    int sharded;
+    int batch_running;
+    Batch batch;
+    pthread_mutex_t batch_lock;
+    pthread_cond_t batch_started;
+    pthread_cond_t batch_finished;
+    pthread_t* workers;
+    int worker_count;
+    Snapshot snapshot;
+    FrozenTrie compact;
+    int frozen;
+    int compacted;
+    int thaw_on_write;
+    int concurrent;
+    EpochDomain* epochs;
+    _Atomic unsigned int write_sequence;
+};
 
-// id to be given to the next inserted node, managed by next_id() function
-int current_id = 0;
 
-// full_word[x] is a pointer to a node representing a full word with id = x
-Node* full_word[MAX_WORDS];
 
-// Big char array used to keep all words added using the insert command,
-//  used to optimize prev operation memory usage
-char* all_words = NULL;
+/* *********************
+ * AUXILIARY FUNCTIONS *
+ * *********************/
 
-// currently used and max size of all_words array; Used to determine if we should realloc
-int all_words_current = 0;
-int all_words_max = 0;
 
 
+// pool_free for an object retired to the epoch domain
+void recycle_later(void* object, void* pool){
+    pool_free(pool, object);
+}
 
-/* *********************
- * AUXILIARY FUNCTIONS *
- * *********************/
 
+// give an object back to its pool once no reader can see it anymore
+void recycle(Dictionary* dict, Pool* pool, void* object){
+    if (dict->concurrent == 1){
+        epoch_retire(dict->epochs, object, recycle_later, pool);
+    }
+    else{
+        pool_free(pool, object);
+    }
+}
 
 
-// Create an empty node and return a pointer to it
-Node* node_construct(int label_start, int label_end, int word_start, Node* parent, int id){
-    Node* node = malloc(sizeof(*node));
-    
-    node->label_start = label_start;
-    node->label_end = label_end;
-    node->word_start = word_start;
-    node->parent = parent;
+// make sure readers see everything written so far before a pointer to it
+void publish(Dictionary* dict){
+    if (dict->concurrent == 1){
+        atomic_thread_fence(memory_order_release);
+    }
+}
 
-    node->id = id;
 
-    for (int i = 0; i < ALPHABET_SIZE; ++i){
-        node->path[i] = NULL;
+// wait until readers can't see anything that has been unlinked so far
+void wait_for_readers(Dictionary* dict){
+    if (dict->concurrent == 1){
+        epoch_synchronize(dict->epochs);
     }
-    node_count++;
-    return node;
 }
 
 
-// Free all memory used by a node
-void node_destruct(Node* node){
-    if (node != NULL){
-        free(node);
-        node_count--;
+// start modifying the tree
+void write_begin(Dictionary* dict){
+    if (dict->concurrent == 1){
+        unsigned int sequence = atomic_load_explicit(&dict->write_sequence, memory_order_relaxed);
+        atomic_store_explicit(&dict->write_sequence, sequence + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
     }
 }
 
 
-// initialize the global tree if it has no root
-void init(){
-    if (tree == NULL){
-        tree = node_construct(-1, -1, -1, NULL, -1);
-        node_count = 1;
-        all_words = calloc(STARTING_WORDS_CAPACITY + 1, sizeof(char));
-        all_words_current = 0;
-        all_words_max = STARTING_WORDS_CAPACITY;
+// finish modifying the tree; returns result, for convenience
+int write_end(Dictionary* dict, int result){
+    if (dict->concurrent == 1){
+        unsigned int sequence = atomic_load_explicit(&dict->write_sequence, memory_order_relaxed);
+        atomic_store_explicit(&dict->write_sequence, sequence + 1, memory_order_release);
+        epoch_collect(dict->epochs);
     }
+    return result;
 }
 
 
-// get next id; used when adding a new node to the tree. 
-int next_id(){
-    return current_id++;
+// number of the shard a new child of parent for a given letter belongs to
+int shard_for(Dictionary* dict, Node* parent, int letter_number){
+    if (parent == NULL){
+        return 0;
+    }
+    if (parent->parent == NULL){
+        return dict->sharded == 1 ? letter_number : 0;
+    }
+    return parent->shard;
 }
 
 
-// add and edge from parent to child.
-void add_edge(Node* parent, Node* child){
-    char first_letter = all_words[child->label_start];
-    int letter_number = first_letter - 'a';
-    parent->path[letter_number] = child;
+// stop the program when there's no memory for a part of the tree: a change
+//  can't be undone half-way
+void* tree_memory(void* memory){
+    if (memory == NULL){
+        fprintf(stderr, "Error: out of memory\n");
+        abort();
+    }
+    return memory;
 }
 
 
-// remove an edge whose label begins with first_letter from parent
-void remove_edge(Node* parent, char first_letter){
-    int letter_number = first_letter - 'a';
-    parent->path[letter_number] = NULL;
+// get memory for a part of the tree from a pool
+void* tree_alloc(Pool* pool){
+    return tree_memory(pool_alloc(pool));
 }
 
 
-// change the label and parent of a given node without modifying its other properties
-void change_parent_edge(Node* node, int n_start, Node* parent){
-    node->label_start = n_start;
+// Create an empty node in a given shard and return a pointer to it
+Node* node_construct(Dictionary* dict, int label_start, int label_end, int word_start,
+                     Node* parent, int id, int shard){
+    Node* node = tree_alloc(&dict->shards[shard].node_pool);
+    
+    node->label_start = label_start;
+    node->label_end = label_end;
+    node->word_start = word_start;
     node->parent = parent;
+
+    node->id = id;
+    node->words = 0;
+    node->shard = shard;
+    node->marked = 0;
+
+    node->children = NULL;
+    dict->shards[shard].node_count++;
+    STAT_ADD(nodes_allocated, 1);
+    if (parent != NULL){
+        dict->shards[shard].label_bytes += label_end - label_start + 1;
+    }
+    return node;
 }
 
 
-// add a node's label to its parent's label, delete the node
-// 1--w--2--v--3  ->  1--wv--3
-void union_with_parent(Node* node){
-    // we assume here than node has exactly 1 child
-    Node* parent = node->parent;
-    Node* child = NULL;
-    for (int i = 0; i < ALPHABET_SIZE; ++i){
-            if (node->path[i] != NULL){
-                child = node->path[i];
-                break;
-            }
+// number of the children layout with a given capacity
+int layout_index(int capacity){
+    int layout = 0;
+    while (layout_capacity[layout] != capacity){
+        ++layout;
     }
-    int node_label_length = node->label_end - node->label_start + 1;
-    char first_letter = all_words[node->label_start];
-    
-    remove_edge(parent, first_letter);
-    remove_edge(node, all_words[child->label_start]);
-    change_parent_edge(child, child->label_start - node_label_length, parent);
-    node_destruct(node);
-    add_edge(parent, child);
+    return layout;
 }
 
 
-// return the number of a given node's children
-int child_count(Node* node){
-    int result = 0;
-    for (int i = 0; i < ALPHABET_SIZE; ++i){
-        if (node->path[i] != NULL){
-            ++result;
+// capacity of the smallest children layout that fits a number of edges
+int layout_fitting(int count){
+    int layout = 0;
+    while (layout_capacity[layout] < count){
+        ++layout;
+    }
+    return layout_capacity[layout];
+}
+
+
+// get the pool holding children of a given capacity for a node
+Pool* children_pool_for(Dictionary* dict, Node* node, int capacity){
+    return &dict->shards[node->shard].children_pool[layout_index(capacity)];
+}
+
+
+// Create an empty set of children with a given capacity for a node
+Children* children_construct(Dictionary* dict, Node* node, int capacity){
+    Children* children = tree_alloc(children_pool_for(dict, node, capacity));
+    STAT_ADD(children_allocated, 1);
+    memset(&children->bitmap, 0, sizeof(LetterSet));
+    children->capacity = capacity;
+    if (capacity == NODE_DIRECT){
+        for (int i = 0; i < NODE_DIRECT; ++i){
+            children->path[i] = NULL;
         }
     }
-    return result;
+    return children;
 }
 
 
-// recursively clear a tree represented by a given node.
-void clear_node(Node* node){
+// Free memory used by a node's set of children (but not by the children themselves)
+void children_destruct(Dictionary* dict, Node* node, Children* children){
+    if (children != NULL){
+        STAT_ADD(children_freed, 1);
+        recycle(dict, children_pool_for(dict, node, children->capacity), children);
+    }
+}
+
+
+// Free all memory used by a node
+void node_destruct(Dictionary* dict, Node* node){
     if (node != NULL){
-        for (int i = 0; i < ALPHABET_SIZE; ++i){
-            clear_node(node->path[i]);
+        Shard* shard = &dict->shards[node->shard];
+        children_destruct(dict, node, node->children);
+        if (node->parent != NULL){
+            shard->label_bytes -= node->label_end - node->label_start + 1;
         }
-        node_destruct(node);
+        recycle(dict, &shard->node_pool, node);
+        shard->node_count--;
+        STAT_ADD(nodes_freed, 1);
     }
 }
 
 
-// add a word to words array; resize the array if needed. Returns the index
-//  where the new word begins.
-int add_word(char* word){
-    int word_l = strlen(word);
-    while (all_words_current + word_l > all_words_max){
-        all_words = realloc(all_words, all_words_max * 2 + 1);
-        all_words_max *= 2;
+// index in path[] of the edge for a given letter number
+int path_index(Children* children, int letter_number){
+    if (children->capacity == NODE_DIRECT){
+        return letter_number;
     }
-    strcat(all_words, word);
-    all_words_current += word_l;
-    return all_words_current - word_l;
+    return letters_rank(&children->bitmap, letter_number);
 }
 
 
-// reverse a string
-void reverse_string(char* a_string){
-    int ibegin = 0;
-    int iend = strlen(a_string) - 1;
-    while (ibegin < iend){
-        // swap letters
-        a_string[ibegin] ^= a_string[iend];
-        a_string[iend] ^= a_string[ibegin];
-        a_string[ibegin] ^= a_string[iend];
-        ++ibegin;
-        --iend;
+// target of an edge with label that begins on letter_number, or NULL.
+//   Safe to call from readers: every field is read only once.
+Node* get_child(Node* node, int letter_number){
+    Children* children = SHARED_LOAD(node->children);
+    if (children == NULL){
+        return NULL;
     }
+    LetterSet bitmap = letters_load(&children->bitmap);
+    if (letters_has(&bitmap, letter_number) == 0){
+        return NULL;
+    }
+    if (children->capacity == NODE_DIRECT){
+        return SHARED_LOAD(children->path[letter_number]);
+    }
+    return SHARED_LOAD(children->path[letters_rank(&bitmap, letter_number)]);
 }
 
 
+// move a node's edges to a layout with a different capacity
+void change_layout(Dictionary* dict, Node* node, int capacity){
+    Children* old = node->children;
+    Children* new = children_construct(dict, node, capacity);
+    new->bitmap = old->bitmap;
+    STAT_ADD(layout_changes, 1);
+
+    for (int x = letters_first(&old->bitmap); x != -1; x = letters_next(&old->bitmap, x + 1)){
+        new->path[path_index(new, x)] = old->path[path_index(old, x)];
+    }
+    children_destruct(dict, node, old);
+    publish(dict);
+    SHARED_STORE(node->children, new);
+}
 
-/* **********************
- * MAIN FUNCTIONS BELOW *
- * **********************/
 
+// 1 if the root's children may be changed by several shards at a time: they
+//  always use the direct-indexed layout then, so each shard only writes its
+//  own slot, and their bitmap changes atomically
+int pinned(Dictionary* dict, Node* node){
+    return dict->sharded == 1 && node->parent == NULL;
+}
 
 
-// insert a word into the tree. Returns -1 on fail, id otherwise;
-//   l_end and word_start are set to -1 when inserting a new word
-//   or to indices of all_words array when using the prev command.
-int insert_word(char* word, int label_end, int word_start){
-    init(); // if the tree is empty, insert will succeed, so we can use init()
-    int index = 0; // which letter of the word we are currently on
-    int word_l = strlen(word);
-    Node* current_node = tree;
-    char first_edge_letter;
-    int letter_number;
-    int label_start;
+// make child the target of parent's edge for a given letter, replacing
+//  the current target if there is one
+void set_child(Dictionary* dict, Node* parent, int letter_number, Node* child){
+    Children* children = parent->children;
+    if (children == NULL){
+        // readers can only reach the new edges once they are filled in
+        children = children_construct(dict, parent, pinned(dict, parent) ? NODE_DIRECT : NODE4);
+        children->path[path_index(children, letter_number)] = child;
+        letters_add(&children->bitmap, letter_number);
+        publish(dict);
+        SHARED_STORE(parent->children, children);
+        return;
+    }
+    publish(dict);
+    if (letters_has(&children->bitmap, letter_number) == 1){
+        SHARED_STORE(children->path[path_index(children, letter_number)], child);
+        return;
+    }
+    if (pinned(dict, parent)){
+        SHARED_STORE(children->path[letter_number], child);
+        letters_add_atomic(&children->bitmap, letter_number);
+        return;
+    }
+    int count = letters_count(&children->bitmap);
+    if (count == children->capacity){
+        change_layout(dict, parent, layout_capacity[layout_index(children->capacity) + 1]);
+        children = parent->children;
+    }
 
-    while (1){
-        // we will eventually exit the loop through one of the return statements.
-        if (index == word_l){
-            // current node represents the word we're trying to insert
-            if (current_node->id == -1){
-                // the word has not yet been inserted
-                current_node->id = next_id();
-                full_word[current_node->id] = current_node;
-                return current_node->id;
-            }
-            else{
-                // the word has already been inserted
-                return -1;
-            }
+    int index = path_index(children, letter_number);
+    if (children->capacity != NODE_DIRECT){
+        // keep the edges sorted
+        for (int i = count; i > index; --i){
+            SHARED_STORE(children->path[i], children->path[i - 1]);
         }
-        else{
-            // edge section
-            first_edge_letter = word[index];
-            letter_number = first_edge_letter - 'a';
-            if (current_node->path[letter_number] == NULL){
-                // 1--w--2     ->       1--w--2
-                //                       \-v--3
-                
-                if (word_start == -1){
-                    word_start = add_word(word);
-                    label_end = word_start + word_l - 1;
-                }
-                label_start = word_start + index;
+    }
+    SHARED_STORE(children->path[index], child);
+    letters_add_shared(&children->bitmap, letter_number);
+}
 
-                Node* new_node = node_construct(label_start, label_end, word_start,
-                                                current_node, next_id());
-                add_edge(current_node, new_node);
-                full_word[new_node->id] = new_node;
-                return new_node->id;
-            }
-            else{
-                Node* next_node = current_node->path[letter_number];
-                int edge_start = next_node->label_start;
-                int edge_end = next_node->label_end;
-                int edge_w_start = next_node->word_start;
-                for (int i = edge_start; i <= edge_end; ++i){
-                    // follow the edge and try to find out where the word should be inserted
-                    if (index == word_l){
-                        // end of the word, create a node here
-                        // 1--wv--2      ->   1--w--3--v--2
-                        
-                        Node* new_node = node_construct(edge_start, i - 1, edge_w_start,
-                                                        current_node, next_id());
-                        full_word[new_node->id] = new_node;
-                        change_parent_edge(next_node, i, new_node);
-                        add_edge(new_node, next_node);
-                        current_node->path[letter_number] = new_node;
-
-                        return new_node->id;
-                    }
-                    else if (word[index] != all_words[i]){
-                        // nowhere to go; create new node and edge
-                        // 1--ab--2       ->     1--a--3--b--2
-                        //                              \-c--4
-                        
-                        Node* transition_node = node_construct(edge_start, i - 1, edge_w_start,
-                                                               current_node, -1);
-                        change_parent_edge(next_node, i, transition_node);
-                        add_edge(transition_node, next_node);
-                        current_node->path[letter_number] = transition_node;
 
-                        if (word_start == -1){
-                            word_start = add_word(word);
-                            label_end = word_start + word_l - 1;
-                        }
-                        label_start = word_start + index;
+// remove parent's edge for a given letter; shrink the layout if the
+//  remaining edges fit in a much smaller one
+void unset_child(Dictionary* dict, Node* parent, int letter_number){
+    Children* children = parent->children;
+    if (children == NULL || letters_has(&children->bitmap, letter_number) == 0){
+        return;
+    }
+    if (pinned(dict, parent)){
+        SHARED_STORE(children->path[letter_number], NULL);
+        letters_remove_atomic(&children->bitmap, letter_number);
+        return;
+    }
+    int index = path_index(children, letter_number);
+    int count = letters_count(&children->bitmap) - 1;
+    if (children->capacity == NODE_DIRECT){
+        SHARED_STORE(children->path[index], NULL);
+    }
+    else{
+        for (int i = index; i < count; ++i){
+            SHARED_STORE(children->path[i], children->path[i + 1]);
+        }
+    }
+    letters_remove_shared(&children->bitmap, letter_number);
+
+    if (count == 0){
+        children_destruct(dict, parent, children);
+        SHARED_STORE(parent->children, NULL);
+        return;
+    }
+    // leave a quarter of the smaller layout free before shrinking, so that a
+    //  node doesn't switch layouts back and forth when one edge is
+    //  repeatedly added and removed
+    int layout = layout_index(children->capacity);
+    if (layout > 0 && count <= layout_capacity[layout - 1] - layout_capacity[layout - 1] / 4){
+        change_layout(dict, parent, layout_capacity[layout - 1]);
+    }
+}
 
-                        Node* new_node = node_construct(label_start, label_end, word_start,
-                                                        transition_node, next_id());
-                        full_word[new_node->id] = new_node;
-                        add_edge(transition_node, new_node);
 
-                        return new_node->id;
-                    }
-                    else{
-                        // just follow the edge
-                        index++;
-                    }
-                }
+// target of the edge with the alphabetically first label
+Node* first_child(Node* node){
+    Children* children = node->children;
+    return children->path[path_index(children, letters_first(&children->bitmap))];
+}
+
+
+// initialize a dictionary's tree if it has no root
+void init(Dictionary* dict){
+    if (dict->shard_count == 0){
+        int count = dict->sharded == 1 ? SHARD_COUNT : 1;
+        dict->shards = tree_memory(malloc(count * sizeof(Shard)));
+        for (int x = 0; x < count; ++x){
+            pool_init(&dict->shards[x].node_pool, sizeof(Node));
+            for (int i = 0; i < LAYOUT_COUNT; ++i){
+                pool_init(&dict->shards[x].children_pool[i],
+                          sizeof(Children) + layout_capacity[i] * sizeof(Node*));
             }
+            text_cursor_reset(&dict->shards[x].words);
+            pthread_mutex_init(&dict->shards[x].lock, NULL);
+            dict->shards[x].node_count = 0;
+            dict->shards[x].label_bytes = 0;
         }
-        current_node = current_node->path[letter_number];
+        dict->shard_count = count;
+    }
+    if (dict->tree == NULL){
+        Node* root = node_construct(dict, -1, -1, -1, NULL, -1, 0);
+        publish(dict);
+        SHARED_STORE(dict->tree, root);
     }
 }
 
 
-// insert a new word into the tree
-int insert(char* word){
-    return insert_word(word, -1, -1);
+// total number of nodes in a dictionary's tree
+int total_nodes(Dictionary* dict){
+    int count = 0;
+    for (int x = 0; x < dict->shard_count; ++x){
+        count += dict->shards[x].node_count;
+    }
+    return count;
 }
 
 
-// delete the word with given id. Returns -1 on fail, id otherwise
-int delete(int id){
-    if (id >= MAX_WORDS || full_word[id] == NULL){
-        // word with this id does not exist
-        return -1;
+// total length of the labels of all nodes in a dictionary's tree
+int total_label_bytes(Dictionary* dict){
+    int count = 0;
+    for (int x = 0; x < dict->shard_count; ++x){
+        count += dict->shards[x].label_bytes;
     }
-    if (node_count == 2){
-        // we must delete the root, as the tree becomes empty.
-        // detele root's child from id table:
-        for (int i = 0; i < ALPHABET_SIZE; i++){
-            if(tree->path[i] != NULL){
-                full_word[tree->path[i]->id] = NULL;
-            }
+    return count;
+}
+
+
+// number of characters appended to a dictionary's text and not freed yet
+long text_used(Dictionary* dict){
+    long count = dict->compaction.cursor.used;
+    if (dict->compaction.running == 1){
+        count += dict->compaction.old_used;
+    }
+    for (int x = 0; x < dict->shard_count; ++x){
+        count += dict->shards[x].words.used;
+    }
+    return count;
+}
+
+
+// make room for a given number of ids in the id table
+void reserve_ids(Dictionary* dict, int count){
+    if (count > dict->full_word_capacity){
+        if (dict->full_word_capacity == 0){
+            dict->full_word_capacity = STARTING_IDS_CAPACITY;
         }
-        clear_node(tree);
-        tree = NULL;
-        free(all_words);
-        all_words = NULL;
-        return id;
+        while (count > dict->full_word_capacity){
+            dict->full_word_capacity *= 2;
+        }
+        dict->full_word = realloc(dict->full_word, dict->full_word_capacity * sizeof(Node*));
     }
+}
 
-    Node* node = full_word[id];
-    Node* parent = node->parent;
-    char first_letter = all_words[node->label_start]; // to delete parent's edge
-    full_word[id] = NULL;
-    node->id = -1;
 
-    if (child_count(node) == 0){
-        // just delete the node and an edge from parent
-        remove_edge(parent, first_letter);
-        node_destruct(node);
+// get next id; used when adding a new node to the tree. 
+int next_id(Dictionary* dict){
+    reserve_ids(dict, dict->current_id + 1);
+    return dict->current_id++;
+}
+
+
+// get the node representing a full word with a given id, NULL if there is none
+Node* word_node(Dictionary* dict, int id){
+    if (id < 0 || id >= dict->current_id){
+        return NULL;
     }
-    else if (child_count(node) == 1){
-        // unify the node with its parent
-        union_with_parent(node);
+    return dict->full_word[id];
+}
+
+
+// change the word count of a node and all of its ancestors but the root,
+//  which would be shared by all shards
+void add_words(Node* node, int amount){
+    for (; node->parent != NULL; node = node->parent){
+        node->words += amount;
     }
-    // if child_count(node) > 1 we just leave it as a transition node
+}
 
-    if (parent->id == -1 && child_count(parent) < 2 && parent->parent != NULL){
-        // we might need to delete the parent or unify it with its own parent
-        Node* grandparent = parent->parent;
-        first_letter = all_words[parent->label_start];
-        if (child_count(parent) == 0){
-            remove_edge(grandparent, first_letter);
-            node_destruct(parent);
-            return id;
-        }
-        union_with_parent(parent);
+
+// add and edge from parent to child.
+void add_edge(Dictionary* dict, Node* parent, Node* child){
+    char first_letter = *text_at(&dict->all_words, child->label_start);
+    int letter_number = letter_number_of(first_letter);
+    set_child(dict, parent, letter_number, child);
+}
+
+
+// remove an edge whose label begins with first_letter from parent
+void remove_edge(Dictionary* dict, Node* parent, char first_letter){
+    int letter_number = letter_number_of(first_letter);
+    unset_child(dict, parent, letter_number);
+}
+
+
+// change the label and parent of a given node without modifying its other properties
+void change_parent_edge(Dictionary* dict, Node* node, int n_start, Node* parent){
+    dict->shards[node->shard].label_bytes += node->label_start - n_start;
+    SHARED_STORE(node->label_start, n_start);
+    node->parent = parent;
+}
+
+
+// add a node's label to its parent's label, delete the node
+// 1--w--2--v--3  ->  1--wv--3
+void union_with_parent(Dictionary* dict, Node* node){
+    // we assume here than node has exactly 1 child
+    Node* parent = node->parent;
+    Node* child = first_child(node);
+    int node_label_length = node->label_end - node->label_start + 1;
+    STAT_ADD(unions, 1);
+
+    // the child's new label begins with the same letter as the node's,
+    //  so it simply takes over the parent's edge
+    change_parent_edge(dict, child, child->label_start - node_label_length, parent);
+    add_edge(dict, parent, child);
+    node_destruct(dict, node);
+}
+
+
+// return the number of a given node's children
+int child_count(Node* node){
+    if (node->children == NULL){
+        return 0;
     }
-    return id;
+    return letters_count(&node->children->bitmap);
 }
 
 
-// instert a chosen fragment of the word with a given id. Returns -1 if
-//  a word with this id does not exist or if we can't insert the fragment
-int prev(int id, int start, int end){
-    if (full_word[id] == NULL || start > end){
-        return -1;
+// the first node after a given one's subtree in lexicographic order of
+//  their words, among the nodes in top's subtree; NULL if there's none
+Node* next_after_subtree(Dictionary* dict, Node* node, Node* top){
+    for (; node != top; node = node->parent){
+        int letter_number = letter_number_of(*text_at(&dict->all_words, node->label_start));
+        int later = letters_next(&node->parent->children->bitmap, letter_number + 1);
+        if (later != -1){
+            return get_child(node->parent, later);
+        }
     }
+    return NULL;
+}
 
-    Node* node = full_word[id];
-    if (end > (node->label_end - node->word_start)){
-        return -1;
+
+// the node after a given one in lexicographic order of their words, among
+//  the nodes in top's subtree; NULL if it's the last one
+Node* next_in_order(Dictionary* dict, Node* node, Node* top){
+    if (child_count(node) > 0){
+        return first_child(node);
     }
-    int original_word_start = node->word_start;
+    return next_after_subtree(dict, node, top);
+}
 
-    // we need to recreate the word we are inserting
-    char* new_word = malloc((end - start + 2) * sizeof(char));
-    for (int i = start; i <= end; ++i){
-        new_word[i - start] = all_words[original_word_start + i];
+
+// hash of a word for the word index
+uint32_t word_hash(const char* word, int length){
+    // FNV-1a, with the high bits mixed into the low ones the slot is taken from
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < length; ++i){
+        hash = (hash ^ (unsigned char)word[i]) * 16777619u;
     }
-    new_word[end - start + 1] = 0;
+    return hash ^ hash >> 16;
+}
 
-    int label_end = original_word_start + end;
-    int word_start = original_word_start + start;
 
-    int returned_id = insert_word(new_word, label_end, word_start);
-    free(new_word);
-    return returned_id;
+// length of the word a node represents
+int word_length(Node* node){
+    return node->label_end - node->word_start + 1;
 }
 
 
-// check if a pattern belongs to the tree. Returns 1 if it does, -1 otherwise
-int find(char* pattern){
-    int index = 0;
-    Node* node = tree;
-    int pattern_l = strlen(pattern);
-    while (1){
-        // we will break the loop upon finding the pattern / reaching NULL
-        if (node == NULL){
-            return -1;
-        }
+// hash of the word a node represents
+uint32_t node_hash(Dictionary* dict, Node* node){
+    return word_hash(text_at(&dict->all_words, node->word_start), word_length(node));
+}
 
-        int first_letter = pattern[index];
-        int letter_number = first_letter - 'a';
-        int label_start = -1;
-        int label_end = -1;
-        if(node->path[letter_number] != NULL){
-            label_start = node->path[letter_number]->label_start;
-            label_end = node->path[letter_number]->label_end;
-        }
-        if (label_start == -1){
-            return -1;
-        }
 
-        for (int i = label_start; i <= label_end; ++i){
-            if (pattern[index] != all_words[i]){
-                return -1;
-            }
-            ++index;
-            if (index == pattern_l){
-                return 1;
-            }
+// stop keeping the word index; the next lookup builds it again
+void index_drop(Dictionary* dict){
+    free(dict->word_index.slots);
+    dict->word_index.slots = NULL;
+    dict->word_index.mask = 0;
+    dict->word_index.count = 0;
+    dict->word_index.ready = 0;
+}
+
+
+// put a node into a free slot of the word index, which has room for it
+void index_place(Dictionary* dict, uint32_t hash, Node* node){
+    uint32_t x = hash & dict->word_index.mask;
+    while (dict->word_index.slots[x].node != NULL){
+        x = (x + 1) & dict->word_index.mask;
+    }
+    dict->word_index.slots[x].node = node;
+    dict->word_index.slots[x].hash = hash;
+    ++dict->word_index.count;
+}
+
+
+// make room for a given number of words in the word index; every entry
+//  goes to its place among the new slots. Returns -1 on fail (the index
+//  isn't kept anymore)
+int index_reserve(Dictionary* dict, long count){
+    uint32_t old_capacity = dict->word_index.slots == NULL ? 0 : dict->word_index.mask + 1;
+    if (2 * count <= old_capacity){
+        return 1;
+    }
+    uint32_t capacity = old_capacity == 0 ? STARTING_INDEX_CAPACITY : old_capacity;
+    while (2 * count > capacity){
+        capacity *= 2;
+    }
+    IndexSlot* old_slots = dict->word_index.slots;
+    dict->word_index.slots = calloc(capacity, sizeof(IndexSlot));
+    if (dict->word_index.slots == NULL){
+        dict->word_index.slots = old_slots;
+        index_drop(dict);
+        return -1;
+    }
+    dict->word_index.mask = capacity - 1;
+    dict->word_index.count = 0;
+    for (uint32_t x = 0; x < old_capacity; ++x){
+        if (old_slots[x].node != NULL){
+            index_place(dict, old_slots[x].hash, old_slots[x].node);
         }
-        node = node->path[letter_number];
     }
+    free(old_slots);
+    return 1;
 }
 
 
-// clear the whole tree
-void clear(){
-    clear_node(tree);
-    tree = NULL;
-    current_id = 0;
-    for (int i = 0; i < MAX_WORDS; i++){
-        full_word[i] = NULL;
+// add the word of a node with an id to the word index, if it's kept
+void index_add(Dictionary* dict, Node* node){
+    if (dict->word_index.ready == 0 || index_reserve(dict, dict->word_index.count + 1L) == -1){
+        return;
     }
-    free(all_words);
-    all_words = NULL;
-    all_words_current = 0;
-    all_words_max = 0;
+    index_place(dict, node_hash(dict, node), node);
+}
+
+
+// remove the word of a node from the word index, if it's kept
+void index_remove(Dictionary* dict, Node* node){
+    if (dict->word_index.ready == 0){
+        return;
+    }
+    if (dict->batch_running == 1){
+        pthread_mutex_lock(&dict->word_index.lock);
+    }
+    uint32_t mask = dict->word_index.mask;
+    IndexSlot* slots = dict->word_index.slots;
+    uint32_t hole = node_hash(dict, node) & mask;
+    while (slots[hole].node != node){
+        hole = (hole + 1) & mask;
+    }
+    // an entry after the hole moves into it unless its own slot lies
+    //  between the hole and the entry
+    for (uint32_t x = (hole + 1) & mask; slots[x].node != NULL; x = (x + 1) & mask){
+        uint32_t home = slots[x].hash & mask;
+        if (((x - home) & mask) >= ((x - hole) & mask)){
+            slots[hole] = slots[x];
+            hole = x;
+        }
+    }
+    slots[hole].node = NULL;
+    --dict->word_index.count;
+    if (dict->batch_running == 1){
+        pthread_mutex_unlock(&dict->word_index.lock);
+    }
+}
+
+
+// number of words in a dictionary's tree; the root keeps no count of its own
+long tree_words(Dictionary* dict){
+    long count = 0;
+    if (dict->tree == NULL || dict->tree->children == NULL){
+        return 0;
+    }
+    const LetterSet* bitmap = &dict->tree->children->bitmap;
+    for (int x = letters_first(bitmap); x != -1; x = letters_next(bitmap, x + 1)){
+        count += get_child(dict->tree, x)->words;
+    }
+    return count;
+}
+
+
+// fill the word index with every word of the tree. Returns -1 on fail
+int index_build(Dictionary* dict){
+    index_drop(dict);
+    dict->word_index.ready = 1;
+    if (index_reserve(dict, tree_words(dict)) == -1){
+        return -1;
+    }
+    // in the order of the tree, which is mostly the order of the nodes' memory
+    for (Node* node = dict->tree; node != NULL; node = next_in_order(dict, node, dict->tree)){
+        if (node->id >= 0){
+            index_place(dict, node_hash(dict, node), node);
+        }
+    }
+    return 1;
+}
+
+
+// id of a word in the word index, -1 if it isn't there
+int index_find(Dictionary* dict, const char* word, int length){
+    if (dict->word_index.count == 0){
+        return -1;
+    }
+    uint32_t hash = word_hash(word, length);
+    for (uint32_t x = hash & dict->word_index.mask; dict->word_index.slots[x].node != NULL;
+         x = (x + 1) & dict->word_index.mask){
+        if (dict->word_index.slots[x].hash == hash){
+            Node* node = dict->word_index.slots[x].node;
+            if (word_length(node) == length &&
+                memcmp(text_at(&dict->all_words, node->word_start), word, length) == 0){
+                return node->id;
+            }
+        }
+    }
+    return -1;
+}
+
+
+// recursively clear a tree represented by a given node.
+void clear_node(Dictionary* dict, Node* node){
+    if (node != NULL){
+        Children* children = node->children;
+        for (int x = children == NULL ? -1 : letters_first(&children->bitmap); x != -1;
+             x = letters_next(&children->bitmap, x + 1)){
+            clear_node(dict, get_child(node, x));
+        }
+        node_destruct(dict, node);
+    }
+}
+
+
+// add a word to words store, through a given shard's cursor. Returns the
+//  index where the new word begins.
+int add_word(Dictionary* dict, int shard, const char* word, int length){
+    return text_append(&dict->all_words, &dict->shards[shard].words, word, length);
+}
+
+
+// give up a running compaction without freeing anything; the nodes may
+//  refer to old chunks and new ones alike
+void compaction_stop(Dictionary* dict){
+    Compaction* compaction = &dict->compaction;
+    if (compaction->running == 1){
+        compaction->running = 0;
+        free(compaction->old);
+        compaction->old = NULL;
+        compaction->old_count = 0;
+        compaction->cursor.used += compaction->old_used;
+    }
+}
+
+
+// free the text of all words
+void release_words(Dictionary* dict){
+    compaction_stop(dict);
+    text_release(&dict->all_words);
+    for (int x = 0; x < dict->shard_count; ++x){
+        text_cursor_reset(&dict->shards[x].words);
+    }
+    text_cursor_reset(&dict->compaction.cursor);
+    dict->compaction.last_size = 0;
+    dict->compaction.checked = 0;
+}
+
+
+// 1 if an offset is in a chunk a running compaction hasn't freed yet
+int text_is_old(Dictionary* dict, int offset){
+    int chunk = offset >> TEXT_CHUNK_BITS;
+    return dict->compaction.running == 1 && chunk < dict->compaction.old_count &&
+           dict->compaction.old[chunk] == 1;
+}
+
+
+// the first leaf of a node's subtree, NULL if the node is NULL
+Node* leftmost_leaf(Node* node){
+    while (node != NULL && node->children != NULL){
+        node = first_child(node);
+    }
+    return node;
+}
+
+
+// the first leaf whose word comes after a given word in the order of the
+//  tree, NULL if there's none. The word doesn't have to be in the tree
+Node* leaf_after(Dictionary* dict, const char* word, int length){
+    Node* node = dict->tree;
+    int index = 0;
+    while (index < length){
+        int letter_number = letter_number_of(word[index]);
+        Node* next_node = get_child(node, letter_number);
+        if (next_node == NULL){
+            // the edges for later letters lead to later words
+            int later = node->children == NULL
+                        ? -1 : letters_next(&node->children->bitmap, letter_number + 1);
+            return later != -1 ? leftmost_leaf(get_child(node, later))
+                               : leftmost_leaf(next_after_subtree(dict, node, dict->tree));
+        }
+        int label_length = next_node->label_end - next_node->label_start + 1;
+        int compared = length - index < label_length ? length - index : label_length;
+        const char* label = text_at(&dict->all_words, next_node->label_start);
+        int matched = mismatch(word + index, label, compared);
+        if (matched < compared){
+            int later = letter_number_of(label[matched]) > letter_number_of(word[index + matched]);
+            return later == 1 ? leftmost_leaf(next_node)
+                              : leftmost_leaf(next_after_subtree(dict, next_node, dict->tree));
+        }
+        if (compared < label_length){
+            // the word is a prefix of every word below next_node
+            return leftmost_leaf(next_node);
+        }
+        index += label_length;
+        node = next_node;
+    }
+    // every word below node but its own comes after the word
+    return node->children != NULL ? leftmost_leaf(first_child(node))
+                                  : leftmost_leaf(next_after_subtree(dict, node, dict->tree));
+}
+
+
+// make a node refer to a copy of its word that begins at word_start
+void move_text(Node* node, int word_start){
+    int shift = word_start - node->word_start;
+    node->word_start = word_start;
+    node->label_start += shift;
+    node->label_end += shift;
+}
+
+
+// start a compaction of a dictionary's text: every chunk with text is old
+//  from now on, and the shards append to new ones. Returns -1 if there is
+//  nothing to compact or no memory to keep track of it
+int compaction_start(Dictionary* dict){
+    Compaction* compaction = &dict->compaction;
+    if (compaction->running == 1){
+        return 1;
+    }
+    if (dict->tree == NULL || dict->frozen == 1 || dict->concurrent == 1){
+        return -1;
+    }
+    int count = atomic_load(&dict->all_words.chunk_count);
+    compaction->old = malloc(count + 1);
+    if (compaction->old == NULL){
+        return -1;
+    }
+    compaction->old_count = count;
+    for (int x = 0; x < count; ++x){
+        compaction->old[x] = text_chunk(&dict->all_words, x) != NULL;
+    }
+    compaction->old_used = text_used(dict);
+    for (int x = 0; x < dict->shard_count; ++x){
+        text_cursor_reset(&dict->shards[x].words);
+    }
+    text_cursor_reset(&compaction->cursor);
+    compaction->position_length = -1;
+    compaction->running = 1;
+    return 1;
+}
+
+
+// remember the word of the last leaf a slice went through. Returns -1 on fail
+int compaction_remember(Compaction* compaction, const char* word, int length){
+    if (length > compaction->position_capacity){
+        int capacity = compaction->position_capacity == 0 ? 64 : compaction->position_capacity;
+        while (length > capacity){
+            capacity *= 2;
+        }
+        char* position = realloc(compaction->position, capacity);
+        if (position == NULL){
+            return -1;
+        }
+        compaction->position = position;
+        compaction->position_capacity = capacity;
+    }
+    memcpy(compaction->position, word, length);
+    compaction->position_length = length;
+    return 1;
+}
+
+
+// go through the leaves after the last one of the previous slice until
+//  COMPACT_SLICE work is done; the slice that reaches the end frees the old
+//  chunks. Returns 1 if the compaction goes
+//  on, 0 if it's over
+int compaction_slice(Dictionary* dict){
+    Compaction* compaction = &dict->compaction;
+    Node* leaf = compaction->position_length == -1
+                 ? leftmost_leaf(dict->tree)
+                 : leaf_after(dict, compaction->position, compaction->position_length);
+    long work = 0;
+    STAT_ADD(compaction_slices, 1);
+    while (leaf != NULL && leaf != dict->tree && work < COMPACT_SLICE){
+        int length = word_length(leaf);
+        if (text_is_old(dict, leaf->word_start)){
+            int word_start = text_append(&dict->all_words, &compaction->cursor,
+                                         text_at(&dict->all_words, leaf->word_start), length);
+            if (word_start == -1){
+                // no room for the copy, the old text has to stay
+                compaction_stop(dict);
+                return 0;
+            }
+            move_text(leaf, word_start);
+            STAT_ADD(compaction_copied, length);
+        }
+        // the word of every node above is a prefix of the leaf's
+        for (Node* node = leaf->parent; node != dict->tree && text_is_old(dict, node->word_start);
+             node = node->parent){
+            move_text(node, leaf->word_start);
+        }
+        if (compaction_remember(compaction, text_at(&dict->all_words, leaf->word_start),
+                                length) == -1){
+            compaction_stop(dict);
+            return 0;
+        }
+        work += length + COMPACT_LEAF;
+        leaf = leftmost_leaf(next_after_subtree(dict, leaf, dict->tree));
+    }
+    if (leaf != NULL && leaf != dict->tree){
+        return 1;
+    }
+
+    wait_for_readers(dict);
+    for (int x = 0; x < compaction->old_count; ++x){
+        if (compaction->old[x] == 1 && text_block_at(&dict->all_words, x) == 1){
+            text_free(&dict->all_words, x);
+        }
+    }
+    compaction->running = 0;
+    free(compaction->old);
+    compaction->old = NULL;
+    compaction->old_count = 0;
+    compaction->last_size = text_used(dict);
+    STAT_ADD(compactions, 1);
+    return 0;
+}
+
+
+// 1 if the text a dictionary has appended is ratio times as much as a
+//  compaction would leave, as far as it can tell: that's estimated by the
+//  larger of the labels' total length, which it never leaves less of, and
+//  what the last compaction left, so text that stays live isn't copied
+//  again before the text has grown ratio times. It's only checked when a
+//  block has been allocated or freed since the last time
+int compaction_due(Dictionary* dict){
+    Compaction* compaction = &dict->compaction;
+    long allocated = atomic_load(&dict->all_words.allocated);
+    if (compaction->ratio == 0 || compaction->running == 1 || allocated == compaction->checked){
+        return 0;
+    }
+    compaction->checked = allocated;
+    long used = text_used(dict);
+    long live = total_label_bytes(dict);
+    if (compaction->last_size > live){
+        live = compaction->last_size;
+    }
+    return used > TEXT_CHUNK_SIZE && used >= compaction->ratio * live;
+}
+
+
+// run a slice of the compaction that's going on, or start one if the text
+//  has grown enough; called after every modification. Returns result, for
+//  convenience
+int compaction_step(Dictionary* dict, int result){
+    if (dict->compaction.running == 1 ||
+        (compaction_due(dict) == 1 && compaction_start(dict) == 1)){
+        compaction_slice(dict);
+    }
+    return result;
+}
+
+
+// reverse a string
+void reverse_string(char* a_string){
+    int ibegin = 0;
+    int iend = strlen(a_string) - 1;
+    while (ibegin < iend){
+        // swap letters
+        a_string[ibegin] ^= a_string[iend];
+        a_string[iend] ^= a_string[ibegin];
+        a_string[ibegin] ^= a_string[iend];
+        ++ibegin;
+        --iend;
+    }
+}
+
+
+// free the memory of all nodes at once; none of them may be used anymore
+void release_nodes(Dictionary* dict){
+    // every node lives in the pools, so there's no need to visit them
+    for (int x = 0; x < dict->shard_count; ++x){
+        pool_release(&dict->shards[x].node_pool);
+        for (int i = 0; i < LAYOUT_COUNT; ++i){
+            pool_release(&dict->shards[x].children_pool[i]);
+        }
+        dict->shards[x].node_count = 0;
+        dict->shards[x].label_bytes = 0;
+    }
+}
+
+
+// free the shards of a dictionary with an empty tree; the next init sets
+//  them up again
+void release_shards(Dictionary* dict){
+    release_nodes(dict);
+    for (int x = 0; x < dict->shard_count; ++x){
+        pthread_mutex_destroy(&dict->shards[x].lock);
+    }
+    free(dict->shards);
+    dict->shards = NULL;
+    dict->shard_count = 0;
+}
+
+
+// drop all nodes, words and ids of a dictionary's tree
+void clear_tree(Dictionary* dict){
+    SHARED_STORE(dict->tree, NULL);
+    int was_frozen = dict->frozen;
+    SHARED_STORE(dict->frozen, 0);
+    // nothing can be freed while readers may still be looking at it
+    wait_for_readers(dict);
+    if (was_frozen == 1){
+        snapshot_release(&dict->snapshot);
+        frozen_release(&dict->compact);
+        SHARED_STORE(dict->compacted, 0);
+    }
+    release_nodes(dict);
+    // forgetting the ids is enough, see full_word
+    dict->current_id = 0;
+    index_drop(dict);
+    release_words(dict);
+}
+
+
+// store a dictionary's tree in a newly allocated snapshot. Returns -1 on fail
+int build_snapshot(Dictionary* dict, Snapshot* result){
+    SnapshotHeader layout;
+    uint32_t count = dict->tree == NULL ? 0 : total_nodes(dict);
+    uint64_t size = snapshot_layout(&layout, count, dict->current_id, total_label_bytes(dict));
+    char* block = calloc(1, size);
+    Node** stack = malloc((count + 1) * sizeof(Node*));
+    uint32_t* stack_index = malloc((count + 1) * sizeof(uint32_t));
+    if (block == NULL || stack == NULL || stack_index == NULL){
+        free(block);
+        free(stack);
+        free(stack_index);
+        return -1;
+    }
+    memcpy(block, &layout, sizeof(layout));
+    SnapshotNode* nodes = (SnapshotNode*)(block + layout.nodes_offset);
+    uint32_t* ids = (uint32_t*)(block + layout.ids_offset);
+    char* labels = block + layout.labels_offset;
+    for (int i = 0; i < dict->current_id; ++i){
+        ids[i] = SNAPSHOT_NO_ID;
+    }
+
+    // a node's children get consecutive indices when the node is taken from
+    //  the stack, then their subtrees are laid out one after another
+    uint32_t next_index = 1;
+    uint32_t label_used = 0;
+    int stack_size = 0;
+    if (count > 0){
+        nodes[0].label = 0;
+        nodes[0].id = SNAPSHOT_NO_ID;
+        nodes[0].words = 0;
+        stack[0] = dict->tree;
+        stack_index[0] = 0;
+        stack_size = 1;
+    }
+    while (stack_size > 0){
+        --stack_size;
+        Node* node = stack[stack_size];
+        uint32_t index = stack_index[stack_size];
+        LetterSet bitmap = {{0}};
+        if (node->children != NULL){
+            bitmap = node->children->bitmap;
+        }
+        nodes[index].bitmap = bitmap;
+        nodes[index].first_child = next_index;
+
+        // the children are pushed backwards, so the first one is on top
+        stack_size += letters_count(&bitmap);
+        int position = stack_size;
+        for (int x = letters_first(&bitmap); x != -1; x = letters_next(&bitmap, x + 1)){
+            Node* child = get_child(node, x);
+            int length = child->label_end - child->label_start + 1;
+            memcpy(labels + label_used, text_at(&dict->all_words, child->label_start), length);
+            nodes[next_index].label = label_used;
+            nodes[next_index].id = child->id == -1 ? SNAPSHOT_NO_ID : child->id;
+            nodes[next_index].words = child->words;
+            if (node == dict->tree){
+                nodes[0].words += child->words;
+            }
+            if (child->id != -1){
+                ids[child->id] = next_index;
+            }
+            --position;
+            stack[position] = child;
+            stack_index[position] = next_index;
+            label_used += length;
+            ++next_index;
+        }
+    }
+    nodes[count].label = label_used;
+
+    free(stack);
+    free(stack_index);
+    if (snapshot_attach(result, block, size) == -1){
+        free(block);
+        return -1;
+    }
+    return 1;
+}
+
+
+// rebuild a dictionary's tree from the snapshot it's frozen in and drop the snapshot.
+//   Words are stored again one per leaf; every other node's word is a prefix
+//   of the word of the first leaf below it.
+void thaw_tree(Dictionary* dict){
+    if (dict->compacted == 1 && frozen_snapshot(&dict->compact, &dict->snapshot) == -1){
+        // no memory to unpack it, nothing can be kept
+        clear_tree(dict);
+        return;
+    }
+    const SnapshotHeader* header = dict->snapshot.header;
+    const SnapshotNode* nodes = dict->snapshot.nodes;
+    uint32_t count = header->node_count;
+    SHARED_STORE(dict->frozen, 0);
+
+    reserve_ids(dict, header->id_count);
+    dict->current_id = header->id_count;
+    for (int i = 0; i < dict->current_id; ++i){
+        dict->full_word[i] = NULL;
+    }
+
+    // stack of (snapshot node, its parent, length of the parent's word)
+    uint32_t* stack_index = malloc((count + 1) * sizeof(uint32_t));
+    Node** stack_parent = malloc((count + 1) * sizeof(Node*));
+    int* stack_depth = malloc((count + 1) * sizeof(int));
+    int stack_size = 0;
+    int path_capacity = 64;
+    char* path = malloc(path_capacity);
+    int damaged = 0;
+    // nodes in the order they're built, every parent before its children
+    Node** order = malloc((count + 1) * sizeof(Node*));
+    int built = 0;
+
+    if (count > 0){
+        init(dict);
+        stack_index[0] = 0;
+        stack_parent[0] = NULL;
+        stack_depth[0] = 0;
+        stack_size = 1;
+    }
+    while (stack_size > 0 && damaged == 0){
+        --stack_size;
+        uint32_t index = stack_index[stack_size];
+        Node* parent = stack_parent[stack_size];
+        int depth = stack_depth[stack_size];
+        Node* node = dict->tree;
+
+        if (index >= count){
+            // a snapshot may come from a damaged file, check everything
+            damaged = 1;
+            break;
+        }
+        if (parent != NULL){
+            uint32_t label = nodes[index].label;
+            uint32_t id = nodes[index].id;
+            if (label >= nodes[index + 1].label ||
+                nodes[index + 1].label > header->label_bytes ||
+                (id != SNAPSHOT_NO_ID && id >= header->id_count)){
+                damaged = 1;
+                break;
+            }
+            int length = nodes[index + 1].label - label;
+            while (depth + length > path_capacity){
+                path_capacity *= 2;
+                path = realloc(path, path_capacity);
+            }
+            memcpy(path + depth, dict->snapshot.labels + label, length);
+            if (is_letter(path[depth]) == 0){
+                damaged = 1;
+                break;
+            }
+            int letter_number = letter_number_of(path[depth]);
+
+            // offsets are relative to the word's start until a leaf gets stored
+            node = node_construct(dict, depth, depth + length - 1, -1, parent,
+                                  id == SNAPSHOT_NO_ID ? -1 : (int)id,
+                                  shard_for(dict, parent, letter_number));
+            set_child(dict, parent, letter_number, node);
+            if (node->id != -1){
+                dict->full_word[node->id] = node;
+            }
+            order[built++] = node;
+            depth += length;
+
+            if (letters_empty(&nodes[index].bitmap) == 1){
+                int word_start = add_word(dict, node->shard, path, depth);
+                if (word_start == -1){
+                    damaged = 1;
+                    break;
+                }
+                for (Node* x = node; x != dict->tree && x->word_start == -1; x = x->parent){
+                    x->word_start = word_start;
+                    x->label_start += word_start;
+                    x->label_end += word_start;
+                }
+            }
+        }
+
+        int children = letters_count(&nodes[index].bitmap);
+        if (stack_size + children > count){
+            damaged = 1;
+            break;
+        }
+        for (int i = children - 1; i >= 0; --i){
+            stack_index[stack_size] = nodes[index].first_child + i;
+            stack_parent[stack_size] = node;
+            stack_depth[stack_size] = depth;
+            ++stack_size;
+        }
+    }
+
+    // word counts aren't taken from the file, they're summed up from the leaves
+    for (int i = built - 1; i >= 0; --i){
+        Node* node = order[i];
+        node->words += node->id != -1;
+        if (node->parent != dict->tree){
+            node->parent->words += node->words;
+        }
+    }
+
+    free(stack_index);
+    free(stack_parent);
+    free(stack_depth);
+    free(path);
+    free(order);
+    wait_for_readers(dict);
+    snapshot_release(&dict->snapshot);
+    frozen_release(&dict->compact);
+    SHARED_STORE(dict->compacted, 0);
+    if (damaged == 1){
+        clear_tree(dict);
+    }
+}
+
+
+
+// get the tree ready for a modification: a frozen tree is thawed, unless
+//  modifications are rejected then. Returns -1 if they are, 1 otherwise
+int writable(Dictionary* dict){
+    if (dict->frozen == 1){
+        if (dict->thaw_on_write == 0){
+            return -1;
+        }
+        thaw_tree(dict);
+    }
+    return 1;
+}
+
+
+// build a dictionary's tree, which must be empty, from a word list. The words
+//   are taken in lexicographic order: a word's node hangs below the deepest
+//   node on the path to the previous word that is no deeper than their common
+//   prefix, and a branching node is added at that depth if there is none.
+//   The nodes are allocated in preorder afterwards, so every subtree takes
+//   consecutive memory. Words get ids in the order of the file, starting at
+//   current_id. Returns -1 on fail (the tree is left empty), 1 otherwise
+int build_sorted(Dictionary* dict, const WordList* list){
+    int count = list->count;
+    int capacity = 2 * count + 1;
+    // the tree before it's allocated; node 0 is the root.
+    //  depth - length of the node's word.
+    //  word - a word in the node's subtree, in lexicographic order.
+    //  first, next - the node's first child and its next sibling, -1 if none.
+    int* depth = malloc(capacity * sizeof(int));
+    int* word = malloc(capacity * sizeof(int));
+    int* first = malloc(capacity * sizeof(int));
+    int* next = malloc(capacity * sizeof(int));
+    // path to the last word and the last child of every node on it; reused
+    //  as the stack of the preorder walk
+    int* path = malloc(capacity * sizeof(int));
+    int* last = malloc(capacity * sizeof(int));
+    Node** path_node = malloc(capacity * sizeof(Node*));
+    // nodes in the order they're allocated, every parent before its children
+    Node** order = malloc(capacity * sizeof(Node*));
+    int damaged = depth == NULL || word == NULL || first == NULL || next == NULL ||
+                  path == NULL || last == NULL || path_node == NULL || order == NULL;
+
+    int used = 1;
+    int path_length = 1;
+    if (damaged == 0){
+        depth[0] = 0;
+        word[0] = -1;
+        first[0] = -1;
+        next[0] = -1;
+        path[0] = 0;
+        last[0] = -1;
+    }
+    for (int i = 0; i < count && damaged == 0; ++i){
+        int common = list->common[i];
+        int popped = -1;
+        while (depth[path[path_length - 1]] > common){
+            popped = path[--path_length];
+        }
+        if (depth[path[path_length - 1]] < common){
+            // the popped node moves one level down, below a new branching
+            //  node that takes its place among its siblings
+            int moved = used++;
+            depth[moved] = depth[popped];
+            word[moved] = word[popped];
+            first[moved] = first[popped];
+            next[moved] = -1;
+            depth[popped] = common;
+            word[popped] = i;
+            first[popped] = moved;
+            path[path_length] = popped;
+            last[path_length] = moved;
+            ++path_length;
+        }
+        // words come in lexicographic order, so the new one is longer than common
+        int leaf = used++;
+        depth[leaf] = word_list_length(list, i);
+        word[leaf] = i;
+        first[leaf] = -1;
+        next[leaf] = -1;
+        if (last[path_length - 1] == -1){
+            first[path[path_length - 1]] = leaf;
+        }
+        else{
+            next[last[path_length - 1]] = leaf;
+        }
+        last[path_length - 1] = leaf;
+        path[path_length] = leaf;
+        last[path_length] = -1;
+        ++path_length;
+    }
+
+    // nothing may be left of the memory of earlier nodes
+    wait_for_readers(dict);
+    release_nodes(dict);
+    // the ids below are given without give_id
+    index_drop(dict);
+    int first_id = dict->current_id;
+    reserve_ids(dict, dict->current_id + count);
+    int built = 0;
+    int stack_size = 0;
+    if (count > 0 && damaged == 0){
+        init(dict);
+        path[0] = 0;
+        path_node[0] = NULL;
+        stack_size = 1;
+    }
+    while (stack_size > 0){
+        --stack_size;
+        int x = path[stack_size];
+        Node* parent = path_node[stack_size];
+        Node* node = dict->tree;
+        if (parent != NULL){
+            // offsets are relative to the word's start until a leaf gets stored
+            const char* text = word_list_word(list, word[x]);
+            int start = last[stack_size];
+            int letter_number = letter_number_of(text[start]);
+            int id = depth[x] == word_list_length(list, word[x]) ? first_id + list->ranks[word[x]] : -1;
+            node = node_construct(dict, start, depth[x] - 1, -1, parent, id,
+                                  shard_for(dict, parent, letter_number));
+            set_child(dict, parent, letter_number, node);
+            if (id != -1){
+                dict->full_word[id] = node;
+            }
+            order[built++] = node;
+
+            if (first[x] == -1){
+                int word_start = add_word(dict, node->shard, text, depth[x]);
+                if (word_start == -1){
+                    damaged = 1;
+                    break;
+                }
+                for (Node* y = node; y != dict->tree && y->word_start == -1; y = y->parent){
+                    y->word_start = word_start;
+                    y->label_start += word_start;
+                    y->label_end += word_start;
+                }
+            }
+        }
+
+        // children are added in order, in a layout that fits all of them
+        int children = 0;
+        for (int y = first[x]; y != -1; y = next[y]){
+            ++children;
+        }
+        if (children > 0){
+            int capacity = pinned(dict, node) ? NODE_DIRECT : layout_fitting(children);
+            node->children = children_construct(dict, node, capacity);
+        }
+        stack_size += children;
+        int position = stack_size;
+        for (int y = first[x]; y != -1; y = next[y]){
+            --position;
+            path[position] = y;
+            path_node[position] = node;
+            last[position] = depth[x];
+        }
+    }
+
+    for (int i = built - 1; i >= 0; --i){
+        Node* node = order[i];
+        node->words += node->id != -1;
+        if (node->parent != dict->tree){
+            node->parent->words += node->words;
+        }
+    }
+    dict->current_id += count;
+
+    free(depth);
+    free(word);
+    free(first);
+    free(next);
+    free(path);
+    free(last);
+    free(path_node);
+    free(order);
+    if (damaged == 1){
+        clear_tree(dict);
+        dict->current_id = first_id;
+        return -1;
+    }
+    return 1;
+}
+
+
+
+// length of the string a node stands for
+int node_depth(Node* node){
+    return node->parent == NULL ? 0 : word_length(node);
+}
+
+
+// start with no marked nodes and no links
+void links_init(SuffixLinks* links){
+    links->marked = NULL;
+    links->links = NULL;
+    links->marked_count = 0;
+    links->marked_capacity = 0;
+    links->unlinked = NULL;
+    links->unlinked_count = 0;
+    links->unlinked_capacity = 0;
+}
+
+
+// unmark the marked nodes and forget the links
+void links_release(SuffixLinks* links){
+    for (int i = 0; i < links->marked_count; ++i){
+        links->marked[i]->marked = 0;
+    }
+    free(links->marked);
+    free(links->links);
+    free(links->unlinked);
+}
+
+
+// link of a node, NULL if it has none
+Node* get_link(SuffixLinks* links, Node* node){
+    return node->marked == 0 ? NULL : links->links[node->marked - 1];
+}
+
+
+// give a marked node a link
+void set_link(SuffixLinks* links, Node* node, Node* link){
+    links->links[node->marked - 1] = link;
+}
+
+
+// mark a node and its ancestors up to the first one that is marked already;
+//  without memory to remember them, the rest stay unmarked
+void mark_path(SuffixLinks* links, Node* node){
+    for (; node != NULL && node->marked == 0; node = node->parent){
+        if (links->marked_count == links->marked_capacity){
+            if (links->marked_capacity == MARKS_MAX){
+                return;
+            }
+            int capacity = links->marked_capacity == 0 ? STARTING_MARKS_CAPACITY
+                                                       : 2 * links->marked_capacity;
+            if (capacity > MARKS_MAX){
+                capacity = MARKS_MAX;
+            }
+            Node** marked = realloc(links->marked, capacity * sizeof(Node*));
+            if (marked == NULL){
+                return;
+            }
+            links->marked = marked;
+            Node** grown = realloc(links->links, capacity * sizeof(Node*));
+            if (grown == NULL){
+                return;
+            }
+            links->links = grown;
+            links->marked_capacity = capacity;
+        }
+        links->marked[links->marked_count] = node;
+        links->links[links->marked_count] = NULL;
+        node->marked = ++links->marked_count;
+    }
+}
+
+
+// remember a node that gets its link during the next lookup; without memory
+//  for it, it stays without one
+void add_unlinked(SuffixLinks* links, Node* node){
+    if (links->unlinked_count == links->unlinked_capacity){
+        int capacity = links->unlinked_capacity == 0 ? 64 : 2 * links->unlinked_capacity;
+        Node** unlinked = realloc(links->unlinked, capacity * sizeof(Node*));
+        if (unlinked == NULL){
+            return;
+        }
+        links->unlinked = unlinked;
+        links->unlinked_capacity = capacity;
+    }
+    links->unlinked[links->unlinked_count++] = node;
+}
+
+
+// give a node the links of the unlinked nodes whose strings without their
+//  first letters end above a given depth; the node is the deepest one on
+//  that path at or above them
+void link_unlinked(SuffixLinks* links, Node* node, int depth){
+    while (links->unlinked_count > 0 &&
+           node_depth(links->unlinked[links->unlinked_count - 1]) - 1 < depth){
+        set_link(links, links->unlinked[--links->unlinked_count], node);
+    }
+}
+
+/* **********************
+ * MAIN FUNCTIONS BELOW *
+ * **********************/
+
+
+// create an empty dictionary
+Dictionary* dictionary_create(){
+    Dictionary* dict = calloc(1, sizeof(Dictionary));
+    if (dict == NULL){
+        return NULL;
+    }
+    dict->thaw_on_write = 1;
+    dict->compaction.ratio = COMPACT_RATIO;
+    pthread_mutex_init(&dict->word_index.lock, NULL);
+    pthread_mutex_init(&dict->batch_lock, NULL);
+    pthread_cond_init(&dict->batch_started, NULL);
+    pthread_cond_init(&dict->batch_finished, NULL);
+    return dict;
+}
+
+
+// stop the workers of a dictionary, then free everything it holds
+void dictionary_destroy(Dictionary* dict){
+    pthread_mutex_lock(&dict->batch_lock);
+    dict->batch.stopping = 1;
+    pthread_cond_broadcast(&dict->batch_started);
+    pthread_mutex_unlock(&dict->batch_lock);
+    for (int i = 0; i < dict->worker_count; ++i){
+        pthread_join(dict->workers[i], NULL);
+    }
+    free(dict->workers);
+
+    clear_tree(dict);
+    if (dict->epochs != NULL){
+        epoch_release(dict->epochs);
+        free(dict->epochs);
+    }
+    release_shards(dict);
+    free(dict->full_word);
+    free(dict->compaction.position);
+    free(dict->batch.order);
+    free(dict->batch.shard_of);
+    free(dict->batch.nodes);
+    free(dict->batch.node_change);
+    pthread_mutex_destroy(&dict->word_index.lock);
+    pthread_mutex_destroy(&dict->batch_lock);
+    pthread_cond_destroy(&dict->batch_started);
+    pthread_cond_destroy(&dict->batch_finished);
+    free(dict);
+}
+
+
+
+// insert_node going down from a node that stands for word[0 .. index - 1];
+//   known is the number of letters of the word after it that are known to
+//   be on the node's edge, which are not compared again.
+Node* insert_below(Dictionary* dict, Node* current_node, int index, int known,
+                   const char* word, int word_l, int label_end, int word_start){
+    STAT_ADD(insert_calls, 1);
+    int shard = shard_for(dict, dict->tree, letter_number_of(word[0]));
+    char first_edge_letter;
+    int letter_number;
+    int label_start;
+
+    while (1){
+        // we will eventually exit the loop through one of the return statements.
+        if (index == word_l){
+            // current node represents the word we're trying to insert
+            if (current_node->id == -1){
+                // the word has not yet been inserted
+                current_node->id = ID_PENDING;
+                add_words(current_node, 1);
+                return current_node;
+            }
+            else{
+                // the word has already been inserted
+                return NULL;
+            }
+        }
+        else{
+            // edge section
+            first_edge_letter = word[index];
+            letter_number = letter_number_of(first_edge_letter);
+            Node* next_node = get_child(current_node, letter_number);
+            if (next_node == NULL){
+                // 1--w--2     ->       1--w--2
+                //                       \-v--3
+                
+                if (word_start == -1){
+                    word_start = add_word(dict, shard, word, word_l);
+                    if (word_start == -1){
+                        // no room left for the word's text
+                        return NULL;
+                    }
+                    label_end = word_start + word_l - 1;
+                }
+                label_start = word_start + index;
+
+                Node* new_node = node_construct(dict, label_start, label_end, word_start,
+                                                current_node, ID_PENDING, shard);
+                add_edge(dict, current_node, new_node);
+                add_words(new_node, 1);
+                return new_node;
+            }
+            else{
+                int edge_start = next_node->label_start;
+                int edge_end = next_node->label_end;
+                int edge_w_start = next_node->word_start;
+                int edge_length = edge_end - edge_start + 1;
+
+                // follow the edge and try to find out where the word should be inserted
+                int compared = word_l - index < edge_length ? word_l - index : edge_length;
+                STAT_ADD(insert_edges, 1);
+                STAT_ADD(insert_compared, compared);
+                int matched = known + mismatch(word + index + known,
+                                               text_at(&dict->all_words, edge_start + known),
+                                               compared - known);
+                known = 0;
+                int i = edge_start + matched;
+                index += matched;
+                if (matched < compared){
+                    // nowhere to go; create new node and edge
+                    // 1--ab--2       ->     1--a--3--b--2
+                    //                              \-c--4
+                    
+                    if (word_start == -1){
+                        word_start = add_word(dict, shard, word, word_l);
+                        if (word_start == -1){
+                            return NULL;
+                        }
+                        label_end = word_start + word_l - 1;
+                    }
+                    label_start = word_start + index;
+
+                    Node* transition_node = node_construct(dict, edge_start, i - 1, edge_w_start,
+                                                           current_node, -1, shard);
+                    transition_node->words = next_node->words;
+                    change_parent_edge(dict, next_node, i, transition_node);
+                    add_edge(dict, transition_node, next_node);
+                    set_child(dict, current_node, letter_number, transition_node);
+
+                    Node* new_node = node_construct(dict, label_start, label_end, word_start,
+                                                    transition_node, ID_PENDING, shard);
+                    add_edge(dict, transition_node, new_node);
+                    add_words(new_node, 1);
+
+                    return new_node;
+                }
+                else if (compared < edge_length){
+                    // end of the word, create a node here
+                    // 1--wv--2      ->   1--w--3--v--2
+                    
+                    Node* new_node = node_construct(dict, edge_start, i - 1, edge_w_start,
+                                                    current_node, ID_PENDING, shard);
+                    new_node->words = next_node->words;
+                    change_parent_edge(dict, next_node, i, new_node);
+                    add_edge(dict, new_node, next_node);
+                    set_child(dict, current_node, letter_number, new_node);
+                    add_words(new_node, 1);
+
+                    return new_node;
+                }
+                // just follow the edge
+                current_node = next_node;
+            }
+        }
+    }
+}
+
+
+// insert a word into the tree. Returns NULL on fail, the word's node otherwise;
+//   its id is ID_PENDING until the caller gives it one.
+//   l_end and word_start are set to -1 when inserting a new word
+//   or to indices of all_words array when using the prev command.
+Node* insert_node(Dictionary* dict, const char* word, int word_l, int label_end, int word_start){
+    init(dict); // if the tree is empty, insert will succeed, so we can use init()
+    return insert_below(dict, dict->tree, 0, 0, word, word_l, label_end, word_start);
+}
+
+
+// give the word of a node the next id. Returns the id
+int give_id(Dictionary* dict, Node* node){
+    node->id = next_id(dict);
+    dict->full_word[node->id] = node;
+    index_add(dict, node);
+    return node->id;
+}
+
+
+// insert a word into the tree. Returns -1 on fail, id otherwise
+int insert_word(Dictionary* dict, const char* word, int word_l, int label_end, int word_start){
+    Node* node = insert_node(dict, word, word_l, label_end, word_start);
+    return node == NULL ? -1 : give_id(dict, node);
+}
+
+
+// insert a new word into the tree
+int insert(Dictionary* dict, const char* word, int length){
+    write_begin(dict);
+    if (writable(dict) == -1){
+        return write_end(dict, -1);
+    }
+    return write_end(dict, compaction_step(dict, insert_word(dict, word, length, -1, -1)));
+}
+
+
+// delete the word with given id. Returns -1 on fail, id otherwise
+int delete_word(Dictionary* dict, int id){
+    if (word_node(dict, id) == NULL){
+        // word with this id does not exist
+        return -1;
+    }
+    index_remove(dict, dict->full_word[id]);
+    if (dict->batch_running == 0 && total_nodes(dict) == 2){
+        // we must delete the root, as the tree becomes empty.
+        // detele root's child from id table:
+        dict->full_word[first_child(dict->tree)->id] = NULL;
+        clear_node(dict, dict->tree);
+        SHARED_STORE(dict->tree, NULL);
+        wait_for_readers(dict);
+        release_words(dict);
+        return id;
+    }
+
+    Node* node = dict->full_word[id];
+    Node* parent = node->parent;
+    char first_letter = *text_at(&dict->all_words, node->label_start); // to delete parent's edge
+    dict->full_word[id] = NULL;
+    node->id = -1;
+    add_words(node, -1);
+
+    if (child_count(node) == 0){
+        // just delete the node and an edge from parent
+        remove_edge(dict, parent, first_letter);
+        node_destruct(dict, node);
+    }
+    else if (child_count(node) == 1){
+        // unify the node with its parent
+        union_with_parent(dict, node);
+    }
+    // if child_count(node) > 1 we just leave it as a transition node
+
+    if (parent->id == -1 && child_count(parent) < 2 && parent->parent != NULL){
+        // we might need to delete the parent or unify it with its own parent
+        Node* grandparent = parent->parent;
+        first_letter = *text_at(&dict->all_words, parent->label_start);
+        if (child_count(parent) == 0){
+            remove_edge(dict, grandparent, first_letter);
+            node_destruct(dict, parent);
+            return id;
+        }
+        union_with_parent(dict, parent);
+    }
+    return id;
+}
+
+
+// delete a word from the tree
+int delete(Dictionary* dict, int id){
+    write_begin(dict);
+    if (writable(dict) == -1){
+        return write_end(dict, -1);
+    }
+    return write_end(dict, compaction_step(dict, delete_word(dict, id)));
+}
+
+
+// instert a chosen fragment of the word with a given id. Returns -1 if
+//  a word with this id does not exist or if we can't insert the fragment
+int insert_fragment(Dictionary* dict, int id, int start, int end){
+    if (word_node(dict, id) == NULL || start > end){
+        return -1;
+    }
+
+    Node* node = dict->full_word[id];
+    if (end > (node->label_end - node->word_start)){
+        return -1;
+    }
+    int original_word_start = node->word_start;
+
+    // the fragment is compared right where it is; the text is only appended
+    //  to, so it stays in place while it's being inserted
+    int label_end = original_word_start + end;
+    int word_start = original_word_start + start;
+    if (text_is_old(dict, word_start)){
+        // a running compaction is going to free it, the fragment gets a copy
+        return insert_word(dict, text_at(&dict->all_words, word_start), end - start + 1, -1, -1);
+    }
+    return insert_word(dict, text_at(&dict->all_words, word_start), end - start + 1, label_end,
+                       word_start);
+}
+
+
+// insert every suffix of the word with a given id but the word itself,
+//  longest first. Returns -1 if a word with this id does not exist, the
+//  number of suffixes that got an id otherwise.
+//  As in McCreight's suffix tree construction, a suffix isn't looked up from
+//  the root: the letters the one before it shared with the word or an
+//  earlier suffix are in the tree without their first letter, so they're
+//  skipped edge by edge from the suffix link of a node above, and only the
+//  letters after them are compared. In a tree that holds nothing but the
+//  word's suffixes that takes time linear in the word's length. Letters a
+//  suffix shares only with other words aren't known to be in the tree for
+//  the next one, so they are compared again, and the nodes where other
+//  words branch off are skipped again: each of those adds to that time, up
+//  to quadratic in the length for a word whose suffixes are all in the
+//  tree already as other words.
+int insert_suffixes(Dictionary* dict, int id){
+    Node* node = word_node(dict, id);
+    if (node == NULL){
+        return -1;
+    }
+    int length = word_length(node);
+    int word_start = node->word_start;
+    int label_end = node->label_end;
+    if (text_is_old(dict, word_start)){
+        // a running compaction is going to free it, the suffixes refer to a copy
+        word_start = add_word(dict, node->shard, text_at(&dict->all_words, word_start), length);
+        if (word_start == -1){
+            return -1;
+        }
+        label_end = word_start + length - 1;
+    }
+    // like prev, every suffix refers to the word's text
+    const char* word = text_at(&dict->all_words, word_start);
+    SuffixLinks links;
+    links_init(&links);
+    mark_path(&links, node);
+
+    int inserted = 0;
+    Node* from = dict->tree;  // node the next suffix is looked up from
+    int known = 0;            // letters of the next suffix known to be in the tree
+    for (int start = 1; start < length; ++start){
+        const char* suffix = word + start;
+        int suffix_l = length - start;
+
+        // skip the known letters, looking only at the first one of each
+        //  edge, and link the nodes passed on the way up to from
+        Node* current = from;
+        int depth = node_depth(from);
+        while (depth < known){
+            Node* next = get_child(current, letter_number_of(suffix[depth]));
+            if (next == NULL){
+                known = depth;
+                break;
+            }
+            int next_depth = depth + next->label_end - next->label_start + 1;
+            if (next_depth > known){
+                break;
+            }
+            link_unlinked(&links, current, next_depth);
+            current = next;
+            depth = next_depth;
+        }
+        link_unlinked(&links, current, known + 1);
+
+        // compare the rest, keeping track of how far the suffix runs along
+        //  marked nodes
+        int along = known - depth;
+        int shared = known;
+        Node* shared_node = current;
+        int on_marks = 1;
+        while (depth + along < suffix_l){
+            Node* next = get_child(current, letter_number_of(suffix[depth]));
+            if (next == NULL){
+                break;
+            }
+            int label_length = next->label_end - next->label_start + 1;
+            int compared = suffix_l - depth < label_length ? suffix_l - depth : label_length;
+            STAT_ADD(insert_edges, 1);
+            STAT_ADD(insert_compared, compared - along);
+            along += mismatch(suffix + depth + along,
+                              text_at(&dict->all_words, next->label_start + along), compared - along);
+            on_marks = on_marks == 1 && next->marked != 0;
+            if (on_marks == 1){
+                shared = depth + along;
+            }
+            if (along < label_length){
+                break;
+            }
+            current = next;
+            depth += label_length;
+            along = 0;
+            if (on_marks == 1){
+                shared_node = current;
+            }
+        }
+
+        Node* added = insert_below(dict, current, depth, along, suffix, suffix_l, label_end,
+                                   word_start + start);
+        Node* end = current;
+        if (added != NULL){
+            give_id(dict, added);
+            ++inserted;
+            end = added;
+        }
+        mark_path(&links, end);
+        if (along > 0 && shared == depth + along){
+            // the edge was split where the shared letters end
+            shared_node = node_depth(end) == shared ? end : end->parent;
+        }
+
+        // the next suffix is looked up from the link of the deepest node
+        //  above the shared letters that has one; the nodes below it get
+        //  theirs on the way down
+        known = shared > 0 ? shared - 1 : 0;
+        from = dict->tree;
+        for (Node* up = shared_node; up->parent != NULL; up = up->parent){
+            Node* link = get_link(&links, up);
+            if (link != NULL){
+                from = link;
+                break;
+            }
+            add_unlinked(&links, up);
+        }
+    }
+    links_release(&links);
+    return inserted;
+}
+
+
+// insert a subword of a word from the tree with given id
+int prev(Dictionary* dict, int id, int start, int end){
+    write_begin(dict);
+    if (writable(dict) == -1){
+        return write_end(dict, -1);
+    }
+    return write_end(dict, compaction_step(dict, insert_fragment(dict, id, start, end)));
+}
+
+
+// insert the suffixes of a word from the tree with given id
+int suffixes(Dictionary* dict, int id){
+    write_begin(dict);
+    if (writable(dict) == -1){
+        return write_end(dict, -1);
+    }
+    return write_end(dict, compaction_step(dict, insert_suffixes(dict, id)));
+}
+
+
+// get the highest node whose word begins with a pattern, NULL if no word does
+Node* locate(Dictionary* dict, const char* pattern, int pattern_l){
+    int index = 0;
+    Node* node = SHARED_LOAD(dict->tree);
+    while (1){
+        // we will break the loop upon finding the pattern / reaching NULL
+        if (node == NULL || index == pattern_l){
+            return node;
+        }
+
+        int first_letter = pattern[index];
+        int letter_number = letter_number_of(first_letter);
+        Node* next_node = get_child(node, letter_number);
+        if (next_node == NULL){
+            return NULL;
+        }
+        int label_start = SHARED_LOAD(next_node->label_start);
+        int label_length = SHARED_LOAD(next_node->label_end) - label_start + 1;
+        int compared = pattern_l - index < label_length ? pattern_l - index : label_length;
+        STAT_ADD(find_edges, 1);
+        STAT_ADD(find_compared, compared);
+        const char* label = text_at(&dict->all_words, label_start);
+        if (mismatch(pattern + index, label, compared) < compared){
+            return NULL;
+        }
+        index += compared;
+        node = next_node;
+    }
+}
+
+
+// check if a pattern belongs to the tree. Returns 1 if it does, -1 otherwise
+int find_word(Dictionary* dict, const char* pattern, int pattern_l){
+    STAT_ADD(find_calls, 1);
+    if (SHARED_LOAD(dict->frozen) == 1){
+        return SHARED_LOAD(dict->compacted) == 1 ?
+               frozen_find(&dict->compact, pattern, pattern_l) :
+               snapshot_find(&dict->snapshot, pattern, pattern_l);
+    }
+    return locate(dict, pattern, pattern_l) == NULL ? -1 : 1;
+}
+
+
+// find_word for a reader that runs alongside the writer: repeat it until
+//  no modification overlapped with it
+int find_concurrent(Dictionary* dict, const char* pattern, int pattern_l){
+    while (1){
+        epoch_enter(dict->epochs);
+        unsigned int sequence = atomic_load_explicit(&dict->write_sequence, memory_order_acquire);
+        int result = -1;
+        int valid = 0;
+        if ((sequence & 1) == 0){
+            result = find_word(dict, pattern, pattern_l);
+            atomic_thread_fence(memory_order_acquire);
+            valid = atomic_load_explicit(&dict->write_sequence, memory_order_relaxed) == sequence;
+        }
+        // never wait for the writer inside the epoch, it may be waiting for us
+        epoch_exit(dict->epochs);
+        if (valid == 1){
+            return result;
+        }
+        if ((sequence & 1) == 1){
+            sched_yield();
+        }
+    }
+}
+
+
+// check if any word in the tree has got a given prefix
+int find(Dictionary* dict, const char* pattern, int pattern_l){
+    if (dict->concurrent == 1){
+        return find_concurrent(dict, pattern, pattern_l);
+    }
+    return find_word(dict, pattern, pattern_l);
+}
+
+
+// id of a whole word, -1 if it isn't in the tree
+int lookup(Dictionary* dict, const char* word, int length){
+    if (dict->frozen == 1){
+        return dict->compacted == 1 ? frozen_lookup(&dict->compact, word, length) :
+                                      snapshot_lookup(&dict->snapshot, word, length);
+    }
+    if (dict->tree == NULL){
+        return -1;
+    }
+    if (dict->word_index.ready == 0 && index_build(dict) == -1){
+        // no memory for the index, the word is looked for in the tree
+        Node* node = locate(dict, word, length);
+        return node != NULL && word_length(node) == length ? node->id : -1;
+    }
+    return index_find(dict, word, length);
+}
+
+
+// count the words that begin with a prefix
+int count_prefix(Dictionary* dict, const char* prefix, int length){
+    if (dict->frozen == 1){
+        return dict->compacted == 1 ? frozen_count(&dict->compact, prefix, length) :
+                                      snapshot_count(&dict->snapshot, prefix, length);
+    }
+    Node* node = locate(dict, prefix, length);
+    return node == NULL ? 0 : node->words;
+}
+
+
+// check if any word in the tree has a prefix within edit distance k of a
+//  pattern. Returns 1 if one has, -1 otherwise
+int fuzzy_find(Dictionary* dict, const char* pattern, int length, int k){
+    if (dict->frozen == 1){
+        return dict->compacted == 1 ? frozen_fuzzy_find(&dict->compact, pattern, length, k) :
+                                      snapshot_fuzzy_find(&dict->snapshot, pattern, length, k);
+    }
+    if (dict->tree == NULL || dict->tree->children == NULL){
+        return -1;
+    }
+    FuzzyRows rows;
+    if (length <= k || fuzzy_init(&rows, pattern, length, k) == -1){
+        // a short pattern is within k of the empty prefix
+        return length <= k ? 1 : -1;
+    }
+
+    // depth-first, so the rows of a node's path are still there for its
+    //  children; the stack holds nodes still to visit and the length of
+    //  their parents' words
+    int stack_capacity = 64;
+    Node** stack_node = malloc(stack_capacity * sizeof(Node*));
+    int* stack_depth = malloc(stack_capacity * sizeof(int));
+    stack_node[0] = dict->tree;
+    stack_depth[0] = 0;
+    int stack_size = 1;
+    int state = FUZZY_ALIVE;
+    while (stack_size > 0 && state != FUZZY_FOUND){
+        --stack_size;
+        Node* node = stack_node[stack_size];
+        int depth = stack_depth[stack_size];
+        state = FUZZY_ALIVE;
+        if (node->parent != NULL){
+            int label_length = node->label_end - node->label_start + 1;
+            state = fuzzy_label(&rows, depth, text_at(&dict->all_words, node->label_start),
+                                label_length);
+            depth += label_length;
+        }
+        if (state != FUZZY_ALIVE || node->children == NULL){
+            continue;
+        }
+        const LetterSet* bitmap = &node->children->bitmap;
+        while (stack_size + letters_count(bitmap) > stack_capacity){
+            stack_capacity *= 2;
+            stack_node = realloc(stack_node, stack_capacity * sizeof(Node*));
+            stack_depth = realloc(stack_depth, stack_capacity * sizeof(int));
+        }
+        for (int x = letters_first(bitmap); x != -1; x = letters_next(bitmap, x + 1)){
+            stack_node[stack_size] = get_child(node, x);
+            stack_depth[stack_size] = depth;
+            ++stack_size;
+        }
+        // the child that continues the pattern is visited first
+        int next = fuzzy_next_letter(&rows, depth);
+        if (next != -1 && letters_has(bitmap, next)){
+            int first = stack_size - letters_count(bitmap) + letters_rank(bitmap, next);
+            Node* swapped = stack_node[first];
+            stack_node[first] = stack_node[stack_size - 1];
+            stack_node[stack_size - 1] = swapped;
+        }
+    }
+    free(stack_node);
+    free(stack_depth);
+    fuzzy_release(&rows);
+    return state == FUZZY_FOUND ? 1 : -1;
+}
+
+
+// pass at most limit words that begin with a prefix to emit, in
+//  lexicographic order. Returns the number of words passed
+int list_prefix(Dictionary* dict, const char* prefix, int length, int limit,
+                void (*emit)(const char* word, int length, void* context), void* context){
+    if (dict->frozen == 1 && dict->compacted == 1){
+        return frozen_list(&dict->compact, prefix, length, limit, emit, context);
+    }
+    if (dict->frozen == 1){
+        return snapshot_list(&dict->snapshot, prefix, length, limit, emit, context);
+    }
+    Node* top = locate(dict, prefix, length);
+    int listed = 0;
+    // a node's word is the prefix of its children's words, so it comes first
+    for (Node* node = top; node != NULL && listed < limit; node = next_in_order(dict, node, top)){
+        if (node->id != -1){
+            emit(text_at(&dict->all_words, node->word_start),
+                 node->label_end - node->word_start + 1, context);
+            ++listed;
+        }
+    }
+    return listed;
+}
+
+
+// clear the whole tree
+void clear(Dictionary* dict){
+    write_begin(dict);
+    clear_tree(dict);
+    write_end(dict, 0);
+}
+
+
+// save the tree to a snapshot file. Returns -1 on fail, 1 otherwise
+int save(Dictionary* dict, const char* path){
+    if (dict->frozen == 1 && dict->compacted == 0){
+        return snapshot_write(&dict->snapshot, path);
+    }
+    Snapshot built;
+    int status = dict->frozen == 1 ? frozen_snapshot(&dict->compact, &built)
+                                   : build_snapshot(dict, &built);
+    if (status == -1){
+        return -1;
+    }
+    int result = snapshot_write(&built, path);
+    snapshot_release(&built);
+    return result;
+}
+
+
+// replace the tree with one loaded from a snapshot file. Returns -1 on fail
+//  (the tree is left as it was), 1 otherwise
+int load(Dictionary* dict, const char* path){
+    Snapshot loaded;
+    if (snapshot_map(&loaded, path) == -1){
+        return -1;
+    }
+    write_begin(dict);
+    clear_tree(dict);
+    dict->snapshot = loaded;
+    publish(dict);
+    SHARED_STORE(dict->frozen, 1);
+    return write_end(dict, 1);
+}
+
+
+// insert the words of a file with one word per line. Returns -1 on fail,
+//  the number of words that got an id otherwise
+int bulkload(Dictionary* dict, const char* path){
+    WordList list;
+    if (word_list_read(&list, path) == -1){
+        return -1;
+    }
+    write_begin(dict);
+    if (writable(dict) == -1){
+        word_list_release(&list);
+        return write_end(dict, -1);
+    }
+    int result = 0;
+    if (dict->tree == NULL){
+        result = build_sorted(dict, &list) == -1 ? -1 : list.count;
+    }
+    else{
+        // the words have to find their places among the ones already there
+        for (int i = 0; i < list.line_count; ++i){
+            if (insert_word(dict, list.data + list.starts[i], list.lengths[i], -1, -1) != -1){
+                ++result;
+            }
+        }
+    }
+    word_list_release(&list);
+    return write_end(dict, compaction_step(dict, result));
+}
+
+
+// replace the tree with a snapshot of itself: read-only, more compact, and
+//  served without following pointers. Returns -1 on fail (the tree is left
+//  as it was), 1 otherwise
+int freeze(Dictionary* dict){
+    if (dict->compacted == 1){
+        return 1;
+    }
+    // the level order is taken from a snapshot of the tree, or the loaded one
+    Snapshot built;
+    FrozenTrie result;
+    if (dict->frozen == 1){
+        if (frozen_build(&result, &dict->snapshot) == -1){
+            return -1;
+        }
+    }
+    else{
+        if (build_snapshot(dict, &built) == -1){
+            return -1;
+        }
+        int built_compact = frozen_build(&result, &built);
+        snapshot_release(&built);
+        if (built_compact == -1){
+            return -1;
+        }
+    }
+    write_begin(dict);
+    clear_tree(dict);
+    // the frozen tree has its own ids; thaw makes a new table
+    free(dict->full_word);
+    dict->full_word = NULL;
+    dict->full_word_capacity = 0;
+    dict->compact = result;
+    SHARED_STORE(dict->compacted, 1);
+    publish(dict);
+    SHARED_STORE(dict->frozen, 1);
+    return write_end(dict, 1);
+}
+
+
+// make a frozen tree modifiable again. Returns -1 on fail, 1 otherwise
+int thaw(Dictionary* dict){
+    if (dict->frozen == 0){
+        return 1;
+    }
+    write_begin(dict);
+    thaw_tree(dict);
+    return write_end(dict, 1);
+}
+
+
+// if enabled == 1, modifications of a frozen tree thaw it first, otherwise
+//  they fail
+void set_thaw_on_write(Dictionary* dict, int enabled){
+    dict->thaw_on_write = enabled;
+}
+
+
+int is_frozen(Dictionary* dict){
+    return dict->frozen;
+}
+
+
+// copy the text the nodes refer to into new chunks and free the old ones.
+//  Returns -1 if the tree is frozen or read concurrently, the number of
+//  characters of text left otherwise
+int compact(Dictionary* dict){
+    if (dict->tree == NULL && dict->frozen == 0){
+        return 0;
+    }
+    write_begin(dict);
+    if (compaction_start(dict) == -1){
+        return write_end(dict, -1);
+    }
+    while (compaction_slice(dict) == 1);
+    return write_end(dict, text_used(dict));
+}
+
+
+// run a slice of the compaction that's going on, or of a new one. Returns
+//  -1 if there's nothing to compact, 0 if the compaction is over, 1 if it
+//  goes on
+int compact_step(Dictionary* dict){
+    write_begin(dict);
+    if (compaction_start(dict) == -1){
+        return write_end(dict, -1);
+    }
+    return write_end(dict, compaction_slice(dict));
+}
+
+
+// start compactions by themselves once the text is a given number of times
+//  as much as they would leave, never if it's 0
+void set_compact_ratio(Dictionary* dict, int ratio){
+    dict->compaction.ratio = ratio;
+}
+
+
+// allow find to run in other threads while this one modifies the tree
+int set_concurrent(Dictionary* dict, int enabled){
+    if (enabled == 1 && dict->sharded == 1){
+        // shards are changed by several writers, readers couldn't tell
+        return -1;
+    }
+    if (enabled == 1 && dict->concurrent == 0){
+        // readers could see a node half moved, its compaction ends first
+        while (dict->compaction.running == 1 && compaction_slice(dict) == 1);
+        if (dict->epochs == NULL){
+            dict->epochs = malloc(sizeof(EpochDomain));
+            epoch_init(dict->epochs);
+        }
+        dict->concurrent = 1;
+    }
+    else if (enabled == 0 && dict->concurrent == 1){
+        // whatever waits for readers can be reused right away from now on
+        epoch_synchronize(dict->epochs);
+        dict->concurrent = 0;
+    }
+    return 1;
+}
+
+
+// run an operation of the batch on the shard it belongs to
+void run_operation(Dictionary* dict, int index, int shard){
+    TrieOperation* operation = &dict->batch.operations[index];
+    int before = dict->shards[shard].node_count;
+    switch (operation->type){
+    case TRIE_INSERT:
+        dict->batch.nodes[index] = insert_node(dict, operation->word, operation->length, -1, -1);
+        operation->result = dict->batch.nodes[index] == NULL ? -1 : ID_PENDING;
+        break;
+    case TRIE_DELETE:
+        operation->result = delete_word(dict, operation->id);
+        break;
+    default:
+        operation->result = find_word(dict, operation->word, operation->length);
+        break;
+    }
+    dict->batch.node_change[index] = dict->shards[shard].node_count - before;
+}
+
+
+// take shards of the current batch and run their operations until none is left
+void run_shards(Dictionary* dict){
+    int done = 0;
+    while (1){
+        int shard = atomic_fetch_add(&dict->batch.next_shard, 1);
+        if (shard >= SHARD_COUNT){
+            break;
+        }
+        pthread_mutex_lock(&dict->shards[shard].lock);
+        for (int i = dict->batch.start[shard]; i < dict->batch.start[shard + 1]; ++i){
+            run_operation(dict, dict->batch.order[i], shard);
+        }
+        pthread_mutex_unlock(&dict->shards[shard].lock);
+        ++done;
+    }
+    pthread_mutex_lock(&dict->batch_lock);
+    dict->batch.finished += done;
+    if (dict->batch.finished == SHARD_COUNT){
+        pthread_cond_signal(&dict->batch_finished);
+    }
+    pthread_mutex_unlock(&dict->batch_lock);
+}
+
+
+// a thread of the worker pool of a dictionary: help with every batch that's
+//  started until the dictionary is destroyed
+void* shard_worker(void* argument){
+    Dictionary* dict = argument;
+    long seen = 0;
+    while (1){
+        pthread_mutex_lock(&dict->batch_lock);
+        while (dict->batch.generation == seen && dict->batch.stopping == 0){
+            pthread_cond_wait(&dict->batch_started, &dict->batch_lock);
+        }
+        if (dict->batch.stopping == 1){
+            pthread_mutex_unlock(&dict->batch_lock);
+            return NULL;
+        }
+        seen = dict->batch.generation;
+        pthread_mutex_unlock(&dict->batch_lock);
+        run_shards(dict);
+    }
+}
+
+
+// shard an operation of a batch belongs to, -1 if it fails without running
+int operation_shard(Dictionary* dict, TrieOperation* operation){
+    if (operation->type != TRIE_DELETE){
+        return shard_for(dict, dict->tree, letter_number_of(operation->word[0]));
+    }
+    Node* node = word_node(dict, operation->id);
+    if (node == NULL){
+        operation->result = -1;
+        return -1;
+    }
+    return node->shard;
+}
+
+
+// run the operations one by one
+void run_in_order(Dictionary* dict, TrieOperation* operations, int count){
+    for (int i = 0; i < count; ++i){
+        switch (operations[i].type){
+        case TRIE_INSERT:
+            operations[i].result = insert(dict, operations[i].word, operations[i].length);
+            break;
+        case TRIE_DELETE:
+            operations[i].result = delete(dict, operations[i].id);
+            break;
+        default:
+            operations[i].result = find(dict, operations[i].word, operations[i].length);
+            break;
+        }
+        operations[i].nodes = get_node_count(dict);
+    }
+}
+
+
+// run operations on the shards in parallel, up to the first delete of an id
+//  that's only given out by them. Returns the number of operations run
+int run_shard_batch(Dictionary* dict, TrieOperation* operations, int count){
+    int end = 1;
+    while (end < count
+           && (operations[end].type != TRIE_DELETE || operations[end].id < dict->current_id)){
+        ++end;
+    }
+    if (end < PARALLEL_MINIMUM){
+        // waking the workers would take longer than the operations
+        run_in_order(dict, operations, end);
+        return end;
+    }
+    if (end > dict->batch.capacity){
+        dict->batch.capacity = end;
+        dict->batch.order = realloc(dict->batch.order, end * sizeof(int));
+        dict->batch.shard_of = realloc(dict->batch.shard_of, end * sizeof(int));
+        dict->batch.nodes = realloc(dict->batch.nodes, end * sizeof(Node*));
+        dict->batch.node_change = realloc(dict->batch.node_change, end * sizeof(int));
+    }
+
+    // every shard writes its own slot of the root's children, they must exist
+    init(dict);
+    if (dict->tree->children == NULL){
+        dict->tree->children = children_construct(dict, dict->tree, NODE_DIRECT);
+    }
+    int* shard_of = dict->batch.shard_of;
+    memset(dict->batch.start, 0, sizeof(dict->batch.start));
+    for (int i = 0; i < end; ++i){
+        shard_of[i] = operation_shard(dict, &operations[i]);
+        dict->batch.nodes[i] = NULL;
+        dict->batch.node_change[i] = 0;
+        if (shard_of[i] != -1){
+            ++dict->batch.start[shard_of[i] + 1];
+        }
+    }
+    for (int x = 0; x < SHARD_COUNT; ++x){
+        dict->batch.start[x + 1] += dict->batch.start[x];
+    }
+    int position[SHARD_COUNT];
+    memcpy(position, dict->batch.start, sizeof(position));
+    for (int i = 0; i < end; ++i){
+        if (shard_of[i] != -1){
+            dict->batch.order[position[shard_of[i]]++] = i;
+        }
+    }
+
+    int nodes = total_nodes(dict);
+    dict->batch.operations = operations;
+    dict->batch_running = 1;
+    atomic_store(&dict->batch.next_shard, 0);
+    dict->batch.finished = 0;
+    pthread_mutex_lock(&dict->batch_lock);
+    ++dict->batch.generation;
+    pthread_cond_broadcast(&dict->batch_started);
+    pthread_mutex_unlock(&dict->batch_lock);
+    run_shards(dict);
+    pthread_mutex_lock(&dict->batch_lock);
+    while (dict->batch.finished < SHARD_COUNT){
+        pthread_cond_wait(&dict->batch_finished, &dict->batch_lock);
+    }
+    pthread_mutex_unlock(&dict->batch_lock);
+    dict->batch_running = 0;
+
+    // ids and node counts as if the operations had run one by one; a root
+    //  without children stands for an empty tree
+    for (int i = 0; i < end; ++i){
+        if (dict->batch.nodes[i] != NULL){
+            operations[i].result = give_id(dict, dict->batch.nodes[i]);
+        }
+        nodes += dict->batch.node_change[i];
+        operations[i].nodes = nodes == 1 ? 0 : nodes;
+    }
+    if (total_nodes(dict) == 1){
+        clear_node(dict, dict->tree);
+        dict->tree = NULL;
+        release_words(dict);
+    }
+    return compaction_step(dict, end);
+}
+
+
+// run operations as if they were called one by one
+void run_batch(Dictionary* dict, TrieOperation* operations, int count){
+    if (dict->sharded == 0 || dict->frozen == 1){
+        // the first insert or delete thaws a frozen tree, the next batch runs on shards
+        run_in_order(dict, operations, count);
+        return;
+    }
+    for (int done = 0; done < count; ){
+        done += run_shard_batch(dict, operations + done, count - done);
+    }
+}
+
+
+// spread the tree over shards, run batches with a given number of threads
+int set_sharded(Dictionary* dict, int workers){
+    if (dict->workers != NULL || dict->concurrent == 1 || (dict->tree != NULL && dict->frozen == 0)
+        || workers < 1){
+        return -1;
+    }
+    // the calling thread is one of the workers
+    dict->workers = malloc((workers - 1) * sizeof(pthread_t) + 1);
+    if (dict->workers == NULL){
+        return -1;
+    }
+    for (int i = 1; i < workers; ++i){
+        if (pthread_create(&dict->workers[dict->worker_count], NULL, shard_worker, dict) != 0){
+            return -1;
+        }
+        ++dict->worker_count;
+    }
+    // there's one shard for all nodes until now
+    release_shards(dict);
+    dict->sharded = 1;
+    return 1;
+}
+
+
+// compare two [start, end] ranges of text by their starts
+int compare_ranges(const void* a, const void* b){
+    int x = ((const int*)a)[0];
+    int y = ((const int*)b)[0];
+    return (x > y) - (x < y);
+}
+
+
+// write how much memory the tree uses
+void write_memory_stats(Dictionary* dict, StatsText* report){
+    if (dict->frozen == 1 && dict->compacted == 1){
+        stats_printf(report, "memory frozen=1 compact=1 nodes=%u node_bytes=%zu label_bytes=%zu "
+                     "ids=%u id_table_bytes=%zu\n",
+                     dict->compact.node_count, frozen_node_bytes(&dict->compact),
+                     frozen_label_bytes(&dict->compact),
+                     dict->compact.id_count, frozen_id_bytes(&dict->compact));
+        return;
+    }
+    if (dict->frozen == 1){
+        const SnapshotHeader* header = dict->snapshot.header;
+        stats_printf(report, "memory frozen=1 nodes=%u node_bytes=%zu label_bytes=%u ids=%u "
+                     "id_table_bytes=%zu snapshot_bytes=%llu\n",
+                     header->node_count, (header->node_count + 1) * sizeof(SnapshotNode),
+                     header->label_bytes, header->id_count, header->id_count * sizeof(uint32_t),
+                     (unsigned long long)header->size);
+        return;
+    }
+
+    // the text of every node's word; anything no range covers is dead
+    long children_bytes = 0;
+    long text_live = 0;
+    int range_count = 0;
+    int node_count = total_nodes(dict);
+    int* ranges = malloc(2 * (size_t)node_count * sizeof(int) + 1);
+    Node** stack = malloc((size_t)node_count * sizeof(Node*) + 1);
+    int stack_size = 0;
+    if (dict->tree != NULL && ranges != NULL && stack != NULL){
+        stack[stack_size++] = dict->tree;
+    }
+    while (stack_size > 0){
+        Node* node = stack[--stack_size];
+        if (node->parent != NULL){
+            ranges[2 * range_count] = node->word_start;
+            ranges[2 * range_count + 1] = node->label_end;
+            ++range_count;
+        }
+        if (node->children != NULL){
+            children_bytes += sizeof(Children) + node->children->capacity * sizeof(Node*);
+            const LetterSet* bitmap = &node->children->bitmap;
+            for (int x = letters_first(bitmap); x != -1; x = letters_next(bitmap, x + 1)){
+                stack[stack_size++] = get_child(node, x);
+            }
+        }
+    }
+    if (range_count > 0){
+        qsort(ranges, range_count, 2 * sizeof(int), compare_ranges);
+        int start = ranges[0];
+        int end = ranges[1];
+        for (int i = 1; i < range_count; ++i){
+            if (ranges[2 * i] > end + 1){
+                text_live += end - start + 1;
+                start = ranges[2 * i];
+                end = ranges[2 * i + 1];
+            }
+            else if (ranges[2 * i + 1] > end){
+                end = ranges[2 * i + 1];
+            }
+        }
+        text_live += end - start + 1;
+    }
+    free(ranges);
+    free(stack);
+    long used = text_used(dict);
+
+    stats_printf(report, "memory frozen=0 nodes=%d node_bytes=%zu children_bytes=%ld "
+                 "text_bytes=%ld text_used=%ld text_dead=%ld compacting=%d label_bytes=%d "
+                 "ids=%d id_table_bytes=%zu index_bytes=%zu\n",
+                 node_count, node_count * sizeof(Node), children_bytes,
+                 atomic_load(&dict->all_words.allocated), used,
+                 used - text_live, dict->compaction.running, total_label_bytes(dict),
+                 dict->current_id, dict->full_word_capacity * sizeof(Node*),
+                 dict->word_index.slots == NULL ? 0
+                                                : (dict->word_index.mask + 1) * sizeof(IndexSlot));
 }
 
 
 // returns the number of nodes
-int get_node_count(){
-    return node_count;
+int get_node_count(Dictionary* dict){
+    if (dict->frozen == 1){
+        return dict->compacted == 1 ? dict->compact.node_count : dict->snapshot.header->node_count;
+    }
+    return total_nodes(dict);
 }
@@ -1,19 +1,142 @@
 #pragma once
 
-// insert a word into the global tree
-int insert(char* word);
+#include "stats.h"
+
+/* DICTIONARY - a tree of words with everything kept for it. Every function
+   below works on the dictionary it's given; different dictionaries may be
+   used from different threads at the same time. Only the statistics are
+   kept for all of them together.
+*/
+typedef struct Dictionary Dictionary;
+
+// create an empty dictionary. Returns NULL on fail
+Dictionary* dictionary_create();
+
+// stop the dictionary's workers and free everything it holds
+void dictionary_destroy(Dictionary* dict);
+
+// insert a word of a given length into the tree
+int insert(Dictionary* dict, const char* word, int length);
 
 // insert a subword of a word from the tree with given id
-int prev(int id, int start, int end);
+int prev(Dictionary* dict, int id, int start, int end);
+
+// insert every suffix of the word with a given id, but the word itself,
+//  longest first; they refer to the word's text like the words of prev.
+//  Returns -1 if there is no such word, the number of suffixes that were
+//  new to the tree otherwise
+int suffixes(Dictionary* dict, int id);
 
 // delete a word from the tree
-int delete(int id);
+int delete(Dictionary* dict, int id);
 
 // check if any wordin the tree has got a given prefix
-int find(char* pattern);
+int find(Dictionary* dict, const char* pattern, int length);
+
+// check if any word in the tree has a prefix within edit distance k of a
+//  pattern (insertions, deletions and substitutions of letters). The tree
+//  is walked once, leaving out subtrees that can't be within k
+int fuzzy_find(Dictionary* dict, const char* pattern, int length, int k);
+
+// get the id of a word in the tree, -1 if it isn't there. Unlike find,
+//  only the whole word matches. A hash index of the words is built by the
+//  first call and kept up to date by insert, prev and delete afterwards
+int lookup(Dictionary* dict, const char* word, int length);
+
+// count the words in the tree that begin with a prefix
+int count_prefix(Dictionary* dict, const char* prefix, int length);
+
+// pass at most limit words that begin with a prefix to emit, in
+//  lexicographic order. Returns the number of words passed
+int list_prefix(Dictionary* dict, const char* prefix, int length, int limit,
+                void (*emit)(const char* word, int length, void* context), void* context);
 
 // clear the tree
-void clear();
+void clear(Dictionary* dict);
+
+// save the tree to a snapshot file
+int save(Dictionary* dict, const char* path);
+
+// replace the tree with one from a snapshot file; it's mapped and used as it
+//  is until the first modification
+int load(Dictionary* dict, const char* path);
+
+// replace the tree with a compact read-only copy; find, count, list and
+//  save keep working on it. Returns -1 on fail, 1 otherwise
+int freeze(Dictionary* dict);
+
+// make the tree modifiable again after freeze or load. Returns 1
+int thaw(Dictionary* dict);
+
+// if enabled == 1 (the default), insert, prev, delete and bulkload on a
+//  frozen tree thaw it first; otherwise they fail and it stays frozen
+void set_thaw_on_write(Dictionary* dict, int enabled);
+
+// 1 if the tree is frozen, by freeze or load, 0 otherwise
+int is_frozen(Dictionary* dict);
+
+// insert the words of a file with one word per line. An empty tree is built
+//  from the sorted words at once; the words get ids in the order of the file,
+//  like with insert. Returns -1 on fail, the number of words that got an id
+//  otherwise
+int bulkload(Dictionary* dict, const char* path);
+
+// copy the text of the words into new memory, leaving out the text of
+//  deleted words, and free the old text. Compactions also start by
+//  themselves and run a slice after each modification, see
+//  set_compact_ratio. Returns -1 if the tree is frozen or find runs
+//  concurrently, the number of characters of text left otherwise
+int compact(Dictionary* dict);
+
+// run a slice of the compaction that's going on, or start one. Returns -1 if
+//  there is nothing to compact, 0 if the compaction is over, 1 if it goes on
+int compact_step(Dictionary* dict);
+
+#define COMPACT_RATIO 2  // ratio of a new dictionary
+
+// start a compaction by itself once the text of the words takes ratio times
+//  as much as it would after one, never if ratio is 0
+void set_compact_ratio(Dictionary* dict, int ratio);
+
+// if enabled == 1, find may be called from any number of threads while one
+//  thread calls the other functions; readers never block the writer.
+//  Returns -1 if the tree is sharded
+int set_concurrent(Dictionary* dict, int enabled);
+
+typedef enum{
+    TRIE_INSERT,
+    TRIE_DELETE,
+    TRIE_FIND
+} trie_operation;
+
+/* TRIE OPERATION - an insert, delete or find for run_batch.
+     word, length - the word of an insert or find.
+     id - the id of a delete.
+     result - set to what insert, delete or find returns.
+     nodes - set to what get_node_count returns right after the operation.
+*/
+typedef struct{
+    trie_operation type;
+    const char* word;
+    int length;
+    int id;
+    int result;
+    int nodes;
+} TrieOperation;
+
+// run operations with the same results as if they were called one by one.
+//  In sharded mode, operations on words with different first letters run
+//  in parallel and words get their ids in the order of the operations
+void run_batch(Dictionary* dict, TrieOperation* operations, int count);
+
+// spread the tree over one shard per first letter; run_batch then uses a
+//  given number of threads, the calling one included. Returns -1 if the
+//  tree isn't empty or frozen, or find runs concurrently
+int set_sharded(Dictionary* dict, int workers);
+
+// write how much memory the tree uses: nodes, children, the text of the
+//  words with the part no node refers to anymore, and the id table
+void write_memory_stats(Dictionary* dict, StatsText* report);
 
 // get the number of nodes in the tree
-int get_node_count();
\ No newline at end of file
+int get_node_count(Dictionary* dict);
\ No newline at end of file
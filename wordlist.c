@@ -0,0 +1,270 @@
+#define _GNU_SOURCE  // qsort_r
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "wordlist.h"
+#include "mismatch.h"
+#include "alphabet.h"
+
+
+// find the word on a line ending before end, -1 if the line isn't a word line
+static int line_word(const char* line, const char* end, int* length){
+    const char* word = line;
+    while (word < end && *word == ' '){
+        ++word;
+    }
+    const char* rest = word;
+    while (rest < end && is_letter(*rest)){
+        ++rest;
+    }
+    *length = rest - word;
+    while (rest < end && *rest == ' '){
+        ++rest;
+    }
+    if (*length == 0 || rest != end){
+        return -1;
+    }
+    return word - line;
+}
+
+
+// a word line with a number made of its first characters, for sorting
+typedef struct{
+    uint64_t key;
+    int line;
+} SortKey;
+
+
+// lexicographic order of two word lines; equal words by their place in the file
+static int compare_lines(const void* a, const void* b, void* list_pointer){
+    const WordList* list = list_pointer;
+    int x = *(const int*)a;
+    int y = *(const int*)b;
+    int length = list->lengths[x] < list->lengths[y] ? list->lengths[x] : list->lengths[y];
+    int result = memcmp(list->data + list->starts[x], list->data + list->starts[y], length);
+    if (result == 0){
+        result = list->lengths[x] != list->lengths[y] ?
+                 list->lengths[x] - list->lengths[y] : x - y;
+    }
+    return result;
+}
+
+
+// the first 8 characters of a word line as a number that compares like them
+static uint64_t line_key(const WordList* list, int x){
+    const char* word = list->data + list->starts[x];
+    int length = list->lengths[x] < 8 ? list->lengths[x] : 8;
+    uint64_t key = 0;
+    for (int i = 0; i < 8; ++i){
+        key = key << 8 | (i < length ? (unsigned char)word[i] : 0);
+    }
+    return key;
+}
+
+
+// sort the word lines: a stable radix sort by their first 8 characters, then
+//  the lines that share them are compared as a whole. Returns -1 on fail
+static int sort_lines(WordList* list){
+    int count = list->line_count;
+    SortKey* keys = malloc((count + 1) * sizeof(SortKey));
+    SortKey* other = malloc((count + 1) * sizeof(SortKey));
+    if (keys == NULL || other == NULL){
+        free(keys);
+        free(other);
+        return -1;
+    }
+    for (int i = 0; i < count; ++i){
+        keys[i].key = line_key(list, i);
+        keys[i].line = i;
+    }
+    for (int shift = 0; shift < 64; shift += 8){
+        int start[257] = {0};
+        for (int i = 0; i < count; ++i){
+            ++start[(keys[i].key >> shift & 255) + 1];
+        }
+        if (start[(keys[0].key >> shift & 255) + 1] == count){
+            // every key has the same byte here
+            continue;
+        }
+        for (int x = 0; x < 256; ++x){
+            start[x + 1] += start[x];
+        }
+        for (int i = 0; i < count; ++i){
+            other[start[keys[i].key >> shift & 255]++] = keys[i];
+        }
+        SortKey* swap = keys;
+        keys = other;
+        other = swap;
+    }
+
+    for (int i = 0; i < count; ){
+        int end = i + 1;
+        while (end < count && keys[end].key == keys[i].key){
+            ++end;
+        }
+        for (int x = i; x < end; ++x){
+            list->sorted[x] = keys[x].line;
+        }
+        if (end - i > 1 && (keys[i].key & 255) != 0){
+            // all of them are at least 8 characters long and may differ later
+            qsort_r(list->sorted + i, end - i, sizeof(int), compare_lines, list);
+        }
+        i = end;
+    }
+    free(keys);
+    free(other);
+    return 1;
+}
+
+
+int word_list_read(WordList* list, const char* path){
+    memset(list, 0, sizeof(WordList));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0){
+        return -1;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0){
+        close(fd);
+        return -1;
+    }
+    list->size = info.st_size;
+    if (list->size > 0){
+        void* block = mmap(NULL, list->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (block == MAP_FAILED){
+            close(fd);
+            return -1;
+        }
+        madvise(block, list->size, MADV_SEQUENTIAL);
+        list->data = block;
+    }
+    close(fd);
+
+    // every line but the last one ends with '\n'
+    int capacity = 1;
+    const char* endline = list->data;
+    while (list->size > 0 && (endline = memchr(endline, '\n', list->data + list->size - endline)) != NULL){
+        ++capacity;
+        ++endline;
+    }
+    list->starts = malloc(capacity * sizeof(long));
+    list->lengths = malloc(capacity * sizeof(int));
+    list->sorted = malloc(capacity * sizeof(int));
+    list->common = malloc(capacity * sizeof(int));
+    list->ranks = malloc(capacity * sizeof(int));
+    if (list->starts == NULL || list->lengths == NULL || list->sorted == NULL ||
+        list->common == NULL || list->ranks == NULL){
+        word_list_release(list);
+        return -1;
+    }
+
+    int in_order = 1;
+    for (long position = 0; position < list->size; ){
+        const char* line = list->data + position;
+        const char* end = memchr(line, '\n', list->size - position);
+        if (end == NULL){
+            end = list->data + list->size;
+        }
+        int length;
+        int offset = line_word(line, end, &length);
+        if (offset != -1){
+            int x = list->line_count++;
+            list->starts[x] = position + offset;
+            list->lengths[x] = length;
+            list->sorted[x] = x;
+            if (x > 0 && in_order == 1 && compare_lines(&list->sorted[x - 1], &list->sorted[x], list) > 0){
+                in_order = 0;
+            }
+        }
+        position = end - list->data + 1;
+    }
+    if (in_order == 0 && sort_lines(list) == -1){
+        word_list_release(list);
+        return -1;
+    }
+
+    // words in lexicographic order, next to each other, so the tree is built
+    //  without jumping around the file
+    list->word_starts = malloc(capacity * sizeof(long));
+    list->word_lengths = malloc(capacity * sizeof(int));
+    int* kept = calloc(capacity, sizeof(int));
+    if (list->word_starts == NULL || list->word_lengths == NULL || kept == NULL){
+        free(kept);
+        word_list_release(list);
+        return -1;
+    }
+    list->text = list->data;
+    if (in_order == 0){
+        long total = 0;
+        for (int i = 0; i < list->line_count; ++i){
+            total += list->lengths[i];
+        }
+        list->copy = malloc(total + 1);
+        if (list->copy == NULL){
+            free(kept);
+            word_list_release(list);
+            return -1;
+        }
+        list->text = list->copy;
+    }
+    long used = 0;
+
+    // keep the first of every run of equal words
+    for (int i = 0; i < list->line_count; ++i){
+        int line = list->sorted[i];
+        int length = list->lengths[line];
+        long start = list->starts[line];
+        if (in_order == 0){
+            memcpy(list->copy + used, list->data + start, length);
+            start = used;
+            used += length;
+        }
+        int common = 0;
+        if (list->count > 0){
+            int previous = list->word_lengths[list->count - 1];
+            common = mismatch(list->text + list->word_starts[list->count - 1], list->text + start,
+                              previous < length ? previous : length);
+            if (common == previous && common == length){
+                continue;
+            }
+        }
+        kept[line] = 1;
+        list->sorted[list->count] = line;
+        list->word_starts[list->count] = start;
+        list->word_lengths[list->count] = length;
+        list->common[list->count] = common;
+        ++list->count;
+    }
+    // a word's rank is the number of lines kept before its line
+    int rank = 0;
+    for (int i = 0; i < list->line_count; ++i){
+        int first = kept[i];
+        kept[i] = rank;
+        rank += first;
+    }
+    for (int i = 0; i < list->count; ++i){
+        list->ranks[i] = kept[list->sorted[i]];
+    }
+    free(kept);
+    return 1;
+}
+
+
+void word_list_release(WordList* list){
+    if (list->data != NULL){
+        munmap((void*)list->data, list->size);
+    }
+    free(list->copy);
+    free(list->starts);
+    free(list->lengths);
+    free(list->word_starts);
+    free(list->word_lengths);
+    free(list->sorted);
+    free(list->common);
+    free(list->ranks);
+    memset(list, 0, sizeof(WordList));
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+/* WORD LIST - words of a file with one word per line, for building a tree
+   bottom-up. A word line may be surrounded by spaces; other lines are
+   skipped, like commands that would be ignored.
+     data, size - the mapped file.
+     line_count - number of word lines.
+     starts[x], lengths[x] - offset in data and length of the word on the
+                             x-th word line.
+     count - number of distinct words.
+     text - characters of the distinct words: the file itself if its words
+            are sorted already, or copy, holding them in lexicographic order.
+     word_starts[x], word_lengths[x] - offset in text and length of the x-th
+                                       distinct word in lexicographic order.
+     sorted[x] - word line of the x-th distinct word; of equal words, the
+                 first one in the file.
+     common[x] - length of the common prefix of the (x-1)-th and x-th
+                 distinct words, 0 for x = 0.
+     ranks[x] - number of distinct words that appear in the file for the
+                first time before the x-th one.
+*/
+typedef struct{
+    const char* data;
+    long size;
+    int line_count;
+    long* starts;
+    int* lengths;
+    int count;
+    const char* text;
+    char* copy;
+    long* word_starts;
+    int* word_lengths;
+    int* sorted;
+    int* common;
+    int* ranks;
+} WordList;
+
+// read a word list from a file. Returns -1 on fail, 1 otherwise
+int word_list_read(WordList* list, const char* path);
+
+// pointer to the x-th distinct word in lexicographic order
+static inline const char* word_list_word(const WordList* list, int x){
+    return list->text + list->word_starts[x];
+}
+
+// length of the x-th distinct word in lexicographic order
+static inline int word_list_length(const WordList* list, int x){
+    return list->word_lengths[x];
+}
+
+// unmap the file and free everything the list holds
+void word_list_release(WordList* list);
@@ -0,0 +1,214 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include "workload.h"
+
+
+void workload_defaults(Workload* workload){
+    memset(workload, 0, sizeof(Workload));
+    workload->seed = 1;
+    workload->commands = 1000000;
+    workload->weights[0] = 30;  // insert
+    workload->weights[1] = 10;  // prev
+    workload->weights[2] = 10;  // delete
+    workload->weights[3] = 50;  // find
+    workload->weights[4] = 0;   // clear
+    workload->distribution = LENGTH_UNIFORM;
+    workload->length_min = 1;
+    workload->length_max = 16;
+    workload->length_mean = 8;
+    workload->shared_prefix = 0.3;
+    workload->dictionary_size = 100000;
+    workload->letters = 26;
+}
+
+
+int workload_option(Workload* workload, int argc, char* argv[], int index){
+    const char* name = argv[index];
+    if (strncmp(name, "--", 2) != 0 || index + 1 >= argc){
+        return 0;
+    }
+    const char* value = argv[index + 1];
+    if (strcmp(name, "--seed") == 0){
+        workload->seed = strtoull(value, NULL, 10);
+    }
+    else if (strcmp(name, "--commands") == 0){
+        workload->commands = atol(value);
+    }
+    else if (strcmp(name, "--mix") == 0){
+        // insert:prev:delete:find:clear
+        int* w = workload->weights;
+        if (sscanf(value, "%d:%d:%d:%d:%d", &w[0], &w[1], &w[2], &w[3], &w[4]) != 5){
+            return -1;
+        }
+    }
+    else if (strcmp(name, "--lengths") == 0){
+        // uniform:min:max or geometric:min:max:mean
+        if (sscanf(value, "uniform:%d:%d", &workload->length_min, &workload->length_max) == 2){
+            workload->distribution = LENGTH_UNIFORM;
+        }
+        else if (sscanf(value, "geometric:%d:%d:%lf", &workload->length_min,
+                        &workload->length_max, &workload->length_mean) == 3){
+            workload->distribution = LENGTH_GEOMETRIC;
+        }
+        else{
+            return -1;
+        }
+    }
+    else if (strcmp(name, "--shared-prefix") == 0){
+        workload->shared_prefix = atof(value);
+    }
+    else if (strcmp(name, "--dictionary") == 0){
+        workload->dictionary_size = atoi(value);
+    }
+    else if (strcmp(name, "--letters") == 0){
+        workload->letters = atoi(value);
+    }
+    else{
+        return 0;
+    }
+    return 2;
+}
+
+
+int workload_start(Workload* workload){
+    int sum = 0;
+    for (int i = 0; i < 5; ++i){
+        if (workload->weights[i] < 0){
+            return -1;
+        }
+        sum += workload->weights[i];
+    }
+    if (sum == 0 || workload->length_min < 1 || workload->length_max < workload->length_min ||
+        workload->length_max > WORKLOAD_MAX_LENGTH || workload->dictionary_size < 1 ||
+        workload->letters < 1 || workload->letters > 26){
+        return -1;
+    }
+    workload->state = workload->seed * 0x9E3779B97F4A7C15ull + 1;
+    workload->words = malloc(workload->dictionary_size * sizeof(char*));
+    workload->lengths = malloc(workload->dictionary_size * sizeof(int));
+    workload->word_count = 0;
+    workload->next_id = 0;
+    if (workload->words == NULL || workload->lengths == NULL){
+        workload_release(workload);
+        return -1;
+    }
+    return 1;
+}
+
+
+// xorshift64*
+uint32_t workload_random(Workload* workload, uint32_t bound){
+    uint64_t x = workload->state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    workload->state = x;
+    return ((x * 0x2545F4914F6CDD1Dull) >> 32) % bound;
+}
+
+
+// random number in [0, 1)
+double random_fraction(Workload* workload){
+    return workload_random(workload, 1u << 30) / (double)(1u << 30);
+}
+
+
+int random_length(Workload* workload){
+    int span = workload->length_max - workload->length_min + 1;
+    if (workload->distribution == LENGTH_UNIFORM){
+        return workload->length_min + workload_random(workload, span);
+    }
+    double mean = workload->length_mean > 0 ? workload->length_mean : 1;
+    double extra = floor(log(1 - random_fraction(workload)) / log(mean / (mean + 1)));
+    return extra >= span ? workload->length_max : workload->length_min + (int)extra;
+}
+
+
+int workload_word(Workload* workload, char* buffer){
+    if (workload->word_count == workload->dictionary_size){
+        int x = workload_random(workload, workload->word_count);
+        memcpy(buffer, workload->words[x], workload->lengths[x]);
+        return workload->lengths[x];
+    }
+
+    int length = random_length(workload);
+    int start = 0;
+    if (workload->word_count > 0 && random_fraction(workload) < workload->shared_prefix){
+        int x = workload_random(workload, workload->word_count);
+        start = 1 + workload_random(workload, workload->lengths[x]);
+        if (start > length){
+            start = length;
+        }
+        memcpy(buffer, workload->words[x], start);
+    }
+    for (int i = start; i < length; ++i){
+        buffer[i] = 'a' + workload_random(workload, workload->letters);
+    }
+
+    char* copy = malloc(length);
+    if (copy != NULL){
+        memcpy(copy, buffer, length);
+        workload->words[workload->word_count] = copy;
+        workload->lengths[workload->word_count] = length;
+        ++workload->word_count;
+    }
+    return length;
+}
+
+
+int workload_command(Workload* workload, char* buffer){
+    int sum = 0;
+    for (int i = 0; i < 5; ++i){
+        sum += workload->weights[i];
+    }
+    int pick = workload_random(workload, sum);
+    int type = 0;
+    while (pick >= workload->weights[type]){
+        pick -= workload->weights[type];
+        ++type;
+    }
+
+    int length;
+    int ids = workload->next_id > 0 ? workload->next_id : 1;
+    switch (type){
+    case 0:
+        length = sprintf(buffer, "insert ");
+        length += workload_word(workload, buffer + length);
+        ++workload->next_id;
+        break;
+    case 1:{
+        int start = workload_random(workload, workload->length_max);
+        int end = start + workload_random(workload, workload->length_max);
+        length = sprintf(buffer, "prev %d %d %d", (int)workload_random(workload, ids), start, end);
+        ++workload->next_id;
+        break;
+    }
+    case 2:
+        length = sprintf(buffer, "delete %d", (int)workload_random(workload, ids));
+        break;
+    case 3:
+        length = sprintf(buffer, "find ");
+        length += workload_word(workload, buffer + length);
+        break;
+    default:
+        length = sprintf(buffer, "clear");
+        workload->next_id = 0;
+        break;
+    }
+    buffer[length] = '\0';
+    return length;
+}
+
+
+void workload_release(Workload* workload){
+    for (int i = 0; i < workload->word_count; ++i){
+        free(workload->words[i]);
+    }
+    free(workload->words);
+    free(workload->lengths);
+    workload->words = NULL;
+    workload->lengths = NULL;
+    workload->word_count = 0;
+}
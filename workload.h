@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdint.h>
+
+#define WORKLOAD_MAX_LENGTH 4096  // longest word a workload may contain
+
+typedef enum{
+    LENGTH_UNIFORM,    // every length in [length_min, length_max] equally likely
+    LENGTH_GEOMETRIC   // length_min + a geometric variable with mean length_mean,
+                       //  cut at length_max
+} length_distribution;
+
+/* WORKLOAD - parameters of a synthetic command stream, and its state.
+     weights - relative frequencies of insert, prev, delete, find and clear.
+     shared_prefix - probability that a new word starts with a prefix of a
+                     word generated before.
+     dictionary_size - number of distinct words that inserts and finds draw
+                       from; later words repeat earlier ones.
+     letters - words use the first `letters` small letters.
+   The generated ids follow the rules of the dictionary program, so prev and
+   delete mostly refer to words that exist.
+*/
+typedef struct{
+    uint64_t seed;
+    long commands;
+    int weights[5];
+    length_distribution distribution;
+    int length_min;
+    int length_max;
+    double length_mean;
+    double shared_prefix;
+    int dictionary_size;
+    int letters;
+
+    uint64_t state;
+    char** words;       // words generated so far, at most dictionary_size
+    int* lengths;
+    int word_count;
+    int next_id;        // id the next insert or prev is expected to get
+} Workload;
+
+// set the default parameters: 1M commands, a mix dominated by finds,
+//  uniform lengths in [1, 16], 30% shared prefixes, 100k distinct words
+void workload_defaults(Workload* workload);
+
+// apply a "--name value" option, returns the number of arguments used:
+//  2 if it was a workload option, 0 if it wasn't, -1 if its value is wrong
+int workload_option(Workload* workload, int argc, char* argv[], int index);
+
+// allocate the state of a workload with final parameters. Returns -1 on fail
+int workload_start(Workload* workload);
+
+// store a word in buffer (at least WORKLOAD_MAX_LENGTH + 1 bytes) and
+//  return its length; it's either a new word or one generated before
+int workload_word(Workload* workload, char* buffer);
+
+// store the next command line, without endline, in buffer (at least
+//  WORKLOAD_MAX_LENGTH + 32 bytes) and return its length
+int workload_command(Workload* workload, char* buffer);
+
+// random number in [0, bound)
+uint32_t workload_random(Workload* workload, uint32_t bound);
+
+// free the state of a workload
+void workload_release(Workload* workload);